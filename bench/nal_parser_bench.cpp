@@ -0,0 +1,191 @@
+// Microbenchmark: shared NAL parser vs. the byte-by-byte scanners it replaced.
+//
+// Usage: nal_parser_bench [frame.h264 ...]
+// Each file is treated as one V4L2 buffer (e.g. a dumped 1080p IDR frame).
+// Without arguments a synthetic 1080p-sized IDR access unit is used.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "h264_nal_parser.h"
+
+typedef std::vector<uint8_t> Buffer;
+static const size_t MAX_NALS = 64;
+
+// Scanner from the old v4l2Capture::extractSpsPps (4-byte start codes only)
+static size_t legacyExtractScan(const uint8_t* frame, size_t frameSize) {
+    size_t nals = 0;
+    size_t offset = 0;
+    while (offset + 4 < frameSize) {
+        if (frame[offset] == 0 && frame[offset+1] == 0 &&
+            frame[offset+2] == 0 && frame[offset+3] == 1) {
+            offset += 4;
+            if (offset >= frameSize) break;
+            size_t nextNalOffset = offset;
+            while (nextNalOffset + 4 < frameSize) {
+                if (frame[nextNalOffset] == 0 && frame[nextNalOffset+1] == 0 &&
+                    frame[nextNalOffset+2] == 0 && frame[nextNalOffset+3] == 1) {
+                    break;
+                }
+                nextNalOffset++;
+            }
+            nals++;
+            offset = nextNalOffset;
+        } else {
+            offset++;
+        }
+    }
+    return nals;
+}
+
+// Scanner from the old v4l2Capture::extractSpsPpsImmediate
+static size_t legacyImmediateScan(const uint8_t* frame, size_t frameSize) {
+    size_t nals = 0;
+    size_t offset = 0;
+    while (offset + 4 < frameSize) {
+        if (frame[offset] == 0x00 && frame[offset+1] == 0x00 &&
+            ((frame[offset+2] == 0x00 && frame[offset+3] == 0x01) ||
+             (frame[offset+2] == 0x01))) {
+            size_t startCodeSize = (frame[offset+2] == 0x00) ? 4 : 3;
+            size_t nalStart = offset + startCodeSize;
+            if (nalStart >= frameSize) break;
+            size_t nextNalOffset = nalStart;
+            while (nextNalOffset + 3 < frameSize) {
+                if (frame[nextNalOffset] == 0x00 && frame[nextNalOffset+1] == 0x00 &&
+                    (frame[nextNalOffset+2] == 0x01 ||
+                     (nextNalOffset + 3 < frameSize && frame[nextNalOffset+2] == 0x00 &&
+                      frame[nextNalOffset+3] == 0x01))) {
+                    break;
+                }
+                nextNalOffset++;
+            }
+            nals++;
+            offset = nextNalOffset;
+        } else {
+            offset++;
+        }
+    }
+    return nals;
+}
+
+// The old getFrameWithoutStartCode stripped the start code with memmove
+static size_t legacyStripStartCode(uint8_t* frame, size_t length) {
+    if (length > 3 && frame[0] == 0x00 && frame[1] == 0x00 &&
+        ((frame[2] == 0x00 && frame[3] == 0x01) || frame[2] == 0x01)) {
+        size_t startCodeSize = (frame[2] == 0x00) ? 4 : 3;
+        memmove(frame, frame + startCodeSize, length - startCodeSize);
+        length -= startCodeSize;
+    }
+    return length;
+}
+
+static size_t scalarSplit(const uint8_t* data, size_t size) {
+    size_t nals = 0;
+    size_t start = findStartCodeScalar(data, size, 0);
+    while (start < size) {
+        start = findStartCodeScalar(data, size, start + 3);
+        nals++;
+    }
+    return nals;
+}
+
+static size_t simdSplit(const uint8_t* data, size_t size) {
+    NalUnit units[MAX_NALS];
+    return splitNalUnits(data, size, units, MAX_NALS);
+}
+
+// Emulation-prevented random payload, as an encoder would produce
+static void appendPayload(Buffer& out, size_t bytes, std::mt19937& rng) {
+    size_t zeros = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        uint8_t b = static_cast<uint8_t>(rng());
+        if (zeros >= 2 && b <= 3) {
+            out.push_back(0x03);
+            zeros = 0;
+        }
+        out.push_back(b);
+        zeros = (b == 0) ? zeros + 1 : 0;
+    }
+    out.push_back(0x80);  // rbsp_stop_one_bit
+}
+
+static Buffer syntheticIdr() {
+    std::mt19937 rng(1080);
+    Buffer frame;
+    const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28};
+    const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xEE, 0x3C, 0x80};
+    frame.insert(frame.end(), sps, sps + sizeof(sps));
+    appendPayload(frame, 12, rng);
+    frame.insert(frame.end(), pps, pps + sizeof(pps));
+    // Four IDR slices of ~60 KB, typical of a 1080p keyframe at 8 Mbps
+    for (int slice = 0; slice < 4; ++slice) {
+        const uint8_t idr[] = {0, 0, 1, 0x65};
+        frame.insert(frame.end(), idr, idr + sizeof(idr));
+        appendPayload(frame, 60 * 1024, rng);
+    }
+    return frame;
+}
+
+template <typename Fn>
+static void run(const char* name, const std::vector<Buffer>& frames, int iterations, Fn fn) {
+    size_t bytes = 0;
+    size_t nals = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (const Buffer& frame : frames) {
+            nals += fn(frame);
+            bytes += frame.size();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double perFrameUs = seconds * 1e6 / (iterations * frames.size());
+    printf("%-28s %9.1f us/frame %9.1f MB/s  (%zu NALs/frame)\n", name, perFrameUs,
+           bytes / seconds / 1e6, nals / (iterations * frames.size()));
+}
+
+int main(int argc, char** argv) {
+    std::vector<Buffer> frames;
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in) {
+            fprintf(stderr, "Cannot open %s\n", argv[i]);
+            return 1;
+        }
+        frames.push_back(Buffer(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+    }
+    if (frames.empty()) frames.push_back(syntheticIdr());
+
+    size_t total = 0;
+    for (const Buffer& frame : frames) total += frame.size();
+    printf("%zu frame(s), %zu bytes on average\n", frames.size(), total / frames.size());
+
+    const int iterations = 200;
+    run("legacy extractSpsPps", frames, iterations, [](const Buffer& f) {
+        return legacyExtractScan(f.data(), f.size());
+    });
+    run("legacy extractSpsPpsImmediate", frames, iterations, [](const Buffer& f) {
+        return legacyImmediateScan(f.data(), f.size());
+    });
+    run("scalar findStartCode", frames, iterations, [](const Buffer& f) {
+        return scalarSplit(f.data(), f.size());
+    });
+    run("splitNalUnits", frames, iterations, [](const Buffer& f) {
+        return simdSplit(f.data(), f.size());
+    });
+
+    // Start-code stripping: memmove of the whole frame vs. a pointer offset
+    Buffer scratch;
+    run("legacy strip (memmove)", frames, iterations, [&scratch](const Buffer& f) {
+        scratch = f;
+        return legacyStripStartCode(scratch.data(), scratch.size()) > 0 ? 1 : 0;
+    });
+    run("startCodeLength (offset)", frames, iterations, [&scratch](const Buffer& f) {
+        scratch = f;
+        return startCodeLength(scratch.data(), scratch.size()) > 0 ? 1 : 0;
+    });
+    return 0;
+}
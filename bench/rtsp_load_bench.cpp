@@ -0,0 +1,488 @@
+// End-to-end load benchmark: the server on a file-replay source, N RTSP
+// clients on loopback.
+//
+// Usage: rtsp_load_bench [-c clients] [-s streams] [-d seconds] [-p port]
+//                        [-t] [-l label] [-o results.json] [recording]
+// The server runs in a forked child with 'streams' replay cameras of the
+// recording (.h264 or .v4l2dump); without one a synthetic stream at the
+// default size, bitrate and fps is generated. Clients are spread over the
+// streams and receive over UDP, or RTP-over-TCP with -t.
+// Measured: sustained fps and time to first frame per client, capture to
+// receive latency (once RTCP has synchronized the client's clock), and the
+// server's CPU use and RSS. The JSON result carries the label (e.g. the
+// commit) so runs can be compared.
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <liveMedia.hh>
+#include <BasicUsageEnvironment.hh>
+#include <GroupsockHelper.hh>
+#include "latency_histogram.h"
+#include "live555_rtsp_server_manager.h"
+#include "logger.h"
+
+static const unsigned SINK_BUFFER_SIZE = 1024 * 1024;
+static const unsigned SERVER_START_TIMEOUT_MS = 5000;
+
+// ---------------------------------------------------------------------------
+// Server side (forked child)
+
+static char serverShouldExit = 0;
+
+static void serverSignalHandler(int) {
+    serverShouldExit = 1;
+}
+
+static int runServer(const std::string& recording, int streams, int port) {
+    signal(SIGTERM, serverSignalHandler);
+    signal(SIGINT, serverSignalHandler);
+
+    TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+    UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+    std::vector<DeviceConfig> devices;
+    for (int i = 0; i < streams; ++i) {
+        DeviceConfig config;
+        config.device = recording;
+        config.streamName = "bench" + std::to_string(i);
+        config.adaptiveBitrate = false;
+        devices.push_back(config);
+    }
+
+    Live555RTSPServerManager manager(env, devices, port, 0);
+    if (!manager.initialize()) {
+        logShutdown();
+        return 1;
+    }
+    manager.runEventLoop(&serverShouldExit);
+    manager.cleanup();
+    delete scheduler;
+    env->reclaim();
+    logShutdown();
+    return 0;
+}
+
+// Payload bytes without zeros, so no start code is emulated
+static void appendNal(std::string& out, const uint8_t* header, size_t headerSize, size_t payload,
+                      std::mt19937& random) {
+    static const uint8_t startCode[] = { 0, 0, 0, 1 };
+    out.append(reinterpret_cast<const char*>(startCode), sizeof(startCode));
+    out.append(reinterpret_cast<const char*>(header), headerSize);
+    for (size_t i = 0; i < payload; ++i) out += static_cast<char>(1 + random() % 255);
+}
+
+// Two GOPs of the default GOP_SIZE at VIDEO_BITRATE and the default fps;
+// the IDR gets four times the size of a P frame
+static bool writeSyntheticStream(const std::string& path) {
+    static const uint8_t sps[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84,
+                                   0x00, 0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60 };
+    static const uint8_t pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+    static const uint8_t idr[] = { 0x65, 0x88 };
+    static const uint8_t slice[] = { 0x41, 0x9a };
+
+    DeviceConfig defaults;
+    size_t gopBytes = size_t(defaults.bitrate) / 8 * defaults.gopSize / (1000000 / defaults.frameMicros());
+    size_t pBytes = gopBytes / (defaults.gopSize + 3);
+    std::mt19937 random(1);
+    std::string stream;
+    for (int gop = 0; gop < 2; ++gop) {
+        appendNal(stream, sps, sizeof(sps), 0, random);
+        appendNal(stream, pps, sizeof(pps), 0, random);
+        appendNal(stream, idr, sizeof(idr), pBytes * 4, random);
+        for (int i = 1; i < defaults.gopSize; ++i) appendNal(stream, slice, sizeof(slice), pBytes, random);
+    }
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file.write(stream.data(), stream.size());
+    return file.good();
+}
+
+static bool waitForServer(int port) {
+    for (unsigned waited = 0; waited < SERVER_START_TIMEOUT_MS; waited += 50) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool up = connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(sock);
+        if (up) return true;
+        usleep(50000);
+    }
+    return false;
+}
+
+// utime + stime of a process, in nanoseconds
+static uint64_t processCpuNanos(pid_t pid) {
+    std::ifstream file(("/proc/" + std::to_string(pid) + "/stat").c_str());
+    std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    size_t end = stat.rfind(')');
+    if (end == std::string::npos) return 0;
+    std::istringstream fields(stat.substr(end + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    // Fields after the command name start at 3 (state); utime is 14
+    for (int i = 3; i <= 15 && fields >> field; ++i) {
+        if (i == 14) utime = strtoull(field.c_str(), nullptr, 10);
+        if (i == 15) stime = strtoull(field.c_str(), nullptr, 10);
+    }
+    return (utime + stime) * 1000000000ULL / sysconf(_SC_CLK_TCK);
+}
+
+// A "VmRSS:"-style field of /proc/<pid>/status, in kB
+static unsigned long statusKb(pid_t pid, const std::string& key) {
+    std::ifstream file(("/proc/" + std::to_string(pid) + "/status").c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0) return strtoul(line.c_str() + key.size(), nullptr, 10);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Client side
+
+class BenchClient;
+
+// Counts access units (a change of presentation time) and their latency
+class BenchSink : public MediaSink {
+public:
+    static BenchSink* createNew(UsageEnvironment& env, BenchClient* client) { return new BenchSink(env, client); }
+
+protected:
+    BenchSink(UsageEnvironment& env, BenchClient* client)
+        : MediaSink(env), client(client), buffer(new u_int8_t[SINK_BUFFER_SIZE]) {}
+    virtual ~BenchSink() { delete[] buffer; }
+
+private:
+    static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes,
+                                  struct timeval presentationTime, unsigned durationInMicroseconds);
+    void afterGettingFrame(struct timeval presentationTime);
+    virtual Boolean continuePlaying();
+
+    BenchClient* client;
+    u_int8_t* buffer;
+};
+
+class BenchClient : public RTSPClient {
+public:
+    static BenchClient* createNew(UsageEnvironment& env, const std::string& url, bool tcp,
+                                  LatencyHistogram* allLatency) {
+        return new BenchClient(env, url, tcp, allLatency);
+    }
+    void start();
+    void stop();
+
+    bool tcp;
+    MediaSession* session;
+    MediaSubsession* subsession;
+    uint64_t startNanos;
+    uint64_t playNanos;         // PLAY response, 0 until then
+    uint64_t firstFrameNanos;   // 0 until the first access unit
+    uint64_t lastFrameNanos;
+    uint64_t frames;
+    struct timeval lastPresentationTime;
+    LatencyHistogram latency;
+    LatencyHistogram* allLatency;  // Shared by every client
+    std::string error;
+
+protected:
+    BenchClient(UsageEnvironment& env, const std::string& url, bool tcp, LatencyHistogram* allLatency)
+        : RTSPClient(env, url.c_str(), 0, "rtsp_load_bench", 0, -1), tcp(tcp), session(nullptr),
+          subsession(nullptr), startNanos(0), playNanos(0), firstFrameNanos(0), lastFrameNanos(0), frames(0),
+          lastPresentationTime(), allLatency(allLatency) {}
+    virtual ~BenchClient() {}
+
+private:
+    static void continueAfterDescribe(RTSPClient* rtspClient, int resultCode, char* resultString);
+    static void continueAfterSetup(RTSPClient* rtspClient, int resultCode, char* resultString);
+    static void continueAfterPlay(RTSPClient* rtspClient, int resultCode, char* resultString);
+    void fail(const std::string& what, char* resultString);
+};
+
+void BenchSink::afterGettingFrame(void* clientData, unsigned, unsigned, struct timeval presentationTime, unsigned) {
+    static_cast<BenchSink*>(clientData)->afterGettingFrame(presentationTime);
+}
+
+void BenchSink::afterGettingFrame(struct timeval presentationTime) {
+    uint64_t now = monotonicNanos();
+    // The H.264 RTP source hands out NAL units; a new access unit has a
+    // new presentation time
+    if (presentationTime.tv_sec != client->lastPresentationTime.tv_sec ||
+        presentationTime.tv_usec != client->lastPresentationTime.tv_usec) {
+        client->lastPresentationTime = presentationTime;
+        if (client->frames++ == 0) client->firstFrameNanos = now;
+        client->lastFrameNanos = now;
+
+        // Presentation times are capture wall-clock times once RTCP has
+        // synchronized them, and both ends share this host's clock
+        RTPSource* rtpSource = client->subsession->rtpSource();
+        if (rtpSource != nullptr && rtpSource->hasBeenSynchronizedUsingRTCP()) {
+            struct timeval wall;
+            gettimeofday(&wall, nullptr);
+            int64_t micros = (int64_t(wall.tv_sec) - presentationTime.tv_sec) * 1000000LL +
+                             (int64_t(wall.tv_usec) - presentationTime.tv_usec);
+            if (micros >= 0) {
+                client->latency.record(micros);
+                client->allLatency->record(micros);
+            }
+        }
+    }
+    continuePlaying();
+}
+
+Boolean BenchSink::continuePlaying() {
+    if (fSource == nullptr) return False;
+    fSource->getNextFrame(buffer, SINK_BUFFER_SIZE, afterGettingFrame, this, onSourceClosure, this);
+    return True;
+}
+
+void BenchClient::start() {
+    startNanos = monotonicNanos();
+    sendDescribeCommand(continueAfterDescribe);
+}
+
+void BenchClient::stop() {
+    if (subsession != nullptr && subsession->sink != nullptr) {
+        subsession->sink->stopPlaying();
+        Medium::close(subsession->sink);
+        subsession->sink = nullptr;
+    }
+    if (session != nullptr) {
+        sendTeardownCommand(*session, nullptr);
+        Medium::close(session);
+        session = nullptr;
+    }
+}
+
+void BenchClient::fail(const std::string& what, char* resultString) {
+    error = what + (resultString != nullptr ? ": " + std::string(resultString) : std::string());
+    fprintf(stderr, "%s: %s\n", url(), error.c_str());
+}
+
+void BenchClient::continueAfterDescribe(RTSPClient* rtspClient, int resultCode, char* resultString) {
+    BenchClient* client = static_cast<BenchClient*>(rtspClient);
+    if (resultCode != 0) {
+        client->fail("DESCRIBE failed", resultString);
+        delete[] resultString;
+        return;
+    }
+    client->session = MediaSession::createNew(client->envir(), resultString);
+    delete[] resultString;
+    if (client->session == nullptr || !client->session->hasSubsessions()) {
+        client->fail("bad SDP", nullptr);
+        return;
+    }
+
+    MediaSubsessionIterator iter(*client->session);
+    client->subsession = iter.next();
+    if (!client->subsession->initiate()) {
+        client->fail("subsession initiate failed", nullptr);
+        return;
+    }
+    // High bitrates arrive in bursts on loopback
+    if (client->subsession->rtpSource() != nullptr) {
+        increaseReceiveBufferTo(client->envir(), client->subsession->rtpSource()->RTPgs()->socketNum(),
+                                4 * 1024 * 1024);
+    }
+    client->sendSetupCommand(*client->subsession, continueAfterSetup, False, client->tcp);
+}
+
+void BenchClient::continueAfterSetup(RTSPClient* rtspClient, int resultCode, char* resultString) {
+    BenchClient* client = static_cast<BenchClient*>(rtspClient);
+    if (resultCode != 0) {
+        client->fail("SETUP failed", resultString);
+        delete[] resultString;
+        return;
+    }
+    delete[] resultString;
+
+    client->subsession->sink = BenchSink::createNew(client->envir(), client);
+    client->subsession->sink->startPlaying(*client->subsession->readSource(), nullptr, nullptr);
+    client->sendPlayCommand(*client->session, continueAfterPlay);
+}
+
+void BenchClient::continueAfterPlay(RTSPClient* rtspClient, int resultCode, char* resultString) {
+    BenchClient* client = static_cast<BenchClient*>(rtspClient);
+    if (resultCode != 0) client->fail("PLAY failed", resultString);
+    else client->playNanos = monotonicNanos();
+    delete[] resultString;
+}
+
+// ---------------------------------------------------------------------------
+
+static char clientsShouldExit = 0;
+
+static void endOfRun(void*) {
+    clientsShouldExit = 1;
+}
+
+static double millis(uint64_t nanos) {
+    return nanos / 1e6;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-c clients] [-s streams] [-d seconds] [-p port] [-t] [-l label] "
+                    "[-o results.json] [recording.h264|recording%s]\n", name, FRAME_DUMP_EXTENSION);
+}
+
+int main(int argc, char** argv) {
+    int clientCount = 8;
+    int streams = 1;
+    int seconds = 20;
+    int port = 18554;
+    bool tcp = false;
+    std::string label;
+    std::string output;
+    std::string recording;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-c" && hasValue) clientCount = atoi(argv[++i]);
+        else if (arg == "-s" && hasValue) streams = atoi(argv[++i]);
+        else if (arg == "-d" && hasValue) seconds = atoi(argv[++i]);
+        else if (arg == "-p" && hasValue) port = atoi(argv[++i]);
+        else if (arg == "-l" && hasValue) label = argv[++i];
+        else if (arg == "-o" && hasValue) output = argv[++i];
+        else if (arg == "-t") tcp = true;
+        else if (arg[0] != '-' && recording.empty()) recording = arg;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (clientCount < 1 || streams < 1 || seconds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bool synthetic = recording.empty();
+    if (synthetic) {
+        recording = "/tmp/rtsp_load_bench_" + std::to_string(getpid()) + ".h264";
+        if (!writeSyntheticStream(recording)) {
+            fprintf(stderr, "Cannot write %s\n", recording.c_str());
+            return 1;
+        }
+    }
+
+    // Fork before anything starts a thread or an event loop
+    pid_t server = fork();
+    if (server < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (server == 0) _exit(runServer(recording, streams, port));
+
+    if (!waitForServer(port)) {
+        fprintf(stderr, "Server did not start on port %d\n", port);
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+        if (synthetic) unlink(recording.c_str());
+        return 1;
+    }
+
+    TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+    UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+    LatencyHistogram allLatency;
+    std::vector<BenchClient*> clients;
+    for (int i = 0; i < clientCount; ++i) {
+        std::string url = "rtsp://127.0.0.1:" + std::to_string(port) + "/bench" + std::to_string(i % streams);
+        clients.push_back(BenchClient::createNew(*env, url, tcp, &allLatency));
+    }
+
+    uint64_t runStart = monotonicNanos();
+    uint64_t serverCpuStart = processCpuNanos(server);
+    for (size_t i = 0; i < clients.size(); ++i) clients[i]->start();
+    scheduler->scheduleDelayedTask(int64_t(seconds) * 1000000, endOfRun, nullptr);
+    env->taskScheduler().doEventLoop(&clientsShouldExit);
+    uint64_t runNanos = monotonicNanos() - runStart;
+    uint64_t serverCpu = processCpuNanos(server) - serverCpuStart;
+    unsigned long rssKb = statusKb(server, "VmRSS:");
+    unsigned long peakRssKb = statusKb(server, "VmHWM:");
+
+    // Per-client results plus the spread across clients
+    LatencyHistogram firstFrame;
+    std::ostringstream perClient;
+    double minFps = 0, sumFps = 0;
+    int playing = 0;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        BenchClient* client = clients[i];
+        double fps = 0;
+        if (client->frames > 1 && client->lastFrameNanos > client->firstFrameNanos) {
+            fps = (client->frames - 1) * 1e9 / (client->lastFrameNanos - client->firstFrameNanos);
+        }
+        if (client->frames > 0) {
+            firstFrame.record((client->firstFrameNanos - client->startNanos) / 1000);
+            if (playing == 0 || fps < minFps) minFps = fps;
+            sumFps += fps;
+            ++playing;
+        }
+
+        perClient << (i ? "," : "") << "\n    {\"url\": \"" << client->url() << "\""
+                  << ", \"frames\": " << client->frames
+                  << ", \"fps\": " << fps
+                  << ", \"play_ms\": " << (client->playNanos ? millis(client->playNanos - client->startNanos) : -1)
+                  << ", \"first_frame_ms\": "
+                  << (client->firstFrameNanos ? millis(client->firstFrameNanos - client->startNanos) : -1)
+                  << ", \"latency_samples\": " << client->latency.count()
+                  << ", \"latency_p50_ms\": " << client->latency.percentile(0.5) / 1000.0
+                  << ", \"latency_p99_ms\": " << client->latency.percentile(0.99) / 1000.0
+                  << ", \"error\": \"" << client->error << "\"}";
+    }
+
+    double cpuPercent = runNanos ? 100.0 * serverCpu / runNanos : 0;
+    std::ostringstream json;
+    json << "{\n  \"label\": \"" << label << "\""
+         << ",\n  \"source\": \"" << (synthetic ? "synthetic" : recording) << "\""
+         << ",\n  \"transport\": \"" << (tcp ? "tcp" : "udp") << "\""
+         << ",\n  \"clients\": " << clientCount
+         << ",\n  \"streams\": " << streams
+         << ",\n  \"duration_s\": " << runNanos / 1e9
+         << ",\n  \"clients_playing\": " << playing
+         << ",\n  \"fps_min\": " << minFps
+         << ",\n  \"fps_avg\": " << (playing ? sumFps / playing : 0)
+         << ",\n  \"first_frame_p50_ms\": " << firstFrame.percentile(0.5) / 1000.0
+         << ",\n  \"first_frame_max_ms\": " << firstFrame.percentile(1.0) / 1000.0
+         << ",\n  \"latency_p50_ms\": " << allLatency.percentile(0.5) / 1000.0
+         << ",\n  \"latency_p95_ms\": " << allLatency.percentile(0.95) / 1000.0
+         << ",\n  \"latency_p99_ms\": " << allLatency.percentile(0.99) / 1000.0
+         << ",\n  \"server_cpu_percent\": " << cpuPercent
+         << ",\n  \"server_cpu_percent_per_stream\": " << cpuPercent / streams
+         << ",\n  \"server_rss_kb\": " << rssKb
+         << ",\n  \"server_peak_rss_kb\": " << peakRssKb
+         << ",\n  \"per_client\": [" << perClient.str() << "\n  ]\n}\n";
+
+    for (size_t i = 0; i < clients.size(); ++i) {
+        clients[i]->stop();
+        Medium::close(clients[i]);
+    }
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    if (synthetic) unlink(recording.c_str());
+
+    if (output.empty()) {
+        fputs(json.str().c_str(), stdout);
+    } else {
+        std::ofstream file(output.c_str());
+        file << json.str();
+        fprintf(stderr, "Results written to %s\n", output.c_str());
+    }
+    env->reclaim();
+    delete scheduler;
+    return playing == clientCount ? 0 : 2;
+}
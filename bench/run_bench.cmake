@@ -0,0 +1,18 @@
+# Runs rtsp_load_bench for the 'bench' target. Invoked with cmake -P so
+# the label is the commit checked out when the benchmark runs, not the
+# one that was configured.
+#   -DBENCH=<rtsp_load_bench> -DSOURCE_DIR=<repo> -DOUTPUT=<bench.json>
+#   -DCLIENTS=<n> -DSECONDS=<n> [-DRECORDING=<file>]
+
+execute_process(COMMAND git rev-parse --short HEAD
+                WORKING_DIRECTORY ${SOURCE_DIR}
+                OUTPUT_VARIABLE LABEL OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET)
+
+set(ARGS -c ${CLIENTS} -d ${SECONDS} -l "${LABEL}" -o ${OUTPUT})
+if(RECORDING)
+    list(APPEND ARGS ${RECORDING})
+endif()
+execute_process(COMMAND ${BENCH} ${ARGS} RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "rtsp_load_bench failed: ${RESULT}")
+endif()
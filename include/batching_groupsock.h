@@ -0,0 +1,52 @@
+#ifndef BATCHING_GROUPSOCK_H
+#define BATCHING_GROUPSOCK_H
+
+#include <vector>
+#include <liveMedia.hh>
+#include <Groupsock.hh>
+#include "capture_device.h"
+
+// Groupsock for a client's RTP port that turns the one sendto() per RTP
+// packet of H264VideoRTPSink into one sendmmsg() per access unit and
+// destination. Packets are queued until the one with the RTP marker bit
+// (end of the access unit), RTP_BATCH_MAX_PACKETS, or RTP_BATCH_FLUSH_US.
+// With RTP_EGRESS_GSO, runs of equal-sized packets (the FU-A fragments of
+// a NAL unit) go out as UDP_SEGMENT super-datagrams, and GSO is switched
+// off for the socket if the kernel rejects it. Multicast destinations are
+// written directly.
+class BatchingGroupsock : public Groupsock {
+public:
+    BatchingGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr, Port port,
+                      u_int8_t ttl, CaptureDevice* capture);
+    virtual ~BatchingGroupsock();
+
+    // Called by Groupsock::output() for every destination
+    virtual Boolean write(struct sockaddr_storage const& addressAndPort, u_int8_t ttl,
+                          unsigned char* buffer, unsigned bufferSize);
+    void flush();
+
+private:
+    struct Batch {
+        struct sockaddr_storage destination;
+        std::vector<unsigned char> data;   // Packets back to back
+        std::vector<unsigned> sizes;
+    };
+
+    Batch& batchFor(struct sockaddr_storage const& destination);
+    void send(Batch& batch);
+    // Fills fMessages and fIovecs; returns the message count
+    unsigned buildMessages(Batch& batch, bool gso);
+    static void flushTask(void* clientData);
+
+    CaptureDevice* fCapture;
+    std::vector<Batch> fBatches;   // One per destination, usually one
+    TaskToken fFlushTask;
+    bool fGso;
+
+    // Scratch for sendmmsg(), kept to avoid per-flush allocations
+    std::vector<struct mmsghdr> fMessages;
+    std::vector<struct iovec> fIovecs;
+    std::vector<char> fControl;
+};
+
+#endif // BATCHING_GROUPSOCK_H
@@ -0,0 +1,37 @@
+#ifndef BITRATE_CONTROLLER_H
+#define BITRATE_CONTROLLER_H
+
+#include <cstdint>
+#include <mutex>
+#include "capture_device.h"
+
+// AIMD congestion control for one camera's encoder, fed by the RTCP
+// receiver reports of every client session. The encoder is shared, so the
+// worst viewer wins: any congested report cuts the bitrate by
+// ADAPTIVE_BITRATE_DECREASE, and it only grows again, one step at a time,
+// once nobody has reported trouble for ADAPTIVE_BITRATE_HOLD_MS. Reports
+// between the low and high loss thresholds hold the rate (hysteresis).
+// Reports may come from several worker event loops at once.
+class BitrateController {
+public:
+    explicit BitrateController(CaptureDevice* capture);
+
+    // 'lossFraction' is the RR fraction lost (0..1), 'jitterMs' the
+    // interarrival jitter; 'client' only names the reporter in the log
+    void onReceiverReport(const std::string& client, double lossFraction, double jitterMs);
+
+    int getFloor() const { return floor; }
+    int getCeiling() const { return ceiling; }
+
+private:
+    bool apply(int newBitrate, const std::string& reason);
+
+    CaptureDevice* capture;
+    int floor;
+    int ceiling;
+    std::mutex mutex;
+    uint64_t lastChangeMs;
+    uint64_t lastCongestionMs;
+};
+
+#endif // BITRATE_CONTROLLER_H
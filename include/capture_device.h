@@ -0,0 +1,134 @@
+#ifndef CAPTURE_DEVICE_H
+#define CAPTURE_DEVICE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <sys/time.h>
+#include "constants.h"
+#include "device_config.h"
+#include "encoded_frame.h"
+#include "frame_dump.h"
+#include "frame_pool.h"
+#include "parameter_set_cache.h"
+#include "stream_stats.h"
+
+// Source of encoded H.264 access units for one camera. The distributor,
+// capture thread, framed source and subsession only use this interface;
+// v4l2Capture drives a V4L2 encoder and FileReplayCapture plays back a
+// recording, so the server runs without a camera.
+// The SPS/PPS bookkeeping, stats, bitrate and keyframe rate limiting and
+// the capture-to-wall-clock mapping are common and live here.
+// getFd() must be pollable: readable whenever readEncodedFrame() has a
+// frame, and opened non-blocking for CAPTURE_MODE_NONBLOCK.
+class CaptureDevice {
+public:
+    explicit CaptureDevice(const DeviceConfig& config);
+    virtual ~CaptureDevice();
+
+    // V4L2 device or, for .h264 and .v4l2dump paths, a FileReplayCapture.
+    // Check getFd() for failure to open.
+    static CaptureDevice* createNew(const DeviceConfig& config);
+
+    // Format, controls and buffers; SPS/PPS too if they can be had cheaply
+    virtual bool initialize() = 0;
+    virtual bool startCapture() = 0;
+    virtual bool stopCapture() = 0;
+    // Releases and re-creates the buffers
+    virtual bool reset() = 0;
+    // One access unit without its start code, NAL index built. The caller
+    // assigns the frame index. Safe to call from a capture thread.
+    virtual std::shared_ptr<EncodedFrame> readEncodedFrame() = 0;
+
+    // Zero-copy frames borrow the backend's buffers until released.
+    // Takes effect at the next reset().
+    virtual void setZeroCopy(bool enable) = 0;
+    virtual bool isZeroCopy() const = 0;
+    // Buffers are set up for the current zero-copy setting
+    virtual bool hasMappedBuffers() const = 0;
+    // Learns SPS/PPS from the running stream
+    virtual bool extractSpsPps() = 0;
+
+    // Changes the encoder bitrate while streaming, without a reset.
+    // Safe from any thread.
+    bool setBitrate(int bitsPerSecond);
+    int getBitrate() const { return bitrate.load(std::memory_order_relaxed); }
+    // Forces an IDR soon. Requests within KEYFRAME_REQUEST_MIN_INTERVAL_MS
+    // of the last one are dropped, since one IDR serves every viewer.
+    // Safe from any thread.
+    bool requestKeyFrame(const std::string& reason);
+
+    void clearSpsPps();
+    bool hasSpsPps() const { return spsPpsExtracted; }
+    uint8_t* getSPS() const { return sps; }
+    uint8_t* getPPS() const { return pps; }
+    unsigned getSPSSize() const { return spsSize; }
+    unsigned getPPSSize() const { return ppsSize; }
+    // fmtp parameters for the current SPS/PPS, without "a=fmtp:<pt> "
+    const std::string& getFmtpParams() const { return fmtpParams; }
+    // Bumped whenever the SPS/PPS change, so cached SDP can be rebuilt
+    unsigned getSpsPpsVersion() const { return spsPpsVersion; }
+    bool matchesSpsPps(const uint8_t* otherSps, size_t otherSpsSize,
+                       const uint8_t* otherPps, size_t otherPpsSize) const;
+    // Replaces SPS/PPS with the ones seen in-band if they differ.
+    // Returns true if anything changed.
+    bool updateSpsPps(const uint8_t* newSps, size_t newSpsSize, const uint8_t* newPps, size_t newPpsSize);
+
+    int getFd() const { return fd; }
+    const DeviceConfig& getConfig() const { return config; }
+    bool isNonBlocking() const { return nonBlocking; }
+    // Maps a monotonic capture time to wall-clock time, with an offset
+    // fixed at construction so presentation times never jump when the
+    // system clock is adjusted
+    struct timeval toWallClock(uint64_t monotonicNanos) const;
+    // The reverse, for wall-clock times clients ask for
+    uint64_t toMonotonic(const struct timeval& wallClock) const;
+    // Pipeline statistics for this device, shared by everything serving it
+    StreamStats& getStats() { return stats; }
+    const StreamStats& getStats() const { return stats; }
+    // Slabs for owned frame copies, reserved by the backend once it knows
+    // its largest frame
+    FramePool& getFramePool() { return framePool; }
+
+protected:
+    // Backend side of setBitrate() and requestKeyFrame()
+    virtual bool applyBitrate(int bitsPerSecond) = 0;
+    virtual bool forceKeyFrame() = 0;
+
+    // The key covers everything that shapes the SPS/PPS
+    void setParameterSetCacheKey(const std::string& key);
+    bool loadCachedSpsPps();
+    void storeParameterSet(uint8_t*& dst, unsigned& dstSize, const uint8_t* src, size_t size);
+    void spsPpsChanged();
+    // Frame counters, sequence gaps and the dump, for every frame handed out
+    void frameCaptured(const EncodedFrame& frame);
+
+    DeviceConfig config;
+    int fd;
+    bool nonBlocking;
+
+    uint8_t* sps;
+    uint8_t* pps;
+    unsigned spsSize;
+    unsigned ppsSize;
+    bool spsPpsExtracted;
+    std::string fmtpParams;
+    unsigned spsPpsVersion;
+    ParameterSetCache* paramCache;  // Set once the format is known
+    std::thread paramCacheWriter;   // Latest store(), off the event loop
+
+    StreamStats stats;
+    FramePool framePool;        // After stats, which it counts into
+    bool sequenceValid;         // Cleared at every start of capture
+
+private:
+    std::atomic<int> bitrate;       // Current encoder target
+    std::atomic<uint64_t> lastKeyFrameRequestMs;
+    int64_t wallClockOffsetNanos;   // Wall clock minus CLOCK_MONOTONIC
+    uint32_t lastSequence;          // Of the last frame counted
+    FrameDumpWriter* dumpWriter;    // Set by dump=<path>
+};
+
+#endif // CAPTURE_DEVICE_H
@@ -13,14 +13,176 @@
 #define VIDEO_BITRATE 1000000    // 1 Mbps
 #define GOP_SIZE 30              // GOP size (1 seconds at 30 fps)
 
+// Adaptive bitrate: RTCP receiver reports steer V4L2_CID_MPEG_VIDEO_BITRATE
+// between a floor and a ceiling (0 = the configured bitrate). Any viewer
+// reporting loss or jitter lowers it multiplicatively; it only creeps back
+// up once no viewer has complained for the hold time.
+#define ADAPTIVE_BITRATE_ENABLED 1
+#define ADAPTIVE_BITRATE_MIN 250000
+#define ADAPTIVE_BITRATE_MAX 0
+#define ADAPTIVE_BITRATE_LOSS_HIGH 0.05      // Fraction lost above which we back off
+#define ADAPTIVE_BITRATE_LOSS_LOW 0.01       // ... and below which we may increase
+#define ADAPTIVE_BITRATE_JITTER_HIGH_MS 50   // Interarrival jitter treated as congestion
+#define ADAPTIVE_BITRATE_DECREASE 0.8        // Multiplier per congested report
+#define ADAPTIVE_BITRATE_INCREASE 0.05       // Step, as a fraction of the ceiling
+#define ADAPTIVE_BITRATE_MIN_INTERVAL_MS 2000   // Between any two changes
+#define ADAPTIVE_BITRATE_HOLD_MS 10000       // Since the last bad report, before increasing
+
+// Keyframes on demand: an IDR is forced when a viewer starts without a
+// cached GOP to replay, and on RTCP PLI/FIR, at most once per interval
+#define KEYFRAME_ON_DEMAND 1
+#define KEYFRAME_REQUEST_MIN_INTERVAL_MS 500
+
 // Frame rate settings
 #define FRAME_RATE_NUMERATOR 1
 #define FRAME_RATE_DENOMINATOR 30  // 30 fps
 
+// RTP timestamping: synthesized from the nominal frame rate, or taken from
+// the driver's capture timestamps (follows frame drops and variable rates)
+#define TIMESTAMP_MODE_SYNTHETIC 0
+#define TIMESTAMP_MODE_CAPTURE 1
+#define TIMESTAMP_MODE TIMESTAMP_MODE_CAPTURE
+
 // Camera settings
 #define ROTATION_DEGREES 180
 
+// Capture delivery settings
+#define CAPTURE_MODE_SYNC 0      // Blocking VIDIOC_DQBUF on the event loop
+#define CAPTURE_MODE_THREAD 1    // Capture thread feeding a lock-free ring
+#define CAPTURE_MODE_NONBLOCK 2  // O_NONBLOCK fd watched by the scheduler's select loop
+#define CAPTURE_MODE CAPTURE_MODE_THREAD
+#define CAPTURE_RING_SIZE 8      // Frames between capture thread and event loop
+#define CAPTURE_POLL_TIMEOUT_MS 200
+#define CAPTURE_RETRY_LIMIT 3    // Failed polls/reads in a row before backing off
+#define CAPTURE_BACKOFF_MIN_MS 10  // First back-off, doubled up to CAPTURE_POLL_TIMEOUT_MS
+#define GET_FRAME_TIMEOUT_MS 2000  // Blocking getFrame() on a non-blocking fd
+#define CAPTURE_MAX_OUTPUTS 16   // Event loops one capture thread can feed
+
+// Zero-copy settings: frames borrow the V4L2 mmap buffer until the last
+// consumer is done with it, so more buffers are needed than for copying
+#define ZERO_COPY_FRAMES 1
+#define ZERO_COPY_BUFFER_COUNT 8
+#define ZERO_COPY_DRIVER_RESERVE 3   // Buffers never held in the history
+
+// Owned frame copies come from a per-capture pool of preallocated slabs,
+// the largest one capture buffer long
+#define FRAME_POOL_BYTES (8 * 1024 * 1024)  // Per camera, at least one slab per class; 0 disables it
+#define FRAME_POOL_CLASSES 4     // Each a quarter of the size of the one before
+#define FRAME_POOL_MIN_SLAB 4096
+#define FRAME_POOL_SPARE_HEADERS 128  // Frame headers beyond the slabs and lent buffers
+
+// H.264 parsing settings
+#define MAX_NALS_PER_FRAME 32    // NAL units looked at per V4L2 buffer
+#define MAX_PARAMETER_SET_SIZE 256  // SPS/PPS copy kept by each framed source
+
+// Frame distribution settings
+#define FRAME_HISTORY_DEPTH 8    // Frames kept for consumers that lag slightly
+
+// Low-latency delivery: a consumer that is behind skips stale
+// non-reference frames, or jumps to a newer IDR, instead of sending every
+// queued frame late. Sync capture also drains all ready driver buffers.
+#define LOW_LATENCY_MODE 1
+
+// Idle capture behaviour once the last viewer leaves
+#define WARM_CAPTURE_OFF 0       // STREAMOFF, unmap and REQBUFS 0; full setup next time
+#define WARM_CAPTURE_PAUSE 1     // STREAMOFF only; buffers stay mapped, encoder configured
+#define WARM_CAPTURE_RUNNING 2   // Keep streaming from startup, discard frames while idle
+#define WARM_CAPTURE_MODE WARM_CAPTURE_PAUSE
+
+// GOP cache settings: the latest GOP is replayed to new viewers so they
+// don't wait for the next IDR
+#define GOP_CACHE_ENABLED 1
+#define GOP_CACHE_MAX_FRAMES 60        // Or gop= if larger; a longer GOP is not cached
+#define GOP_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#define GOP_CACHE_BURST_INCREMENT 90   // 1 ms (90 kHz) between replayed frames
+
+// Parameter set cache: SPS/PPS and fmtp kept on disk per device and format
+#define PARAM_SET_CACHE_ENABLED 1
+#define PARAM_SET_CACHE_DIR "/var/tmp/v4l2_rtsp_server"
+
+// File replay: a device path ending in .h264/.264 (Annex-B) or
+// FRAME_DUMP_EXTENSION is played back in a loop instead of opening a camera
+#define REPLAY_PACE_RECORDED 0   // Recorded timestamps, or the configured fps for .h264
+#define REPLAY_PACE_FAST 1       // As fast as the pipeline takes frames
+#define REPLAY_PACE REPLAY_PACE_RECORDED
+#define REPLAY_MAX_LAG_MS 500    // Further behind schedule, replay restarts the clock
+#define FRAME_DUMP_EXTENSION ".v4l2dump"
+#define FRAME_DUMP_MAGIC "V4L2DMP1"  // 8 bytes at the start of a dump
+
+// RTP egress batching: the RTP packets of one access unit are queued per
+// client and sent with one sendmmsg(), equal-sized FU-A runs as UDP GSO
+// super-datagrams where the kernel supports UDP_SEGMENT
+#define RTP_EGRESS_BATCHING 1
+#define RTP_EGRESS_GSO 1
+#define RTP_BATCH_MAX_PACKETS 64     // Flushed early when this many are queued
+#define RTP_BATCH_FLUSH_US 2000      // Flush deadline if no marker bit shows up
+
+// SSM multicast mount (multicast=<group>[:port]): one RTP stream to the
+// group, advertised as rtsp://host:port/<stream>MULTICAST_STREAM_SUFFIX
+#define MULTICAST_RTP_PORT 20000     // Even; RTCP uses the next port
+#define MULTICAST_TTL 16
+#define MULTICAST_STREAM_SUFFIX "-multicast"
+
+// Segmented recording (record=<dir>): fragmented MP4 written by a thread of
+// its own from the frames the distributor hands out
+#define RECORDER_SEGMENT_SECONDS 60      // A new file at the first IDR after this
+#define RECORDER_FRAGMENT_MS 1000        // moof/mdat flushed this often
+#define RECORDER_RETENTION_SECONDS (7 * 24 * 3600)  // Older segments are deleted; 0 keeps all
+#define RECORDER_RETENTION_BYTES (16ULL << 30)     // Per camera; 0 for no limit
+#define RECORDER_QUEUE_FRAMES 256        // Frames queued for the writer before drops
+#define RECORDER_WRITE_BLOCK (1024 * 1024)  // Aligned write size
+#define RECORDER_CHECKPOINT_MS 2000      // A partly filled block is written this often
+
+// Timeshift DVR (dvr=<seconds>): the last seconds of encoded video kept in
+// memory and served as rtsp://host:port/<stream>DVR_STREAM_SUFFIX, where
+// PLAY with "Range: clock=..." starts in the past
+#define DVR_STREAM_SUFFIX "-dvr"
+#define DVR_BITRATE_HEADROOM 2           // Arena = seconds * max bitrate * this
+#define DVR_FRAME_HEADROOM 2             // Frame entries = seconds * fps * this
+#define DVR_MAX_ARENA_BYTES (256ULL << 20)   // Per camera
+#define DVR_CATCHUP_RATE 1.25            // Playback speed while behind live
+
+// Low-latency HLS (hls=on): fMP4 parts and segments served over HTTP as
+// http://host:HLS_HTTP_PORT/<stream>/index.m3u8; port 0 disables it
+#define HLS_HTTP_PORT 8080
+#define HLS_HTTP_BIND "0.0.0.0"
+#define HLS_HTTP_MAX_CONNECTIONS 128     // Players hold blocked reloads open
+#define HLS_PART_MS 200                  // Part target duration
+#define HLS_SEGMENT_MS 1000              // A new segment at the first IDR after this
+#define HLS_TARGET_DURATION 2            // Seconds at least; a key frame is requested to keep within it
+#define HLS_SEGMENT_COUNT 6              // Complete segments in the playlist
+#define HLS_PART_SEGMENTS 3              // Newest segments whose parts are listed
+
 // RTSP server settings
 #define DEFAULT_RTSP_PORT 8554
+#define DEFAULT_STREAM_NAME "v4l2Stream"
+
+// RTSP worker threads: 0 serves everything from the main event loop; N > 0
+// runs N event loops with their own RTSP listener on the same port
+// (SO_REUSEPORT) and shares every capture between them
+#define RTSP_WORKER_THREADS 0
+#define RTSP_WORKER_PIN_CORES 1  // Pin worker i to core i % cores
+
+// Logging: LOG_DEBUG and LOG_INFO below LOG_COMPILE_LEVEL are compiled out
+// (0 debug, 1 info, 2 warn, 3 error)
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 1
+#endif
+#define LOG_RING_SLOTS 1024          // Messages queued for the writer thread
+#define LOG_SLOT_SIZE 240            // Longer messages are truncated
+#define LOG_DRAIN_INTERVAL_MS 20
+#define LOG_RATE_LIMIT_BURST 5       // Per call site of LOG_RATE_LIMITED ...
+#define LOG_RATE_LIMIT_INTERVAL_MS 1000  // ... per this interval
+
+// Local HTTP stats endpoint (/metrics, Prometheus text format) on the main
+// event loop; port 0 disables it
+#define STATS_HTTP_PORT 9554
+#define STATS_HTTP_BIND "127.0.0.1"
+#define HTTP_MAX_CONNECTIONS 16
+#define HTTP_MAX_REQUEST_SIZE 8192
+#define HTTP_KEEPALIVE_TIMEOUT_MS 15000
+
+// Per-device CPU usage is logged this often (0 disables it)
+#define CPU_REPORT_INTERVAL_SEC 60
 
 #endif // CONSTANTS_H
\ No newline at end of file
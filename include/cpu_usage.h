@@ -0,0 +1,33 @@
+#ifndef CPU_USAGE_H
+#define CPU_USAGE_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+// CPU time consumed by the calling thread, in nanoseconds
+inline uint64_t threadCpuNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Adds the thread CPU time spent in a scope to 'total'. Handlers can
+// re-enter each other (a delivery asks for the next frame), so only the
+// outermost timer sharing 'depth' counts. 'total' may be read from another
+// thread for reporting.
+class ScopedCpuTimer {
+public:
+    ScopedCpuTimer(std::atomic<uint64_t>& total, unsigned& depth)
+        : total(total), depth(depth), start(depth++ == 0 ? threadCpuNanos() : 0) {}
+    ~ScopedCpuTimer() {
+        if (--depth == 0) total.fetch_add(threadCpuNanos() - start, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t>& total;
+    unsigned& depth;
+    uint64_t start;
+};
+
+#endif // CPU_USAGE_H
@@ -0,0 +1,59 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <string>
+#include "constants.h"
+
+// Per-camera settings. Defaults come from constants.h; main() overrides
+// them from the command line, one spec per device.
+struct DeviceConfig {
+    std::string device;
+    std::string streamName;   // RTSP path, rtsp://host:port/<streamName>
+    unsigned width;
+    unsigned height;
+    int bitrate;
+    int gopSize;
+    unsigned frameRateNumerator;
+    unsigned frameRateDenominator;
+    int rotation;
+    int captureMode;
+    int timestampMode;
+    bool lowLatency;
+    bool adaptiveBitrate;
+    int minBitrate;           // Adaptive bitrate floor
+    int maxBitrate;           // Adaptive bitrate ceiling; 0 means 'bitrate'
+    int replayPace;           // REPLAY_PACE_*, for file replay
+    std::string dumpPath;     // Records every captured frame when set
+    std::string multicastGroup;  // SSM mount when set, IPv4
+    int multicastPort;        // RTP port of the mount, even
+    std::string recordDirectory;  // Segmented MP4 recording when set
+    unsigned dvrSeconds;      // Timeshift DVR length; 0 disables it
+    bool hls;                 // Low-latency HLS over HTTP
+
+    DeviceConfig()
+        : device(DEVICE), streamName(DEFAULT_STREAM_NAME), width(WIDTH), height(HEIGHT),
+          bitrate(VIDEO_BITRATE), gopSize(GOP_SIZE),
+          frameRateNumerator(FRAME_RATE_NUMERATOR), frameRateDenominator(FRAME_RATE_DENOMINATOR),
+          rotation(ROTATION_DEGREES), captureMode(CAPTURE_MODE),
+          timestampMode(TIMESTAMP_MODE), lowLatency(LOW_LATENCY_MODE != 0),
+          adaptiveBitrate(ADAPTIVE_BITRATE_ENABLED != 0), minBitrate(ADAPTIVE_BITRATE_MIN),
+          maxBitrate(ADAPTIVE_BITRATE_MAX), replayPace(REPLAY_PACE),
+          multicastPort(MULTICAST_RTP_PORT), dvrSeconds(0), hls(false) {}
+
+    // 90 kHz RTP ticks and microseconds per frame at the nominal rate
+    unsigned frameTicks() const { return 90000ULL * frameRateNumerator / frameRateDenominator; }
+    unsigned frameMicros() const { return 1000000ULL * frameRateNumerator / frameRateDenominator; }
+};
+
+// Parses "<device>[,key=value...]" with keys name, size (WxH), bitrate,
+// gop, fps, rotate, mode (sync, thread or nonblock), timestamps
+// (capture or synthetic), latency (low or normal), abr (on or off),
+// minbitrate, maxbitrate, pace (recorded or fast), dump (a
+// FRAME_DUMP_EXTENSION file to record to), multicast (group[:port]),
+// record (a directory for MP4 segments), dvr (seconds to keep for
+// timeshifted playback) and hls (on or off), e.g.
+// "/dev/video2,name=door,size=1280x720,fps=15".
+// Keys that are not given keep their current value in 'config'.
+bool parseDeviceConfig(const std::string& spec, DeviceConfig& config);
+
+#endif // DEVICE_CONFIG_H
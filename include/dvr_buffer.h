@@ -0,0 +1,102 @@
+#ifndef DVR_BUFFER_H
+#define DVR_BUFFER_H
+
+#include <cstdint>
+#include <vector>
+#include "capture_device.h"
+#include "v4l2_frame_distributor.h"
+
+// The last few minutes of one camera's encoded video, for timeshifted
+// playback (v4l2DvrMediaSubsession). Everything is allocated when the
+// buffer is created: a byte arena sized from the DVR length and the
+// highest bitrate the camera may use, and fixed rings of frame and IDR
+// entries. Recording a frame is a copy into the arena; the oldest frames
+// are overwritten as it fills.
+// Frames are numbered with a sequence number that only grows, and the
+// buffer holds [oldest(), end()). Readers must check contains() before
+// touching a frame, since it may have been overwritten since they last
+// looked. IDR frames are looked up by capture time with a binary search.
+// The buffer is a distributor consumer like any RTSP session and keeps
+// the capture running; it lives on the distributor's event loop, as do
+// its readers.
+class DvrBuffer : public v4l2FrameDistributor::Consumer {
+public:
+    struct Frame {
+        uint64_t captureNanos;   // EncodedFrame::captureNanos
+        uint64_t position;       // Arena position of the first NAL unit
+        uint32_t length;         // Bytes in the arena, length prefixes included
+        uint16_t nalCount;
+        bool keyFrame;
+        bool parameterSets;      // Carries SPS and PPS in-band
+    };
+
+    class Reader {
+    public:
+        virtual ~Reader() {}
+        // Called once per waitForFrame() when the next frame is stored
+        virtual void frameStored() = 0;
+    };
+
+    // Starts the capture and records 'seconds' of video. Null if the
+    // capture can't be started.
+    static DvrBuffer* createNew(CaptureDevice* capture, v4l2FrameDistributor* distributor, unsigned seconds);
+    virtual ~DvrBuffer();
+
+    uint64_t oldest() const { return firstSeq; }
+    uint64_t end() const { return nextSeq; }
+    bool contains(uint64_t seq) const { return seq >= firstSeq && seq < nextSeq; }
+    const Frame& frame(uint64_t seq) const { return frames[seq % frames.size()]; }
+
+    // Frames are stored as 4-byte big-endian length and NAL unit, back to
+    // back and never split by the end of the arena. Returns the NAL unit
+    // at 'position' and moves 'position' past it.
+    const uint8_t* nalAt(uint64_t& position, uint32_t& length) const;
+
+    // Newest IDR captured at or before 'captureNanos', or the oldest IDR
+    // if they are all later. False if there is none.
+    bool findKeyFrame(uint64_t captureNanos, uint64_t& seq) const;
+    bool latestKeyFrame(uint64_t& seq) const;
+    // Capture time span of the frames held, in nanoseconds
+    uint64_t windowNanos() const;
+
+    // 'reader' is told about the next frame once; cancelled by cancelWait()
+    void waitForFrame(Reader* reader);
+    void cancelWait(Reader* reader);
+
+    CaptureDevice* getCapture() const { return capture; }
+
+private:
+    DvrBuffer(CaptureDevice* capture, v4l2FrameDistributor* distributor, size_t arenaBytes,
+              size_t frameCapacity);
+    bool start();
+
+    virtual void deliverFrame(const FramePtr& frame, bool continuous);
+    void store(const EncodedFrame& frame);
+    void evictOldest();
+    void notifyReaders();
+
+    struct KeyFrame {
+        uint64_t captureNanos;
+        uint64_t seq;
+    };
+    const KeyFrame& keyFrame(uint64_t i) const { return keyFrames[i % keyFrames.size()]; }
+
+    CaptureDevice* capture;
+    v4l2FrameDistributor* distributor;
+    StreamStats& stats;
+
+    std::vector<uint8_t> arena;
+    uint64_t writePosition;     // Grows without wrapping; arena offset is % size
+    std::vector<Frame> frames;  // Ring indexed by seq
+    uint64_t firstSeq;
+    uint64_t nextSeq;
+    std::vector<KeyFrame> keyFrames;  // Ring of the IDRs among the frames held
+    uint64_t firstKey;
+    uint64_t nextKey;
+    bool waitingForKeyFrame;    // After a lost frame; frames past a gap don't decode
+
+    std::vector<Reader*> waiting;
+    std::vector<Reader*> notifying;  // Spare list swapped with 'waiting'
+};
+
+#endif // DVR_BUFFER_H
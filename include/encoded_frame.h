@@ -0,0 +1,67 @@
+#ifndef ENCODED_FRAME_H
+#define ENCODED_FRAME_H
+
+#include <sys/time.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "constants.h"
+#include "h264_nal_parser.h"
+
+// One encoded H.264 frame as handed out by v4l2FrameDistributor.
+// The frame is shared (reference counted) between every consumer that
+// still has to send it, so the capture data is copied at most once per
+// frame no matter how many viewers are attached. In zero-copy mode the
+// payload points straight into a V4L2 mmap buffer, which is requeued when
+// the last reference goes away.
+// The NAL index is built once at dequeue time; nothing downstream scans
+// the payload for start codes again.
+struct EncodedFrame {
+    uint64_t index;             // Distributor-assigned, strictly increasing
+    struct timeval timestamp;   // Driver timestamp (v4l2_buffer.timestamp)
+    uint32_t sequence;          // Driver sequence (v4l2_buffer.sequence)
+    uint64_t dequeueNanos;      // monotonicNanos() when VIDIOC_DQBUF returned
+    uint64_t captureNanos;      // Capture time on the monotonic clock: the driver
+                                // timestamp if it is monotonic, else dequeueNanos
+    const uint8_t* data;        // Access unit without the leading start code
+    size_t length;
+    int bufferIndex;            // Lent V4L2 buffer, or -1 for an owned copy
+    std::vector<uint8_t> storage;  // Backing store of an owned copy outside the FramePool
+
+    // NAL index; offsets are relative to data
+    NalUnit nals[MAX_NALS_PER_FRAME];
+    unsigned nalCount;
+    bool keyFrame;              // Contains an IDR slice
+    bool parameterSets;         // Carries both SPS and PPS in-band
+    bool reference;             // Some NAL has nal_ref_idc != 0
+
+    EncodedFrame() : index(0), timestamp(), sequence(0), dequeueNanos(0), captureNanos(0), data(nullptr), length(0),
+                     bufferIndex(-1), nalCount(0), keyFrame(false),
+                     parameterSets(false), reference(false) {}
+
+    // Fills the NAL index and the flags derived from it
+    void indexNals() {
+        size_t count = splitNalUnits(data, length, nals, MAX_NALS_PER_FRAME);
+        nalCount = count < MAX_NALS_PER_FRAME ? count : MAX_NALS_PER_FRAME;
+        bool sps = false, pps = false;
+        for (unsigned i = 0; i < nalCount; ++i) {
+            if (nals[i].type == NAL_TYPE_IDR) keyFrame = true;
+            else if (nals[i].type == NAL_TYPE_SPS) sps = true;
+            else if (nals[i].type == NAL_TYPE_PPS) pps = true;
+            if (nals[i].refIdc != 0) reference = true;
+        }
+        parameterSets = sps && pps;
+    }
+
+    bool isIDR() const { return keyFrame; }
+    bool hasParameterSets() const { return parameterSets; }
+    bool isLent() const { return bufferIndex >= 0; }
+    const uint8_t* bytes() const { return data; }
+    size_t size() const { return length; }
+    const uint8_t* nalData(unsigned i) const { return data + nals[i].offset; }
+};
+
+typedef std::shared_ptr<const EncodedFrame> FramePtr;
+
+#endif // ENCODED_FRAME_H
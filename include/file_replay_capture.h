@@ -0,0 +1,64 @@
+#ifndef FILE_REPLAY_CAPTURE_H
+#define FILE_REPLAY_CAPTURE_H
+
+#include <cstdint>
+#include <vector>
+#include "capture_device.h"
+
+// Plays back a recording in a loop so the server can be run, profiled and
+// load-tested without a camera. The file is memory-mapped and split into
+// access units once: an Annex-B .h264/.264 elementary stream (paced at
+// the configured fps) or a FRAME_DUMP_EXTENSION dump (paced at its
+// recorded timestamps). pace=fast hands frames out as fast as they are
+// taken. getFd() is a timerfd that becomes readable when the next frame
+// is due. Zero-copy frames point straight into the mapping, which
+// outlives every frame since the capture is released last.
+class FileReplayCapture : public CaptureDevice {
+public:
+    explicit FileReplayCapture(const DeviceConfig& config);
+    virtual ~FileReplayCapture();
+
+    virtual bool initialize();
+    virtual bool startCapture();
+    virtual bool stopCapture();
+    // Rewinds to the start of the file
+    virtual bool reset();
+    virtual std::shared_ptr<EncodedFrame> readEncodedFrame();
+
+    virtual void setZeroCopy(bool enable) { zeroCopy = enable; }
+    virtual bool isZeroCopy() const { return zeroCopy; }
+    virtual bool hasMappedBuffers() const { return mapping != nullptr; }
+    // From the first access unit carrying both, no streaming needed
+    virtual bool extractSpsPps();
+
+protected:
+    // A recording's bitrate and GOP structure are fixed
+    virtual bool applyBitrate(int) { return false; }
+    virtual bool forceKeyFrame() { return false; }
+
+private:
+    struct ReplayFrame {
+        size_t offset;           // In the mapping, after the start code
+        size_t length;
+        uint64_t captureMicros;  // Relative to the first frame
+        uint32_t sequence;
+    };
+
+    bool indexAnnexB();
+    bool indexDump();
+    uint64_t dueNanos(size_t index) const;
+    void armTimer(uint64_t monotonicNanos);
+
+    const uint8_t* mapping;
+    size_t mappingSize;
+    std::vector<ReplayFrame> frames;
+    uint64_t loopMicros;          // One pass through the file
+    size_t nextFrame;
+    uint64_t passStartNanos;      // Monotonic time frame 0 of this pass is due
+    uint32_t passSequence;        // Added to recorded sequences, per pass
+    bool zeroCopy;
+    bool streaming;
+    bool fastPace;
+};
+
+#endif // FILE_REPLAY_CAPTURE_H
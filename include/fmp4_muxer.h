@@ -0,0 +1,53 @@
+#ifndef FMP4_MUXER_H
+#define FMP4_MUXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "encoded_frame.h"
+
+// Fragmented MP4 (ISO BMFF) for a single H.264 track on the 90 kHz clock.
+// An init segment (ftyp, moov with the avcC) is followed by any number of
+// fragments (moof, mdat). Samples are stored length-prefixed (AVCC); the
+// in-band AUD, SPS and PPS are left out since the avcC carries them.
+// Everything is appended to a byte vector, so the caller decides how the
+// bytes reach the disk or the network.
+class Fmp4Muxer {
+public:
+    Fmp4Muxer();
+
+    // ftyp + moov. SPS and PPS include their NAL header; width and height
+    // are only used if the SPS doesn't parse.
+    static void writeInitSegment(std::vector<uint8_t>& out, const uint8_t* sps, size_t spsSize,
+                                 const uint8_t* pps, size_t ppsSize, unsigned width, unsigned height);
+
+    // Queues one access unit lasting 'duration' 90 kHz ticks. A frame with
+    // nothing but parameter sets extends the previous sample instead.
+    void addSample(const EncodedFrame& frame, uint32_t duration);
+    // Lengthens the last queued sample. A live packager queues each frame
+    // with no duration and extends it once the next frame shows how long
+    // it lasted, so it never has to hold on to the frame itself.
+    void extendLastSample(uint32_t duration);
+    bool empty() const { return samples.empty(); }
+    size_t pendingBytes() const { return mdat.size(); }
+    // Decode time of the next fragment, in 90 kHz ticks
+    uint64_t decodeTime() const { return baseDecodeTime; }
+
+    // moof + mdat for the queued samples, which are then dropped
+    void writeFragment(std::vector<uint8_t>& out);
+    // Starts over for a new file: decode time 0, fragment sequence 1
+    void reset();
+
+private:
+    struct Sample {
+        uint32_t duration;
+        uint32_t size;
+        bool keyFrame;
+    };
+    std::vector<Sample> samples;
+    std::vector<uint8_t> mdat;    // Payload of the pending fragment
+    uint64_t baseDecodeTime;
+    uint32_t sequenceNumber;
+};
+
+#endif // FMP4_MUXER_H
@@ -0,0 +1,34 @@
+#ifndef FRAME_DUMP_H
+#define FRAME_DUMP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "encoded_frame.h"
+
+// FRAME_DUMP_EXTENSION recordings: FRAME_DUMP_MAGIC, then for every frame
+// a FrameDumpRecord followed by the access unit without its start code.
+// Host byte order; dumps are meant to be replayed on the same kind of
+// machine. Written with dump=<path>, played back by FileReplayCapture.
+struct FrameDumpRecord {
+    uint64_t captureMicros;  // Monotonic capture time
+    uint32_t sequence;       // Driver sequence
+    uint32_t length;         // Bytes that follow
+};
+
+// Appends frames to a dump. Buffered stdio writes on the capture path,
+// so meant for recording test material, not for production.
+class FrameDumpWriter {
+public:
+    explicit FrameDumpWriter(const std::string& path);
+    ~FrameDumpWriter();
+
+    bool isOpen() const { return file != nullptr; }
+    void write(const EncodedFrame& frame);
+
+private:
+    std::string path;
+    FILE* file;
+};
+
+#endif // FRAME_DUMP_H
@@ -0,0 +1,134 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+#include "encoded_frame.h"
+#include "stream_stats.h"
+
+// Preallocated memory for the frames of one capture: the EncodedFrame
+// headers with room for their shared_ptr control blocks, and payload
+// slabs for owned copies (made by the capture itself when it doesn't lend
+// its buffers, and by the GOP cache and the recorder of lent frames). The
+// slabs come in FRAME_POOL_CLASSES size classes, the largest one capture
+// buffer long and each further one a quarter of the one before, so
+// P-frames don't take IDR-sized slabs.
+// A frame holds its header and slab until its last reference goes away
+// and then puts them back, on whatever thread that is. The free lists are
+// lock-free, so neither the capture thread nor an event loop ever waits
+// on another thread or the allocator; the heap is only touched when the
+// pool has run dry (framePoolMisses). Frames must be released before the
+// pool is.
+class FramePool {
+public:
+    explicit FramePool(StreamStats& stats);
+
+    // Allocates the slabs for frames up to 'maxFrameSize' bytes and
+    // headers for as many frames plus 'lentFrames' borrowed ones, once;
+    // everything stays where it is for as long as the pool lives
+    void reserve(size_t maxFrameSize, size_t lentFrames);
+    bool isReserved() const { return !headers.empty(); }
+
+    // Owned frame with room for 'size' payload bytes at 'payload'. Only
+    // data and length are set.
+    std::shared_ptr<EncodedFrame> allocate(size_t size, uint8_t*& payload);
+    // Owned copy of a frame, for holding on to data that may be lent
+    std::shared_ptr<EncodedFrame> clone(const EncodedFrame& frame);
+    // Empty frame whose payload belongs to the caller; 'release' runs
+    // when the last reference goes away
+    template <typename Release>
+    std::shared_ptr<EncodedFrame> lend(Release release);
+
+private:
+    // Lock-free LIFO of the indices 0..n-1 (a Treiber stack). The head
+    // carries a tag bumped on every pop, so a stale head never wins the
+    // compare-and-swap (ABA).
+    class FreeList {
+    public:
+        FreeList() : head(EMPTY) {}
+        void init(uint32_t count);
+        bool pop(uint32_t& index);
+        void push(uint32_t index);
+
+    private:
+        static const uint64_t EMPTY = 0xFFFFFFFFu;
+        std::atomic<uint64_t> head;   // Tag << 32 | index
+        std::unique_ptr<std::atomic<uint32_t>[]> next;
+    };
+
+    struct SizeClass {
+        size_t slabSize;
+        uint8_t* base;
+        FreeList free;
+    };
+
+    // Room for a control block holding a release lambda and the allocator
+    static const size_t CONTROL_BLOCK_SIZE = 96;
+    struct Header {
+        EncodedFrame frame;
+        int sizeClass;                // -1 without a slab
+        uint32_t slab;
+        alignas(std::max_align_t) unsigned char controlBlock[CONTROL_BLOCK_SIZE];
+    };
+
+    // Places the control block in its header's room, and returns the
+    // header (and slab) to the pool once the control block is gone
+    template <typename T>
+    struct HeaderAllocator {
+        typedef T value_type;
+        FramePool* pool;
+        uint32_t header;
+
+        HeaderAllocator(FramePool* pool, uint32_t header) : pool(pool), header(header) {}
+        template <typename U>
+        HeaderAllocator(const HeaderAllocator<U>& other) : pool(other.pool), header(other.header) {}
+
+        T* allocate(size_t count) {
+            if (count * sizeof(T) <= CONTROL_BLOCK_SIZE && alignof(T) <= alignof(std::max_align_t)) {
+                return reinterpret_cast<T*>(pool->headers[header].controlBlock);
+            }
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        }
+        void deallocate(T* block, size_t) {
+            if (reinterpret_cast<unsigned char*>(block) != pool->headers[header].controlBlock) {
+                ::operator delete(block);
+            }
+            pool->release(header);
+        }
+        template <typename U>
+        bool operator==(const HeaderAllocator<U>& other) const { return header == other.header; }
+        template <typename U>
+        bool operator!=(const HeaderAllocator<U>& other) const { return header != other.header; }
+    };
+
+    bool takeHeader(uint32_t& header);
+    void release(uint32_t header);
+
+    StreamStats& stats;
+    std::vector<uint8_t> arena;
+    std::vector<SizeClass> classes;   // Smallest first
+    std::vector<Header> headers;
+    FreeList freeHeaders;
+};
+
+template <typename Release>
+std::shared_ptr<EncodedFrame> FramePool::lend(Release release) {
+    uint32_t header;
+    if (!takeHeader(header)) {
+        return std::shared_ptr<EncodedFrame>(new EncodedFrame(), [release](EncodedFrame* frame) {
+            release();
+            delete frame;
+        });
+    }
+    Header& slot = headers[header];
+    slot.frame = EncodedFrame();
+    slot.sizeClass = -1;
+    return std::shared_ptr<EncodedFrame>(&slot.frame, [release](EncodedFrame*) { release(); },
+                                         HeaderAllocator<EncodedFrame>(this, header));
+}
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,45 @@
+#ifndef H264_NAL_PARSER_H
+#define H264_NAL_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Annex-B start-code search and NAL splitting shared by everything that
+// looks inside an H.264 buffer. The start-code search uses SSE2 or NEON
+// when the compiler targets them and a scalar loop otherwise.
+
+// H.264 NAL unit types we act on
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+
+struct NalUnit {
+    size_t offset;   // First byte of the NAL header, after the start code
+    size_t length;   // Up to the next start code, trailing zeros dropped
+    uint8_t type;    // nal_unit_type
+    uint8_t refIdc;  // nal_ref_idc
+};
+
+// Position of the first 00 00 01 at or after 'from', or 'size' if none.
+// A 4-byte start code is found at its second byte.
+size_t findStartCode(const uint8_t* data, size_t size, size_t from = 0);
+size_t findStartCodeScalar(const uint8_t* data, size_t size, size_t from = 0);
+
+// Length of the start code at the beginning of the buffer (0, 3 or 4).
+size_t startCodeLength(const uint8_t* data, size_t size);
+
+// Splits an Annex-B buffer into NAL units in a single pass. Bytes before
+// the first start code count as a NAL unit of their own, so a buffer that
+// had its start code stripped still yields one unit. Returns the number
+// of units found; at most maxUnits are written.
+size_t splitNalUnits(const uint8_t* data, size_t size, NalUnit* units, size_t maxUnits);
+
+// Coded picture size from an SPS NAL unit (header byte included), after
+// cropping. Returns false, leaving width and height alone, if the SPS is
+// truncated or malformed.
+bool parseSpsResolution(const uint8_t* sps, size_t size, unsigned& width, unsigned& height);
+
+#endif // H264_NAL_PARSER_H
@@ -0,0 +1,114 @@
+#ifndef HLS_PACKAGER_H
+#define HLS_PACKAGER_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <UsageEnvironment.hh>
+#include "capture_device.h"
+#include "fmp4_muxer.h"
+#include "http_server.h"
+#include "v4l2_frame_distributor.h"
+
+// Low-latency HLS egress of one camera. The packager is a distributor
+// consumer like any RTSP session and turns the same encoded frames into
+// CMAF parts (one moof/mdat each, about HLS_PART_MS long) as they arrive;
+// a segment is the run of parts from one IDR to the next one after
+// HLS_SEGMENT_MS. The playlist and the media are held in memory and
+// served by an HttpServer under /<stream>/:
+//   index.m3u8            playlist; _HLS_msn/_HLS_part block until ready
+//   init.mp4?v=<n>        init segment for SPS/PPS version n
+//   segment.m4s?msn=<m>   complete segment m
+//   part.m4s?msn=<m>&part=<p>   part p of segment m; the part named by
+//                         the playlist's preload hint is held until done
+// New SPS/PPS start a segment after an EXT-X-DISCONTINUITY with a new
+// init segment. Everything runs on the distributor's event loop, which
+// must also run the HttpServer.
+class HlsPackager : public v4l2FrameDistributor::Consumer {
+public:
+    // Starts the capture and registers the handlers for 'capture's stream
+    static HlsPackager* createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                  v4l2FrameDistributor* distributor, HttpServer* server);
+    virtual ~HlsPackager();
+
+private:
+    HlsPackager(UsageEnvironment& env, CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                HttpServer* server);
+    bool start();
+
+    struct Part {
+        std::vector<uint8_t> data;   // moof + mdat
+        uint32_t ticks;              // 90 kHz
+        bool independent;            // Starts with an IDR
+    };
+    struct Segment {
+        uint64_t msn;                // Media sequence number
+        struct timeval startTime;    // Wall clock of its first frame
+        std::vector<Part> parts;
+        uint64_t ticks;              // Of the parts so far
+        std::shared_ptr<const std::vector<uint8_t> > init;
+        unsigned initVersion;
+        bool discontinuity;          // Follows new SPS/PPS
+        bool complete;
+    };
+    // A request that blocks until its playlist or part exists
+    struct Waiter {
+        uint64_t connectionId;
+        bool playlist;
+        uint64_t msn;
+        int part;                    // -1: the whole segment
+        uint64_t deadlineNanos;
+    };
+
+    virtual void deliverFrame(const FramePtr& frame, bool continuous);
+    void package(const EncodedFrame& frame);
+    bool startSegment(const EncodedFrame& frame);
+    void finishSegment();
+    void closePart();
+    uint32_t ticksBetween(uint64_t fromNanos, uint64_t toNanos) const;
+
+    const Segment* findSegment(uint64_t msn) const;
+    uint64_t currentMsn() const;
+    bool playlistReady(uint64_t msn, int part) const;
+    // EXT-X-TARGETDURATION: the longest segment so far, rounded up
+    uint64_t targetDuration() const;
+    std::string playlist() const;
+
+    void servePlaylist(const HttpRequest& request, HttpResponse& response);
+    void serveInit(const HttpRequest& request, HttpResponse& response);
+    void serveSegment(const HttpRequest& request, HttpResponse& response);
+    void servePart(const HttpRequest& request, HttpResponse& response);
+    // False if the part will never exist
+    bool answerPart(uint64_t msn, unsigned part, HttpResponse& response) const;
+    void wait(const HttpRequest& request, HttpResponse& response, bool playlist, uint64_t msn, int part);
+    void answerWaiters(bool timedOut);
+    static void waiterTimeoutTask(void* clientData);
+
+    UsageEnvironment& env;
+    CaptureDevice* capture;
+    v4l2FrameDistributor* distributor;
+    HttpServer* server;
+    StreamStats& stats;
+    std::string path;                // /<stream>/
+
+    Fmp4Muxer muxer;
+    std::deque<Segment> segments;    // Oldest first; the last may be open
+    uint64_t nextMsn;
+    uint64_t discontinuitySequence;
+    std::shared_ptr<const std::vector<uint8_t> > init;
+    unsigned initVersion;
+    bool waitingForKeyFrame;
+    bool sampleOpen;                 // The muxer's last sample still grows
+    uint64_t lastCaptureNanos;       // Of that sample
+    uint32_t partTicks;              // Of the part being built
+    bool partIndependent;
+    bool keyFrameRequested;          // For the open segment
+    uint64_t targetTicks;            // Never shrinks, players expect it fixed
+
+    std::vector<Waiter> waiters;
+    TaskToken waiterTask;
+};
+
+#endif // HLS_PACKAGER_H
@@ -0,0 +1,78 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <UsageEnvironment.hh>
+#include "constants.h"
+
+struct HttpRequest {
+    std::string method;
+    std::string path;    // Without the query string
+    std::string query;   // After '?', undecoded
+    uint64_t connectionId;  // For HttpServer::respond() after deferring
+};
+
+struct HttpResponse {
+    int status;
+    std::string contentType;
+    std::string body;
+    std::vector<std::pair<std::string, std::string> > headers;  // Sent as is
+    bool deferred;       // The handler answers later with respond()
+
+    HttpResponse() : status(200), contentType("text/plain; charset=utf-8"), deferred(false) {}
+};
+
+// Minimal HTTP/1.1 server driven by a live555 scheduler, for monitoring
+// endpoints and HLS. Only GET is served; HTTP/1.1 clients keep their
+// connection for further requests until it has been idle for
+// HTTP_KEEPALIVE_TIMEOUT_MS, which is also how long a new connection has
+// to send its first request. The socket work is non-blocking and runs as
+// background handlers, so handlers execute on the scheduler's thread and
+// may read anything that thread owns. A handler that can't answer yet
+// sets 'deferred' and calls respond() once it can, e.g. for an LL-HLS
+// blocking playlist reload.
+class HttpServer {
+public:
+    typedef std::function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+    HttpServer(UsageEnvironment& env, const std::string& bindAddress, int port,
+               unsigned maxConnections = HTTP_MAX_CONNECTIONS);
+    ~HttpServer();
+
+    bool initialize();
+    // Exact path match; anything else gets a 404
+    void addHandler(const std::string& path, Handler handler);
+    // Answers a deferred request; false if its client has gone away
+    bool respond(uint64_t connectionId, const HttpResponse& response);
+    int getPort() const { return port_; }
+
+private:
+    struct Connection;
+
+    static void incomingConnectionHandler(void* clientData, int mask);
+    static void connectionReadableHandler(void* clientData, int mask);
+    static void connectionWritableHandler(void* clientData, int mask);
+    void acceptConnection();
+    void handleReadable(Connection* connection);
+    void handleWritable(Connection* connection);
+    void dispatch(Connection* connection);
+    void sendResponse(Connection* connection, const HttpResponse& response);
+    void closeConnection(Connection* connection);
+    static void idleTimeoutHandler(void* clientData);
+
+    UsageEnvironment& env_;
+    std::string bindAddress_;
+    int port_;
+    unsigned maxConnections_;
+    int listenSocket_;
+    uint64_t nextConnectionId_;
+    std::map<std::string, Handler> handlers_;
+    std::map<int, Connection*> connections_;
+};
+
+#endif // HTTP_SERVER_H
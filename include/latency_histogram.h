@@ -0,0 +1,51 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+// CLOCK_MONOTONIC in nanoseconds; the clock V4L2 stamps buffers with
+inline uint64_t monotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Fixed-size log-linear histogram of microsecond latencies, in the spirit
+// of HdrHistogram: every power of two is split into 2^SUB_BITS linear
+// buckets, so the relative error stays under 1/2^SUB_BITS across the whole
+// range. record() is one bit scan and three relaxed atomic adds; no locks
+// and no allocation, from any thread.
+class LatencyHistogram {
+public:
+    static const unsigned SUB_BITS = 3;
+    static const unsigned SUB_BUCKETS = 1u << SUB_BITS;
+    static const unsigned MAX_EXPONENT = 27;   // Up to 2^30 us, ~1074 s
+    static const unsigned BUCKETS = (MAX_EXPONENT + 1) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(uint64_t micros);
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t sumMicros() const { return sum.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the given quantile (0..1)
+    uint64_t percentile(double quantile) const;
+
+    // Appends name_bucket{...,le=".."}, name_sum and name_count lines,
+    // in seconds, with cumulative buckets up to each power of two
+    // (le is one microsecond below it).
+    void writePrometheus(std::string& out, const std::string& name, const std::string& labels) const;
+
+private:
+    static unsigned bucketIndex(uint64_t micros);
+    static uint64_t bucketUpperBound(unsigned index);
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -1,25 +1,86 @@
 #ifndef LIVE555_RTSP_SERVER_MANAGER_H
 #define LIVE555_RTSP_SERVER_MANAGER_H
 
+#include <string>
+#include <vector>
 #include <liveMedia.hh>
 #include <BasicUsageEnvironment.hh>
-#include "v4l2_capture.h"
+#include "bitrate_controller.h"
+#include "capture_device.h"
+#include "device_config.h"
+#include "dvr_buffer.h"
+#include "hls_packager.h"
+#include "http_server.h"
+#include "live555_rtsp_worker.h"
+#include "segment_recorder.h"
+#include "v4l2_frame_distributor.h"
+#include "v4l2_multicast_stream.h"
 
+// One RTSP listener serving every configured camera. Each device gets its
+// own CaptureDevice, frame distributor (and capture thread) and
+// ServerMediaSession named after DeviceConfig::streamName.
+// With worker threads the main loop keeps only the capture side: every
+// worker has its own listener on the port and a shard of each camera's
+// distributor, and sessions stay on the worker that accepted them.
+// Cameras with a multicast group also get an SSM mount on the main loop,
+// cameras with a record directory a SegmentRecorder fed from it, and
+// cameras with a DVR length a DvrBuffer and a timeshift mount, and
+// cameras with hls=on an HlsPackager on the shared HLS HTTP server.
+// Per-device statistics are served as Prometheus text on
+// http://STATS_HTTP_BIND:STATS_HTTP_PORT/metrics from the main loop.
 class Live555RTSPServerManager {
 public:
-    Live555RTSPServerManager(UsageEnvironment* env, v4l2Capture* capture, int port = 8554);
+    Live555RTSPServerManager(UsageEnvironment* env, const std::vector<DeviceConfig>& devices,
+                             int port = DEFAULT_RTSP_PORT, int workerCount = RTSP_WORKER_THREADS);
     ~Live555RTSPServerManager();
 
+    // Fails only if the server can't listen or no device could be opened
     bool initialize();
     void runEventLoop(char* shouldExit);
     void cleanup();
 
 private:
+    struct Camera {
+        DeviceConfig config;
+        CaptureDevice* capture;
+        v4l2FrameDistributor* distributor;
+        BitrateController* bitrateController;          // Null without adaptive bitrate
+        ServerMediaSession* sms;                       // Main loop only
+        v4l2MulticastStream* multicast;                // Null without multicast=
+        SegmentRecorder* recorder;                     // Null without record=
+        DvrBuffer* dvr;                                // Null without dvr=
+        HlsPackager* hls;                              // Null without hls=on
+        std::vector<v4l2FrameDistributor*> shards;    // One per worker
+        uint64_t lastCaptureCpu;    // At the previous CPU report
+        uint64_t lastEventLoopCpu;
+    };
+
+    bool addCamera(const DeviceConfig& config);
+    bool addStream(RTSPServer* server, UsageEnvironment& env, const Camera& camera,
+                   v4l2FrameDistributor* distributor, ServerMediaSession*& sms);
+    bool addMulticastStream(Camera& camera);
+    bool addRecorder(Camera& camera);
+    bool addDvrStream(Camera& camera);
+    bool addHlsStream(Camera& camera);
+    bool startWorkers();
+    void releaseCameras();
+
+    void serveMetrics(const HttpRequest& request, HttpResponse& response);
+
+    static void cpuReportTask(void* clientData);
+    void reportCpuUsage();
+
     int port_;
+    int workerCount_;
     UsageEnvironment* env_;
-    v4l2Capture* capture_;
-    RTSPServer* rtspServer_;
-    ServerMediaSession* sms_;
+    std::vector<DeviceConfig> devices_;
+    std::vector<Camera> cameras_;
+    std::vector<Live555RTSPWorker*> workers_;
+    RTSPServer* rtspServer_;   // Without workers only
+    HttpServer* httpServer_;   // Stats endpoint, if enabled
+    HttpServer* hlsServer_;    // If any camera has hls=on
+    TaskToken cpuReportTask_;
+    struct timespec lastCpuReport_;
 };
 
 #endif // LIVE555_RTSP_SERVER_MANAGER_H
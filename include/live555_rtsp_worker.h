@@ -0,0 +1,42 @@
+#ifndef LIVE555_RTSP_WORKER_H
+#define LIVE555_RTSP_WORKER_H
+
+#include <thread>
+#include <liveMedia.hh>
+#include <BasicUsageEnvironment.hh>
+
+// One extra event loop with its own scheduler, environment and RTSP
+// listener. Every worker binds the same port with SO_REUSEPORT, so the
+// kernel spreads incoming RTSP connections, and with them the client
+// sessions and their RTP packetizing, across the workers.
+// Everything is set up on the main thread before start(); after that the
+// worker's live555 objects are only touched from its own thread until
+// stop() has joined it.
+class Live555RTSPWorker {
+public:
+    Live555RTSPWorker(int id, int port);
+    ~Live555RTSPWorker();
+
+    bool initialize();
+    bool start();
+    void stop();
+    // Closes the listener and its sessions; only after stop()
+    void cleanup();
+
+    int getId() const { return id_; }
+    UsageEnvironment* getEnv() const { return env_; }
+    RTSPServer* getRTSPServer() const { return rtspServer_; }
+
+private:
+    void run();
+
+    int id_;
+    int port_;
+    TaskScheduler* scheduler_;
+    UsageEnvironment* env_;
+    RTSPServer* rtspServer_;
+    std::thread thread_;
+    char shouldExit_;
+};
+
+#endif // LIVE555_RTSP_WORKER_H
@@ -5,7 +5,64 @@
 #include <iostream>
 #include <ctime>
 #include <iomanip>
+#include <atomic>
+#include <cstdint>
+#include "constants.h"
 
+// Severity levels
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Messages are copied into a preallocated lock-free ring and written out by
+// a background thread, so a call never formats a timestamp, takes a lock or
+// touches stdout on the caller's thread. If the ring is full the message is
+// dropped and counted rather than waited for.
+void logMessage(int level, const std::string& message);
+// Same as LOG_INFO
 void logMessage(const std::string& message);
+// Writes out everything queued and stops the background thread; also run
+// at exit. Later messages are written synchronously.
+void logShutdown();
+
+// Levels below LOG_COMPILE_LEVEL compile to nothing, arguments included.
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(message) logMessage(LOG_LEVEL_DEBUG, message)
+#else
+#define LOG_DEBUG(message) do {} while (0)
+#endif
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(message) logMessage(LOG_LEVEL_INFO, message)
+#else
+#define LOG_INFO(message) do {} while (0)
+#endif
+#define LOG_WARN(message) logMessage(LOG_LEVEL_WARN, message)
+#define LOG_ERROR(message) logMessage(LOG_LEVEL_ERROR, message)
+
+// Per call site limit of LOG_RATE_LIMIT_BURST messages per
+// LOG_RATE_LIMIT_INTERVAL_MS, for errors that can repeat every frame.
+// Suppressed messages are not even formatted; the next one that gets
+// through reports how many were skipped.
+class LogRateLimiter {
+public:
+    LogRateLimiter() : windowStart(0), count(0), suppressed(0) {}
+    // Returns false to suppress; otherwise 'skipped' is set to the number
+    // of messages suppressed since the last one that got through.
+    bool allow(uint64_t& skipped);
+
+private:
+    std::atomic<int64_t> windowStart;
+    std::atomic<unsigned> count;
+    std::atomic<uint64_t> suppressed;
+};
+
+std::string rateLimitSuffix(uint64_t skipped);
+
+#define LOG_RATE_LIMITED(level, message) do { \
+        static LogRateLimiter logLimiter_; \
+        uint64_t logSkipped_ = 0; \
+        if (logLimiter_.allow(logSkipped_)) logMessage(level, (message) + rateLimitSuffix(logSkipped_)); \
+    } while (0)
 
 #endif // LOGGER_H
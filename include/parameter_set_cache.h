@@ -0,0 +1,31 @@
+#ifndef PARAMETER_SET_CACHE_H
+#define PARAMETER_SET_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// SPS/PPS and the matching fmtp parameters kept on disk per device, so a
+// restarted server can answer DESCRIBE without pulling frames from the
+// encoder. Entries carry the key of the format and controls they were
+// captured with; a different key is a miss. The live stream stays the
+// authority: the capture overwrites the entry when in-band parameter sets
+// disagree with it.
+class ParameterSetCache {
+public:
+    ParameterSetCache(const std::string& device, const std::string& key);
+
+    bool load(std::vector<uint8_t>& sps, std::vector<uint8_t>& pps, std::string& fmtpParams) const;
+    bool store(const uint8_t* sps, unsigned spsSize, const uint8_t* pps, unsigned ppsSize,
+               const std::string& fmtpParams) const;
+    const std::string& getPath() const { return path; }
+
+private:
+    std::string path;
+    std::string key;
+};
+
+// "packetization-mode=1;profile-level-id=...;sprop-parameter-sets=..."
+std::string buildFmtpParams(const uint8_t* sps, unsigned spsSize, const uint8_t* pps, unsigned ppsSize);
+
+#endif // PARAMETER_SET_CACHE_H
@@ -0,0 +1,28 @@
+#ifndef RTCP_FEEDBACK_GROUPSOCK_H
+#define RTCP_FEEDBACK_GROUPSOCK_H
+
+#include <liveMedia.hh>
+#include <Groupsock.hh>
+#include "capture_device.h"
+
+// Groupsock for a client's RTCP port that spots payload-specific feedback,
+// PLI (RFC 4585) and FIR (RFC 5104), on its way to the RTCPInstance, which
+// ignores both, and asks the encoder for an IDR. RTP-over-TCP does not go
+// through groupsocks, so feedback from interleaved clients is not seen.
+class RtcpFeedbackGroupsock : public Groupsock {
+public:
+    RtcpFeedbackGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr, Port port,
+                          u_int8_t ttl, CaptureDevice* capture);
+    virtual ~RtcpFeedbackGroupsock();
+
+    virtual Boolean handleRead(unsigned char* buffer, unsigned bufferMaxSize, unsigned& bytesRead,
+                               struct sockaddr_storage& fromAddressAndPort);
+
+    // True if a compound RTCP packet carries a PLI or FIR
+    static bool hasPictureLossFeedback(const unsigned char* packet, unsigned size);
+
+private:
+    CaptureDevice* fCapture;
+};
+
+#endif // RTCP_FEEDBACK_GROUPSOCK_H
@@ -0,0 +1,106 @@
+#ifndef SEGMENT_RECORDER_H
+#define SEGMENT_RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "capture_device.h"
+#include "fmp4_muxer.h"
+#include "spsc_ring.h"
+#include "v4l2_frame_distributor.h"
+
+// Records one camera into rolling fragmented MP4 segments from the frames
+// the distributor already hands out, so nothing is captured or encoded
+// twice. On the event loop a frame only costs a reference (a copy for lent
+// V4L2 buffers) and a ring push; muxing and disk I/O run on the recorder's
+// own thread. A full ring drops frames for the recording only, counted in
+// StreamStats::recorderDrops, and recording resumes at the next IDR, so a
+// stalled disk never holds up capture or RTP.
+// Files go out in RECORDER_WRITE_BLOCK-sized writes at aligned offsets.
+// A segment is written as <stream>-<time>.mp4.part and renamed to .mp4
+// once it is synced; .part files a crash left behind are cut back to their
+// last complete fragment and renamed on startup. Segments beyond
+// RECORDER_RETENTION_SECONDS or RECORDER_RETENTION_BYTES are deleted,
+// oldest first.
+class SegmentRecorder : public v4l2FrameDistributor::Consumer {
+public:
+    // Starts recording into 'directory' right away; 'distributor' must run
+    // on the calling thread's event loop. Null if the directory is unusable.
+    static SegmentRecorder* createNew(CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                                      const std::string& directory);
+    // Finalizes the open segment
+    virtual ~SegmentRecorder();
+
+private:
+    SegmentRecorder(CaptureDevice* capture, v4l2FrameDistributor* distributor, const std::string& directory);
+    bool start();
+
+    struct ParameterSets {
+        std::vector<uint8_t> sps;
+        std::vector<uint8_t> pps;
+    };
+    struct QueuedFrame {
+        FramePtr frame;
+        bool continuous;
+        std::shared_ptr<const ParameterSets> parameterSets;  // Current when it was captured
+    };
+
+    // Event loop side
+    virtual void deliverFrame(const FramePtr& frame, bool continuous);
+
+    // Recorder thread
+    void run();
+    void record(QueuedFrame& next);
+    uint32_t ticksBetween(const EncodedFrame& frame, const EncodedFrame& next) const;
+    bool openSegment(const QueuedFrame& first);
+    void flushFragment();
+    void finishSegment();
+    void abandonSegment();
+    void append(const std::vector<uint8_t>& bytes);
+    bool writeBlock();
+    void checkpoint();
+    void recoverPartialSegments();
+    bool recoverSegment(const std::string& partPath);
+    void applyRetention();
+    void syncDirectory();
+
+    CaptureDevice* capture;
+    v4l2FrameDistributor* distributor;
+    std::string directory;
+    std::string prefix;        // <stream>-
+    StreamStats& stats;
+
+    SpscRing<QueuedFrame> queue;
+    std::shared_ptr<const ParameterSets> parameterSets;
+    unsigned parameterSetVersion;
+    bool lostFrame;             // Next queued frame follows a drop
+
+    std::thread thread;
+    std::atomic<bool> running;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    // Recorder thread only
+    Fmp4Muxer muxer;
+    QueuedFrame held;           // Waits for the next frame to know its duration
+    bool waitingForKeyFrame;
+    int fd;                     // Open segment, or -1
+    std::string partPath;
+    std::string finalPath;
+    std::shared_ptr<const ParameterSets> segmentParameterSets;
+    uint64_t segmentStartNanos;
+    uint64_t fragmentStartNanos;
+    std::vector<uint8_t> fragment;
+    uint8_t* block;             // RECORDER_WRITE_BLOCK, page aligned
+    size_t blockFill;
+    off_t blockOffset;          // File offset of block[0]
+    bool blockDirty;            // Holds bytes the file doesn't have yet
+    uint64_t lastCheckpointMs;
+};
+
+#endif // SEGMENT_RECORDER_H
@@ -0,0 +1,70 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free single-producer/single-consumer ring.
+// push() must only be called from one thread and pop() from one other
+// thread. Capacity is rounded up to a power of two.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t requestedCapacity)
+        : head(0), tail(0), highWater(0) {
+        size_t capacity = 1;
+        while (capacity < requestedCapacity) capacity <<= 1;
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    // Producer side. Returns false (and leaves item untouched) if full.
+    bool push(T&& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if (t - h > mask) return false;
+
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+
+        size_t used = t + 1 - h;
+        if (used > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(used, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side. Returns false if empty.
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if (h == t) return false;
+
+        item = std::move(slots[h & mask]);
+        slots[h & mask] = T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Fill level; exact from either side, approximate from a third thread.
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+    size_t capacity() const { return mask + 1; }
+    size_t highWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // Keep producer and consumer indices on separate cache lines
+    char padHead[64];
+    std::atomic<size_t> head;
+    char padTail[64];
+    std::atomic<size_t> tail;
+    std::atomic<size_t> highWater;
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,65 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "latency_histogram.h"
+
+// Per-device pipeline statistics. Written from the capture thread and the
+// event loops with relaxed atomics only; read by the stats endpoint.
+struct StreamStats {
+    // Stage latencies
+    LatencyHistogram driverToDequeue;    // v4l2_buffer.timestamp -> VIDIOC_DQBUF returned
+    LatencyHistogram dequeueToDelivery;  // DQBUF -> first NAL handed to afterGetting()
+    LatencyHistogram deliveryToSend;     // afterGetting() -> first RTP packet of the NAL sent
+
+    std::atomic<uint64_t> frames;         // Dequeued for streaming
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> keyFrames;
+    std::atomic<uint64_t> sequenceGaps;   // Frames the driver skipped (v4l2_buffer.sequence)
+    std::atomic<uint64_t> ringDrops;      // Frames dropped on a full capture ring
+    std::atomic<uint64_t> latencySkips;   // Stale frames a consumer skipped (low-latency mode)
+    std::atomic<uint64_t> truncations;    // NAL units cut to fit the sink buffer
+    std::atomic<uint64_t> truncatedBytes;
+    std::atomic<uint64_t> streamStarts;   // VIDIOC_STREAMON
+    std::atomic<uint64_t> resets;         // Buffers torn down and remapped
+    std::atomic<uint64_t> consumers;      // Gauge: client streams attached now
+    std::atomic<uint64_t> bitrate;        // Gauge: encoder target, bits/s
+    std::atomic<uint64_t> bitrateChanges; // Adaptive bitrate adjustments
+    std::atomic<uint64_t> keyFrameRequests;  // Forced IDRs issued
+    std::atomic<uint64_t> pictureLossIndications;  // RTCP PLI/FIR received
+    std::atomic<uint64_t> rtpPackets;     // Sent through batched egress, per destination
+    std::atomic<uint64_t> rtpSendCalls;   // sendmmsg() calls carrying them
+    std::atomic<uint64_t> recorderDrops;  // Frames the recorder queue had no room for
+    std::atomic<uint64_t> recordedBytes;  // Written to MP4 segments
+    std::atomic<uint64_t> recordedSegments;  // Segments finalized
+    std::atomic<uint64_t> dvrOverruns;    // DVR viewers whose frames were overwritten
+    std::atomic<uint64_t> dvrWindowMs;    // Gauge: capture time the DVR holds
+    std::atomic<uint64_t> hlsParts;       // LL-HLS parts published
+    std::atomic<uint64_t> framePoolMisses;  // Frame copies that had to use the heap
+    std::atomic<uint64_t> gopCacheOverflows;  // GOPs too long or large to cache
+
+    StreamStats()
+        : frames(0), bytes(0), keyFrames(0), sequenceGaps(0), ringDrops(0), latencySkips(0),
+          truncations(0), truncatedBytes(0), streamStarts(0), resets(0), consumers(0),
+          bitrate(0), bitrateChanges(0),
+          keyFrameRequests(0), pictureLossIndications(0), rtpPackets(0), rtpSendCalls(0),
+          recorderDrops(0), recordedBytes(0), recordedSegments(0), dvrOverruns(0), dvrWindowMs(0),
+          hlsParts(0), framePoolMisses(0), gopCacheOverflows(0) {}
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+};
+
+// One scrape in Prometheus text exposition format; 'labels' are the label
+// pairs for each stats block, e.g. device="/dev/video0",stream="front"
+struct LabeledStats {
+    std::string labels;
+    const StreamStats* stats;
+};
+std::string formatPrometheus(const std::vector<LabeledStats>& streams);
+
+#endif // STREAM_STATS_H
@@ -8,7 +8,11 @@
 #include <sys/mman.h>
 #include <unistd.h> // for close()
 #include <cstdint>  // for uint8_t
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <string>
+#include "capture_device.h"
 #include "constants.h"
 
 struct Buffer {
@@ -23,48 +27,63 @@ struct FrameInfo {
     bool valid;
 };
 
-class v4l2Capture {
+// V4L2 stateful H.264 encoder (e.g. the Raspberry Pi's bcm2835-codec
+// behind /dev/video*), read through mmap buffers.
+class v4l2Capture : public CaptureDevice {
 public:
-    v4l2Capture(const char* device);
-    ~v4l2Capture();
+    // CAPTURE_MODE_NONBLOCK opens the device with O_NONBLOCK, for
+    // scheduler-driven reads
+    explicit v4l2Capture(const DeviceConfig& config);
+    virtual ~v4l2Capture();
 
-    bool initialize();
-    bool startCapture();
-    bool stopCapture();
-    bool reset();
+    virtual bool initialize();
+    virtual bool startCapture();
+    virtual bool stopCapture();
+    virtual bool reset();
     unsigned char* getFrame(size_t& length);
     unsigned char* getFrameWithoutStartCode(size_t& length);
     void releaseFrame();
+    // Dequeues one frame without its start code. The caller assigns the
+    // frame index. In zero-copy mode the frame borrows the mmap buffer and
+    // requeues it on destruction; otherwise the data is copied out and the
+    // buffer is requeued immediately. Safe to call from a capture thread.
+    virtual std::shared_ptr<EncodedFrame> readEncodedFrame();
 
-    bool extractSpsPps();
-    void clearSpsPps();
-    bool extractSpsPpsImmediate();
-    bool hasSpsPps() const { return spsPpsExtracted; }
-    uint8_t* getSPS() const { return sps; }
-    uint8_t* getPPS() const { return pps; }
-    unsigned getSPSSize() const { return spsSize; }
-    unsigned getPPSSize() const { return ppsSize; }
-    
+    // Zero-copy needs more buffers, since consumers hold on to them.
+    // Takes effect at the next reset().
+    virtual void setZeroCopy(bool enable);
+    virtual bool isZeroCopy() const { return zeroCopy; }
+    unsigned getBufferCount() const { return n_buffers; }
+    // Buffers are mapped for the current zero-copy setting
+    virtual bool hasMappedBuffers() const { return buffers != nullptr && mappedRequest == requestedBuffers; }
 
-    int getFd() const { return fd; }
+    virtual bool extractSpsPps();
+    bool extractSpsPpsImmediate();
     // Timing information
     const FrameInfo& getCurrentFrameInfo() const { return currentFrameInfo; }
     bool isFrameValid() const { return currentFrameInfo.valid; }
     uint32_t getSequence() const { return currentFrameInfo.sequence; }
     const timeval& getTimestamp() const { return currentFrameInfo.timestamp; }
 
+protected:
+    // VIDIOC_S_CTRL on V4L2_CID_MPEG_VIDEO_BITRATE and
+    // V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME
+    virtual bool applyBitrate(int bitsPerSecond);
+    virtual bool forceKeyFrame();
+
 private:
-    int fd;
+    bool waitForFrame(int timeoutMs);
     Buffer* buffers;
     unsigned int n_buffers;
     struct v4l2_buffer current_buf;
     bool initializeMmap();
-
-    uint8_t* sps;
-    uint8_t* pps;
-    unsigned spsSize;
-    unsigned ppsSize;
-    bool spsPpsExtracted;
+    unsigned int requestedBuffers;
+    unsigned int mappedRequest;  // requestedBuffers at the last initializeMmap()
+    bool zeroCopy;
+    // Bumped whenever queued buffers are reclaimed, so late releases of
+    // frames lent before a stop/reset don't queue a buffer twice.
+    std::atomic<unsigned> bufferGeneration;
+    void requeueBuffer(unsigned int index, unsigned generation);
 
     FrameInfo currentFrameInfo;
     void updateFrameInfo(const v4l2_buffer& buf);
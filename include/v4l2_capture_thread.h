@@ -0,0 +1,72 @@
+#ifndef V4L2_CAPTURE_THREAD_H
+#define V4L2_CAPTURE_THREAD_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <UsageEnvironment.hh>
+#include "capture_device.h"
+#include "encoded_frame.h"
+#include "spsc_ring.h"
+
+// Dequeues frames from a CaptureDevice on its own thread so the live555 event
+// loop never blocks in VIDIOC_DQBUF. Frames are pushed into a bounded SPSC
+// ring and the scheduler is woken through an event trigger; the event loop
+// drains the ring with popFrame().
+// With RTSP worker threads every worker registers an output of its own:
+// each active output gets its own ring and trigger, and a frame is shared
+// between them by reference, so the hot path stays lock-free.
+class v4l2CaptureThread {
+public:
+    explicit v4l2CaptureThread(CaptureDevice* capture);
+    ~v4l2CaptureThread();
+
+    // Registers a consumer event loop; returns its output number. Outputs
+    // start active and are never removed, only deactivated.
+    int addOutput(TaskScheduler& scheduler, EventTriggerId trigger, void* triggerClientData);
+    // Inactive outputs get no frames, so they don't pin zero-copy buffers
+    void setOutputActive(int output, bool active);
+
+    bool start(uint64_t firstIndex);
+    void stop();
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+
+    // Consumer side, from the event loop that owns the output only
+    bool popFrame(int output, FramePtr& frame);
+
+    // Ring occupancy, for monitoring
+    size_t ringSize(int output) const { return outputs[output].ring->size(); }
+    size_t ringCapacity() const { return outputCount.load() > 0 ? outputs[0].ring->capacity() : 0; }
+    size_t ringHighWaterMark(int output) const { return outputs[output].ring->highWaterMark(); }
+    uint64_t droppedFrames() const { return dropped.load(std::memory_order_relaxed); }
+    // CPU time used by the capture thread over all runs
+    uint64_t cpuNanos() const { return cpuTime.load(std::memory_order_relaxed); }
+    // Index the next captured frame will get; valid once stopped
+    uint64_t nextIndex() const { return nextFrameIndex; }
+
+private:
+    void run();
+    // Sleeps once 'failures' in a row pass CAPTURE_RETRY_LIMIT, so a
+    // device that keeps failing doesn't spin the thread
+    void backOff(unsigned failures);
+
+    struct Output {
+        std::unique_ptr<SpscRing<FramePtr>> ring;
+        TaskScheduler* scheduler;
+        EventTriggerId trigger;
+        void* triggerClientData;
+        std::atomic<bool> active;
+    };
+
+    CaptureDevice* capture;
+    Output outputs[CAPTURE_MAX_OUTPUTS];
+    std::atomic<int> outputCount;   // Slots below this are fully set up
+
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> cpuTime;
+    uint64_t nextFrameIndex;
+};
+
+#endif // V4L2_CAPTURE_THREAD_H
@@ -0,0 +1,68 @@
+#ifndef V4L2_DVR_FRAMED_SOURCE_H
+#define V4L2_DVR_FRAMED_SOURCE_H
+
+#include <FramedSource.hh>
+#include <vector>
+#include "dvr_buffer.h"
+
+// Plays one client session out of a camera's DvrBuffer, starting at an
+// IDR and sending one NAL unit at a time like v4l2H264FramedSource.
+// Without a seek it starts at the newest IDR; seekTo() moves the start
+// into the past. Frames are paced by their capture times, DVR_CATCHUP_RATE
+// times faster while there is backlog, so a timeshifted viewer drifts
+// back to live and then follows the capture. A viewer the DVR overwrites
+// is moved up to the oldest IDR still held.
+class v4l2DvrFramedSource : public FramedSource, public DvrBuffer::Reader {
+public:
+    static v4l2DvrFramedSource* createNew(UsageEnvironment& env, DvrBuffer* dvr);
+
+    // Starts playback at the IDR at or before 'captureNanos' (monotonic)
+    // and ends it after 'endNanos' (0 plays on). Returns the capture time
+    // of that IDR, or 0 if the DVR is empty.
+    uint64_t seekTo(uint64_t captureNanos, uint64_t endNanos);
+
+protected:
+    v4l2DvrFramedSource(UsageEnvironment& env, DvrBuffer* dvr);
+    virtual ~v4l2DvrFramedSource();
+
+private:
+    virtual void doGetNextFrame();
+    virtual void doStopGettingFrames();
+    virtual void frameStored();
+
+    bool position();
+    void beginFrame(uint64_t seq);
+    void sendParameterSet(const std::vector<uint8_t>& nal);
+    void sendNextNal();
+    void setPresentationTime();
+
+    DvrBuffer* fDvr;
+    CaptureDevice* fCapture;
+    StreamStats& fStats;
+    std::vector<uint8_t> fSps;    // Sent ahead of IDRs without in-band ones
+    std::vector<uint8_t> fPps;
+
+    enum State {
+        SENDING_SPS,
+        SENDING_PPS,
+        SENDING_FRAMES
+    };
+    State fState{SENDING_FRAMES};
+    bool fPositioned{false};
+    uint64_t fStartNanos{0};      // Seek target; UINT64_MAX for the newest IDR, 0 for the oldest
+    uint64_t fEndNanos{0};
+    uint64_t fSeq{0};             // Frame being sent
+    uint64_t fNalPosition{0};     // Next NAL unit of it in the DVR
+    unsigned fNalsLeft{0};
+    bool fWaiting{false};         // For the DVR to store the next frame
+
+    // Presentation time: wall clock at the first frame plus the paced
+    // capture time since
+    struct timeval fBaseTime;
+    uint64_t fPlayNanos{0};
+    uint64_t fFrameNanos{0};      // Capture time of fSeq
+    uint64_t fNextAdvance{0};     // Paced gap to fSeq + 1, if fAdvanceKnown
+    bool fAdvanceKnown{false};
+};
+
+#endif // V4L2_DVR_FRAMED_SOURCE_H
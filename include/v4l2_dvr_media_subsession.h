@@ -0,0 +1,34 @@
+#ifndef V4L2_DVR_MEDIA_SUBSESSION_H
+#define V4L2_DVR_MEDIA_SUBSESSION_H
+
+#include "dvr_buffer.h"
+#include "v4l2_h264_media_subsession.h"
+
+// Timeshift mount of a camera: like v4l2H264MediaSubsession, but every
+// session plays out of the camera's DvrBuffer. PLAY with an absolute
+// "Range: clock=<start>-[<end>]" starts at the IDR at or before <start>
+// (the oldest one held if <start> is older) and plays through to live,
+// or stops after <end>. Without a clock range a session starts at the
+// newest IDR, so it never waits for the encoder. The stream stays
+// unbounded in the SDP, so npt ranges play live.
+class v4l2DvrMediaSubsession : public v4l2H264MediaSubsession {
+public:
+    static v4l2DvrMediaSubsession* createNew(UsageEnvironment& env, DvrBuffer* dvr,
+                                             v4l2FrameDistributor* distributor);
+
+protected:
+    v4l2DvrMediaSubsession(UsageEnvironment& env, DvrBuffer* dvr, v4l2FrameDistributor* distributor);
+
+    virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
+    virtual void seekStreamSource(FramedSource* inputSource, char*& absStart, char*& absEnd);
+    virtual void startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler,
+                             void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                             ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                             void* serverRequestAlternativeByteHandlerClientData);
+    virtual void deleteStream(unsigned clientSessionId, void*& streamToken);
+
+private:
+    DvrBuffer* fDvr;
+};
+
+#endif // V4L2_DVR_MEDIA_SUBSESSION_H
@@ -0,0 +1,145 @@
+#ifndef V4L2_FRAME_DISTRIBUTOR_H
+#define V4L2_FRAME_DISTRIBUTOR_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <UsageEnvironment.hh>
+#include "capture_device.h"
+#include "encoded_frame.h"
+#include "v4l2_capture_thread.h"
+
+// Reads frames from a single CaptureDevice and hands them to any number of
+// consumers (one v4l2H264FramedSource per client session). Every frame is
+// dequeued and copied exactly once; consumers only keep a reference to it.
+// In CAPTURE_MODE_THREAD the dequeue happens on a v4l2CaptureThread and
+// frames arrive through an event trigger; in CAPTURE_MODE_NONBLOCK the
+// device fd is watched by the scheduler and read when it becomes readable;
+// in CAPTURE_MODE_SYNC they are read on the event loop when a consumer
+// asks for one.
+// The frames since the latest IDR are kept in a bounded GOP cache, and new
+// consumers start from the cached IDR instead of waiting for the next one.
+// How much of the pipeline survives an idle period is set by warmMode
+// (see WARM_CAPTURE_MODE).
+// With RTSP worker threads, each worker gets a shard (createShard()) that
+// serves the consumers on its event loop, and the primary only drives the
+// device.
+class v4l2FrameDistributor {
+public:
+    class Consumer {
+    public:
+        virtual ~Consumer() {}
+        // Called on the event loop thread once per requestFrame().
+        // 'continuous' is false if a frame the decoder needs was lost
+        // since the previous delivery; skipped non-reference frames don't
+        // count.
+        virtual void deliverFrame(const FramePtr& frame, bool continuous) = 0;
+    };
+
+    static v4l2FrameDistributor* createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                           int captureMode = CAPTURE_MODE,
+                                           bool zeroCopy = ZERO_COPY_FRAMES,
+                                           int warmMode = WARM_CAPTURE_MODE);
+    // Per-worker view of a capture owned by 'primary', which must use
+    // CAPTURE_MODE_THREAD. The shard gets every frame through a ring of its
+    // own; starting and idling it start and idle the shared device.
+    // Shards are created before the worker event loops run.
+    static v4l2FrameDistributor* createShard(UsageEnvironment& env, v4l2FrameDistributor* primary);
+    ~v4l2FrameDistributor();
+
+    void addConsumer(Consumer* consumer);
+    void removeConsumer(Consumer* consumer);
+
+    // Asks for the next frame after the last one delivered to this consumer.
+    // Delivery is immediate if that frame is already buffered.
+    void requestFrame(Consumer* consumer);
+    void cancelRequest(Consumer* consumer);
+
+    // Maps buffers and learns SPS/PPS once, then parks the device (STREAMOFF)
+    bool prepare();
+    bool startStreaming();
+    // Called when the last consumer is gone; applies warmMode
+    void idle();
+    // Full teardown regardless of warmMode
+    void stopStreaming();
+    bool isStreaming() const { return streaming; }
+    bool isShard() const { return primary != nullptr; }
+    int getWarmMode() const { return warmMode; }
+    unsigned consumerCount() const { return consumers.size(); }
+    // A new consumer would start with a replayed IDR
+    bool hasCachedGop() const { return !gopCache.empty(); }
+    // Index the next captured frame will get; older frames are backlog
+    uint64_t nextIndex() const { return nextFrameIndex; }
+    // Capture ring occupancy; zero in CAPTURE_MODE_SYNC
+    size_t ringSize() const { return captureThread ? captureThread->ringSize(captureOutput) : 0; }
+    // CPU time spent on this device by the capture thread and by the event
+    // loop (dequeue, distribution and packetizing for every consumer).
+    // The capture thread is only counted by the primary.
+    uint64_t captureCpuNanos() const {
+        return captureThread && primary == nullptr ? captureThread->cpuNanos() : 0;
+    }
+    uint64_t eventLoopCpuNanos() const { return eventLoopCpu.load(std::memory_order_relaxed); }
+
+private:
+    v4l2FrameDistributor(UsageEnvironment& env, CaptureDevice* capture, int captureMode,
+                         bool zeroCopy, int warmMode);
+    v4l2FrameDistributor(UsageEnvironment& env, v4l2FrameDistributor* primary);
+
+    struct ConsumerState {
+        Consumer* consumer;
+        uint64_t nextIndex;  // Index of the next frame this consumer wants
+        bool waiting;        // Has an outstanding requestFrame()
+    };
+    ConsumerState* findConsumer(Consumer* consumer);
+
+    void stopDelivery();
+    // Primary side of shard start/idle; called from worker threads
+    bool acquireShard();
+    void releaseShard();
+
+    static void readFrameTask(void* clientData);
+    void readFrame();
+    void scheduleRead();
+    static void framesReadyHandler(void* clientData);
+    void framesReady();
+    static void deviceReadableHandler(void* clientData, int mask);
+    void deviceReadable();
+    void addFrame(const FramePtr& frame);
+    void checkParameterSets(const EncodedFrame& frame);
+    void cacheFrame(const FramePtr& frame);
+    void clearGopCache();
+    FramePtr findFrame(uint64_t index) const;
+    void deliverToWaiting();
+    void deliverTo(ConsumerState& state);
+    FramePtr skipStaleFrames(const FramePtr& frame, bool& continuous);
+
+    UsageEnvironment& env;
+    CaptureDevice* capture;
+    int captureMode;
+    EventTriggerId framesReadyTrigger;
+    v4l2CaptureThread* captureThread;
+    std::vector<ConsumerState> consumers;
+    std::deque<FramePtr> recentFrames;  // Last historyDepth frames
+    size_t historyDepth;
+    std::deque<FramePtr> gopCache;      // Latest IDR and the frames after it
+    size_t gopCacheBytes;
+    size_t gopCacheMaxFrames;           // GOP_CACHE_MAX_FRAMES or the configured GOP
+    uint64_t nextFrameIndex;
+    TaskToken readTask;
+    int warmMode;
+    bool lowLatency;
+    bool prepared;        // Buffers mapped and SPS/PPS known
+    bool deviceRunning;   // STREAMON issued
+    bool streaming;       // Frames are being delivered
+    std::atomic<uint64_t> eventLoopCpu;
+    unsigned cpuTimerDepth;
+
+    v4l2FrameDistributor* primary;  // Set on shards only
+    int captureOutput;              // Our output of captureThread
+    std::mutex shardMutex;          // Primary: serializes device control by shards
+    unsigned activeShards;
+    bool spsPpsMismatchLogged;
+};
+
+#endif // V4L2_FRAME_DISTRIBUTOR_H
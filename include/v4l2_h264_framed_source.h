@@ -2,43 +2,71 @@
 #define V4L2_H264_FRAMED_SOURCE_H
 
 #include <FramedSource.hh>
-#include "v4l2_capture.h"
+#include <chrono>
+#include "capture_device.h"
+#include "v4l2_frame_distributor.h"
 #include "constants.h"
 
-class v4l2H264FramedSource : public FramedSource {
+class v4l2H264FramedSource : public FramedSource, public v4l2FrameDistributor::Consumer {
 public:
-    static v4l2H264FramedSource* createNew(UsageEnvironment& env, v4l2Capture* capture);
-    void setNeedSpsPps() { needSpsPps = true; }
-    
+    static v4l2H264FramedSource* createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                           v4l2FrameDistributor* distributor);
+
 protected:
-    v4l2H264FramedSource(UsageEnvironment& env, v4l2Capture* capture);
+    v4l2H264FramedSource(UsageEnvironment& env, CaptureDevice* capture, v4l2FrameDistributor* distributor);
     virtual ~v4l2H264FramedSource();
 
 private:
     virtual void doGetNextFrame();
-    v4l2Capture* fCapture;
+    virtual void doStopGettingFrames();
+    virtual void deliverFrame(const FramePtr& frame, bool continuous);
+    CaptureDevice* fCapture;
+    v4l2FrameDistributor* fDistributor;
     uint32_t fCurTimestamp{0};  // Current RTP timestamp
-    static const uint32_t TIMESTAMP_INCREMENT = 90000/FRAME_RATE_DENOMINATOR;  // 90kHz/30fps
+    uint32_t fFrameTicks;         // 90kHz ticks per frame at the device's frame rate
+    unsigned fFrameDuration;      // Microseconds per frame
     struct timeval fInitialTime;  // Base time for all calculations
 
+    // TIMESTAMP_MODE_CAPTURE: presentation times follow the driver's
+    // capture timestamps instead of the nominal frame rate
+    bool fCaptureTimestamps;
+    uint64_t fLastCaptureNanos{0};     // Monotonic time of the last frame sent
+    uint64_t fLastCaptureIndex{UINT64_MAX};
+    void setPresentationTime();
+
     enum GopState {
         WAITING_FOR_GOP,  // Initial state
         SENDING_SPS,
         SENDING_PPS,
-        SENDING_IDR,
         SENDING_FRAMES
     };
     GopState gopState{WAITING_FOR_GOP};
-    uint32_t currentGopTimestamp{0};  // Timestamp for current GOP
     
-    // Buffer for first IDR
-    unsigned char* firstIDRFrame{nullptr};
-    size_t firstIDRSize{0};
+    // First frame captured after this source attached; the cached GOP
+    // replayed ahead of it is backlog, whatever comes later is live
+    uint64_t fLiveIndex{0};
+
+    // Frame being sent NAL by NAL, shared with other consumers
+    FramePtr currentFrame;
+    unsigned nextNal{0};
     bool foundFirstGOP{false};
+    void sendNextNal();
+
+    // Startup latency: created at SETUP, first pulled at PLAY
+    std::chrono::steady_clock::time_point setupTime;
+    std::chrono::steady_clock::time_point playTime;
+    bool playStarted{false};
+    bool firstNalSent{false};
+    void logStartupLatency();
+
+    // Hands the NAL to the sink, which packs and sends its first RTP
+    // packet before returning; that time goes into the stats.
+    void deliverNal();
+    StreamStats& fStats;
 
-    bool needSpsPps{true};  // Flag to indicate if SPS/PPS needed
-    uint8_t* storedSps{nullptr};
-    uint8_t* storedPps{nullptr};
+    // This source's own SPS/PPS; 0 size if there were none to copy
+    uint8_t storedSps[MAX_PARAMETER_SET_SIZE];
+    uint8_t storedPps[MAX_PARAMETER_SET_SIZE];
     unsigned storedSpsSize{0};
     unsigned storedPpsSize{0};
 
@@ -2,25 +2,40 @@
 #define V4L2_H264_MEDIA_SUBSESSION_H
 
 #include <liveMedia.hh>
-#include "v4l2_capture.h"
+#include "bitrate_controller.h"
+#include "capture_device.h"
+#include "v4l2_frame_distributor.h"
 
 class v4l2H264MediaSubsession: public OnDemandServerMediaSubsession {
 public:
-    static v4l2H264MediaSubsession* createNew(UsageEnvironment& env, v4l2Capture* capture, Boolean reuseFirstSource);
+    // 'bitrateController' may be null, which disables adaptive bitrate
+    static v4l2H264MediaSubsession* createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                              v4l2FrameDistributor* distributor,
+                                              BitrateController* bitrateController, Boolean reuseFirstSource);
 
 protected:
-    v4l2H264MediaSubsession(UsageEnvironment& env, v4l2Capture* capture, Boolean reuseFirstSource);
+    v4l2H264MediaSubsession(UsageEnvironment& env, CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                            BitrateController* bitrateController, Boolean reuseFirstSource);
     virtual ~v4l2H264MediaSubsession();
 
     virtual FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate);
     virtual RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource);
+    virtual Groupsock* createGroupsock(struct sockaddr_storage const& addr, Port port);
+    virtual void startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler,
+                             void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                             ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                             void* serverRequestAlternativeByteHandlerClientData);
+    virtual RTCPInstance* createRTCP(Groupsock* RTCPgs, unsigned totSessionBW, unsigned char const* cname,
+                                     RTPSink* sink);
     virtual void deleteStream(unsigned clientSessionId, void*& streamToken);
     virtual char const* getAuxSDPLine(RTPSink* rtpSink, FramedSource* inputSource);
 
 private:
-    v4l2Capture* fCapture;
+    CaptureDevice* fCapture;
+    v4l2FrameDistributor* fDistributor;
+    BitrateController* fBitrateController;
     char* fAuxSDPLine;
-    unsigned streamingSessionId;  
+    unsigned fAuxSDPLineVersion;  // SPS/PPS version fAuxSDPLine was built from
 };
 
 #endif // V4L2_H264_MEDIA_SUBSESSION_H
@@ -0,0 +1,30 @@
+#ifndef V4L2_H264_RTP_SINK_H
+#define V4L2_H264_RTP_SINK_H
+
+#include <liveMedia.hh>
+#include "bitrate_controller.h"
+
+// H264VideoRTPSink that passes its client's RTCP receiver reports on to
+// the camera's BitrateController. One sink per client session.
+class v4l2H264RTPSink : public H264VideoRTPSink {
+public:
+    static v4l2H264RTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                      u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize,
+                                      BitrateController* bitrateController);
+
+    // For RTCPInstance::setRRHandler(), with the sink as client data
+    static void receiverReportHandler(void* clientData);
+
+protected:
+    v4l2H264RTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                    u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize,
+                    BitrateController* bitrateController);
+    virtual ~v4l2H264RTPSink();
+
+private:
+    void onReceiverReport();
+
+    BitrateController* fBitrateController;
+};
+
+#endif // V4L2_H264_RTP_SINK_H
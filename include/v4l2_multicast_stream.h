@@ -0,0 +1,41 @@
+#ifndef V4L2_MULTICAST_STREAM_H
+#define V4L2_MULTICAST_STREAM_H
+
+#include <string>
+#include <liveMedia.hh>
+#include <Groupsock.hh>
+#include "capture_device.h"
+#include "v4l2_frame_distributor.h"
+
+// SSM multicast mount of one camera: a single RTP sink sends to a
+// source-specific multicast group and a PassiveServerMediaSubsession
+// advertises it, so every viewer that SETUPs joins the group and egress
+// stays one stream however many decoders tune in. The sink is a consumer
+// of the camera's distributor like any unicast session, and it keeps the
+// capture running for as long as the mount exists.
+class v4l2MulticastStream {
+public:
+    // 'port' is the RTP port; RTCP uses port + 1
+    static v4l2MulticastStream* createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                          v4l2FrameDistributor* distributor, const std::string& group, int port);
+    ~v4l2MulticastStream();
+
+    // Mount named 'streamName' for the server; starts sending
+    ServerMediaSession* createSession(const std::string& streamName);
+
+private:
+    v4l2MulticastStream(UsageEnvironment& env, CaptureDevice* capture, v4l2FrameDistributor* distributor);
+    bool initialize(const std::string& group, int port);
+    static void afterPlaying(void* clientData);
+
+    UsageEnvironment& fEnv;
+    CaptureDevice* fCapture;
+    v4l2FrameDistributor* fDistributor;
+    Groupsock* fRtpGroupsock;
+    Groupsock* fRtcpGroupsock;
+    RTPSink* fSink;
+    RTCPInstance* fRtcp;
+    FramedSource* fSource;    // Framer around our v4l2H264FramedSource
+};
+
+#endif // V4L2_MULTICAST_STREAM_H
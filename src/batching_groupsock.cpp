@@ -0,0 +1,166 @@
+#include "batching_groupsock.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103   // linux/udp.h, Linux 4.18+
+#endif
+
+// Kernel limits for one GSO send: 64 segments, one IP datagram's payload
+static const unsigned GSO_MAX_SEGMENTS = 64;
+static const unsigned GSO_MAX_BYTES = 65000;
+
+static bool isMulticast(struct sockaddr_storage const& address) {
+    if (address.ss_family == AF_INET) {
+        return IN_MULTICAST(ntohl(reinterpret_cast<const struct sockaddr_in&>(address).sin_addr.s_addr));
+    }
+    if (address.ss_family == AF_INET6) {
+        return IN6_IS_ADDR_MULTICAST(&reinterpret_cast<const struct sockaddr_in6&>(address).sin6_addr);
+    }
+    return false;
+}
+
+static bool sameDestination(struct sockaddr_storage const& a, struct sockaddr_storage const& b) {
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_INET) {
+        const struct sockaddr_in& a4 = reinterpret_cast<const struct sockaddr_in&>(a);
+        const struct sockaddr_in& b4 = reinterpret_cast<const struct sockaddr_in&>(b);
+        return a4.sin_port == b4.sin_port && a4.sin_addr.s_addr == b4.sin_addr.s_addr;
+    }
+    const struct sockaddr_in6& a6 = reinterpret_cast<const struct sockaddr_in6&>(a);
+    const struct sockaddr_in6& b6 = reinterpret_cast<const struct sockaddr_in6&>(b);
+    return a6.sin6_port == b6.sin6_port && memcmp(&a6.sin6_addr, &b6.sin6_addr, sizeof(a6.sin6_addr)) == 0;
+}
+
+BatchingGroupsock::BatchingGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+                                     Port port, u_int8_t ttl, CaptureDevice* capture)
+    : Groupsock(env, groupAddr, port, ttl), fCapture(capture), fFlushTask(nullptr), fGso(RTP_EGRESS_GSO != 0) {
+}
+
+BatchingGroupsock::~BatchingGroupsock() {
+    flush();
+}
+
+Boolean BatchingGroupsock::write(struct sockaddr_storage const& addressAndPort, u_int8_t ttl,
+                                 unsigned char* buffer, unsigned bufferSize) {
+    if (isMulticast(addressAndPort)) {
+        return Groupsock::write(addressAndPort, ttl, buffer, bufferSize);
+    }
+
+    Batch& batch = batchFor(addressAndPort);
+    batch.data.insert(batch.data.end(), buffer, buffer + bufferSize);
+    batch.sizes.push_back(bufferSize);
+
+    // The marker bit ends the access unit
+    bool marker = bufferSize >= 2 && (buffer[1] & 0x80);
+    if (marker || batch.sizes.size() >= RTP_BATCH_MAX_PACKETS) {
+        send(batch);
+    } else if (fFlushTask == nullptr) {
+        fFlushTask = env().taskScheduler().scheduleDelayedTask(RTP_BATCH_FLUSH_US, flushTask, this);
+    }
+    // Send errors are logged at flush time; a lost UDP packet is not
+    // something the sink could act on anyway
+    return True;
+}
+
+BatchingGroupsock::Batch& BatchingGroupsock::batchFor(struct sockaddr_storage const& destination) {
+    for (Batch& batch : fBatches) {
+        if (sameDestination(batch.destination, destination)) return batch;
+    }
+    fBatches.push_back(Batch());
+    fBatches.back().destination = destination;
+    fBatches.back().data.reserve(RTP_BATCH_MAX_PACKETS * 1500);
+    return fBatches.back();
+}
+
+void BatchingGroupsock::flushTask(void* clientData) {
+    BatchingGroupsock* self = static_cast<BatchingGroupsock*>(clientData);
+    self->fFlushTask = nullptr;
+    self->flush();
+}
+
+void BatchingGroupsock::flush() {
+    env().taskScheduler().unscheduleDelayedTask(fFlushTask);
+    for (Batch& batch : fBatches) {
+        if (!batch.sizes.empty()) send(batch);
+    }
+}
+
+unsigned BatchingGroupsock::buildMessages(Batch& batch, bool gso) {
+    size_t packets = batch.sizes.size();
+    fMessages.resize(packets);
+    fIovecs.resize(packets);
+    fControl.assign(packets * CMSG_SPACE(sizeof(uint16_t)), 0);
+    socklen_t addressLength = batch.destination.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                                                       : sizeof(struct sockaddr_in);
+
+    unsigned count = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i < packets; ++count) {
+        // A GSO run: equal-sized segments, the last one may be shorter
+        unsigned segment = batch.sizes[i];
+        size_t runBytes = segment;
+        size_t end = i + 1;
+        if (gso) {
+            while (end < packets && end - i < GSO_MAX_SEGMENTS && runBytes + batch.sizes[end] <= GSO_MAX_BYTES &&
+                   batch.sizes[end] <= segment) {
+                runBytes += batch.sizes[end];
+                if (batch.sizes[end++] < segment) break;
+            }
+        }
+
+        struct msghdr& header = fMessages[count].msg_hdr;
+        memset(&fMessages[count], 0, sizeof(fMessages[count]));
+        fIovecs[count].iov_base = &batch.data[offset];
+        fIovecs[count].iov_len = runBytes;
+        header.msg_name = &batch.destination;
+        header.msg_namelen = addressLength;
+        header.msg_iov = &fIovecs[count];
+        header.msg_iovlen = 1;
+        if (end - i > 1) {
+            header.msg_control = &fControl[count * CMSG_SPACE(sizeof(uint16_t))];
+            header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segmentSize = segment;
+            memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+        }
+        offset += runBytes;
+        i = end;
+    }
+    return count;
+}
+
+void BatchingGroupsock::send(Batch& batch) {
+    unsigned count = buildMessages(batch, fGso);
+    unsigned sent = 0;
+    StreamStats& stats = fCapture->getStats();
+    while (sent < count) {
+        int ret = sendmmsg(socketNum(), &fMessages[sent], count - sent, 0);
+        StreamStats::add(stats.rtpSendCalls);
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (fGso && sent == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+            // Kernel or NIC without UDP GSO; plain batches from now on
+            LOG_INFO("UDP GSO unavailable (" + std::string(strerror(errno)) + "), using sendmmsg() only.");
+            fGso = false;
+            count = buildMessages(batch, false);
+            continue;
+        }
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, "RTP sendmmsg error, " + std::to_string(batch.sizes.size()) +
+                         " packets dropped: " + std::string(strerror(errno)));
+        break;
+    }
+    StreamStats::add(stats.rtpPackets, batch.sizes.size());
+    batch.data.clear();
+    batch.sizes.clear();
+}
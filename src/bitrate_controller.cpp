@@ -0,0 +1,53 @@
+#include "bitrate_controller.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+
+static uint64_t monotonicMillis() {
+    return monotonicNanos() / 1000000ULL;
+}
+
+BitrateController::BitrateController(CaptureDevice* capture)
+    : capture(capture), lastChangeMs(0), lastCongestionMs(0) {
+    const DeviceConfig& config = capture->getConfig();
+    ceiling = config.maxBitrate > 0 ? config.maxBitrate : config.bitrate;
+    floor = std::min(config.minBitrate, ceiling);
+    LOG_INFO("Adaptive bitrate for " + config.device + ": " + std::to_string(floor / 1000) + "-" +
+             std::to_string(ceiling / 1000) + " kbps.");
+}
+
+void BitrateController::onReceiverReport(const std::string& client, double lossFraction, double jitterMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t now = monotonicMillis();
+    int current = capture->getBitrate();
+    bool congested = lossFraction > ADAPTIVE_BITRATE_LOSS_HIGH || jitterMs > ADAPTIVE_BITRATE_JITTER_HIGH_MS;
+    bool clear = lossFraction < ADAPTIVE_BITRATE_LOSS_LOW && jitterMs <= ADAPTIVE_BITRATE_JITTER_HIGH_MS;
+
+    char reason[160];
+    snprintf(reason, sizeof(reason), "RR from %s: loss %.1f%%, jitter %.1f ms", client.c_str(),
+             lossFraction * 100.0, jitterMs);
+
+    if (congested) lastCongestionMs = now;
+    bool settled = lastChangeMs == 0 || now - lastChangeMs >= ADAPTIVE_BITRATE_MIN_INTERVAL_MS;
+
+    if (congested && current > floor && settled) {
+        apply(std::max(floor, static_cast<int>(current * ADAPTIVE_BITRATE_DECREASE)), reason);
+    } else if (clear && current < ceiling && settled &&
+               now - lastCongestionMs >= ADAPTIVE_BITRATE_HOLD_MS) {
+        int step = std::max(1, static_cast<int>(ceiling * ADAPTIVE_BITRATE_INCREASE));
+        apply(std::min(ceiling, current + step), reason);
+    } else {
+        LOG_DEBUG(std::string("Bitrate hold at ") + std::to_string(current / 1000) + " kbps (" + reason + ").");
+    }
+}
+
+bool BitrateController::apply(int newBitrate, const std::string& reason) {
+    int current = capture->getBitrate();
+    if (!capture->setBitrate(newBitrate)) return false;
+
+    lastChangeMs = monotonicMillis();
+    StreamStats::add(capture->getStats().bitrateChanges);
+    LOG_INFO(capture->getConfig().device + " bitrate " + std::to_string(current / 1000) + " -> " +
+             std::to_string(newBitrate / 1000) + " kbps (" + reason + ").");
+    return true;
+}
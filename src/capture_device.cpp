@@ -0,0 +1,178 @@
+#include "capture_device.h"
+#include "file_replay_capture.h"
+#include "logger.h"
+#include "v4l2_capture.h"
+#include <cstring>
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+CaptureDevice* CaptureDevice::createNew(const DeviceConfig& config) {
+    if (endsWith(config.device, ".h264") || endsWith(config.device, ".264") ||
+        endsWith(config.device, FRAME_DUMP_EXTENSION)) {
+        return new FileReplayCapture(config);
+    }
+    return new v4l2Capture(config);
+}
+
+CaptureDevice::CaptureDevice(const DeviceConfig& config)
+    : config(config)
+    , fd(-1)
+    , nonBlocking(config.captureMode == CAPTURE_MODE_NONBLOCK)
+    , sps(nullptr)
+    , pps(nullptr)
+    , spsSize(0)
+    , ppsSize(0)
+    , spsPpsExtracted(false)
+    , spsPpsVersion(0)
+    , paramCache(nullptr)
+    , framePool(stats)
+    , sequenceValid(false)
+    , bitrate(config.bitrate)
+    , lastKeyFrameRequestMs(0)
+    , wallClockOffsetNanos(0)
+    , lastSequence(0)
+    , dumpWriter(config.dumpPath.empty() ? nullptr : new FrameDumpWriter(config.dumpPath)) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    wallClockOffsetNanos = int64_t(now.tv_sec) * 1000000000LL + int64_t(now.tv_usec) * 1000LL -
+                           int64_t(monotonicNanos());
+}
+
+CaptureDevice::~CaptureDevice() {
+    if (paramCacheWriter.joinable()) paramCacheWriter.join();
+    delete[] sps;
+    delete[] pps;
+    delete paramCache;
+    delete dumpWriter;
+}
+
+bool CaptureDevice::setBitrate(int bitsPerSecond) {
+    if (!applyBitrate(bitsPerSecond)) return false;
+    bitrate.store(bitsPerSecond, std::memory_order_relaxed);
+    stats.bitrate.store(bitsPerSecond, std::memory_order_relaxed);
+    return true;
+}
+
+bool CaptureDevice::requestKeyFrame(const std::string& reason) {
+    (void)reason;  // Only logged at debug level, which may be compiled out
+    uint64_t now = monotonicNanos() / 1000000ULL;
+    uint64_t last = lastKeyFrameRequestMs.load(std::memory_order_relaxed);
+    if (last != 0 && now - last < KEYFRAME_REQUEST_MIN_INTERVAL_MS) return false;
+    // One caller wins if several viewers ask at once
+    if (!lastKeyFrameRequestMs.compare_exchange_strong(last, now)) return false;
+
+    if (!forceKeyFrame()) return false;
+    StreamStats::add(stats.keyFrameRequests);
+    LOG_DEBUG("Forced keyframe on " + config.device + " (" + reason + ").");
+    return true;
+}
+
+struct timeval CaptureDevice::toWallClock(uint64_t monotonicNanos) const {
+    int64_t wallNanos = int64_t(monotonicNanos) + wallClockOffsetNanos;
+    struct timeval tv;
+    tv.tv_sec = wallNanos / 1000000000LL;
+    tv.tv_usec = (wallNanos % 1000000000LL) / 1000;
+    return tv;
+}
+
+uint64_t CaptureDevice::toMonotonic(const struct timeval& wallClock) const {
+    int64_t wallNanos = int64_t(wallClock.tv_sec) * 1000000000LL + int64_t(wallClock.tv_usec) * 1000LL;
+    int64_t nanos = wallNanos - wallClockOffsetNanos;
+    return nanos > 0 ? uint64_t(nanos) : 0;
+}
+
+void CaptureDevice::frameCaptured(const EncodedFrame& frame) {
+    if (sequenceValid && frame.sequence - lastSequence > 1) {
+        uint32_t lost = frame.sequence - lastSequence - 1;
+        StreamStats::add(stats.sequenceGaps, lost);
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, config.device + " dropped " + std::to_string(lost) +
+                         " frame(s) before sequence " + std::to_string(frame.sequence) + ".");
+    }
+    lastSequence = frame.sequence;
+    sequenceValid = true;
+
+    StreamStats::add(stats.frames);
+    StreamStats::add(stats.bytes, frame.length);
+    if (frame.keyFrame) StreamStats::add(stats.keyFrames);
+    if (dumpWriter != nullptr) dumpWriter->write(frame);
+}
+
+void CaptureDevice::setParameterSetCacheKey(const std::string& key) {
+    delete paramCache;
+    paramCache = PARAM_SET_CACHE_ENABLED ? new ParameterSetCache(config.device, key) : nullptr;
+}
+
+void CaptureDevice::storeParameterSet(uint8_t*& dst, unsigned& dstSize, const uint8_t* src, size_t size) {
+    delete[] dst;
+    dstSize = size;
+    dst = new uint8_t[dstSize];
+    memcpy(dst, src, dstSize);
+}
+
+bool CaptureDevice::loadCachedSpsPps() {
+    if (paramCache == nullptr) return false;
+
+    std::vector<uint8_t> cachedSps, cachedPps;
+    std::string cachedFmtp;
+    if (!paramCache->load(cachedSps, cachedPps, cachedFmtp)) return false;
+
+    storeParameterSet(sps, spsSize, cachedSps.data(), cachedSps.size());
+    storeParameterSet(pps, ppsSize, cachedPps.data(), cachedPps.size());
+    fmtpParams = cachedFmtp;
+    spsPpsExtracted = true;
+    spsPpsVersion++;
+    LOG_INFO("Loaded SPS/PPS from " + paramCache->getPath());
+    return true;
+}
+
+void CaptureDevice::spsPpsChanged() {
+    fmtpParams = buildFmtpParams(sps, spsSize, pps, ppsSize);
+    spsPpsVersion++;
+    if (paramCache != nullptr) {
+        // Changes come from the event loop, which shouldn't wait on the
+        // disk; the writer gets copies of everything. Changes are seconds
+        // apart, so joining the previous write hardly ever blocks.
+        if (paramCacheWriter.joinable()) paramCacheWriter.join();
+        ParameterSetCache cache(*paramCache);
+        std::vector<uint8_t> spsCopy(sps, sps + spsSize);
+        std::vector<uint8_t> ppsCopy(pps, pps + ppsSize);
+        std::string fmtp = fmtpParams;
+        paramCacheWriter = std::thread([cache, spsCopy, ppsCopy, fmtp]() {
+            cache.store(spsCopy.data(), spsCopy.size(), ppsCopy.data(), ppsCopy.size(), fmtp);
+        });
+    }
+}
+
+bool CaptureDevice::matchesSpsPps(const uint8_t* otherSps, size_t otherSpsSize,
+                                  const uint8_t* otherPps, size_t otherPpsSize) const {
+    return spsPpsExtracted &&
+           otherSpsSize == spsSize && memcmp(otherSps, sps, spsSize) == 0 &&
+           otherPpsSize == ppsSize && memcmp(otherPps, pps, ppsSize) == 0;
+}
+
+bool CaptureDevice::updateSpsPps(const uint8_t* newSps, size_t newSpsSize,
+                                 const uint8_t* newPps, size_t newPpsSize) {
+    if (matchesSpsPps(newSps, newSpsSize, newPps, newPpsSize)) return false;
+
+    storeParameterSet(sps, spsSize, newSps, newSpsSize);
+    storeParameterSet(pps, ppsSize, newPps, newPpsSize);
+    spsPpsExtracted = true;
+    spsPpsChanged();
+    LOG_INFO("SPS/PPS changed in the live stream, updated.");
+    return true;
+}
+
+void CaptureDevice::clearSpsPps() {
+    delete[] sps;
+    delete[] pps;
+    sps = nullptr;
+    pps = nullptr;
+    spsSize = 0;
+    ppsSize = 0;
+    spsPpsExtracted = false;
+    fmtpParams.clear();
+    spsPpsVersion++;
+    LOG_DEBUG("Cleared SPS/PPS data");
+}
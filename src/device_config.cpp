@@ -0,0 +1,123 @@
+#include "device_config.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <sstream>
+
+static bool parseUnsigned(const std::string& text, unsigned& value) {
+    if (text.empty()) return false;
+    char* end = nullptr;
+    unsigned long parsed = strtoul(text.c_str(), &end, 10);
+    if (*end != '\0' || parsed == 0) return false;
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+bool parseDeviceConfig(const std::string& spec, DeviceConfig& config) {
+    std::stringstream stream(spec);
+    std::string item;
+
+    if (!std::getline(stream, item, ',') || item.empty()) {
+        LOG_ERROR("Device spec '" + spec + "' has no device path");
+        return false;
+    }
+    config.device = item;
+
+    while (std::getline(stream, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            LOG_ERROR("Bad device option '" + item + "', expected key=value");
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        unsigned number = 0;
+        bool ok = true;
+
+        if (key == "name") {
+            ok = !value.empty();
+            config.streamName = value;
+        } else if (key == "size") {
+            size_t x = value.find('x');
+            unsigned w = 0, h = 0;
+            ok = x != std::string::npos && parseUnsigned(value.substr(0, x), w) &&
+                 parseUnsigned(value.substr(x + 1), h);
+            if (ok) {
+                config.width = w;
+                config.height = h;
+            }
+        } else if (key == "bitrate") {
+            ok = parseUnsigned(value, number);
+            if (ok) config.bitrate = number;
+        } else if (key == "gop") {
+            ok = parseUnsigned(value, number);
+            if (ok) config.gopSize = number;
+        } else if (key == "fps") {
+            ok = parseUnsigned(value, number);
+            if (ok) {
+                config.frameRateNumerator = 1;
+                config.frameRateDenominator = number;
+            }
+        } else if (key == "rotate") {
+            config.rotation = atoi(value.c_str());
+        } else if (key == "mode") {
+            if (value == "sync") config.captureMode = CAPTURE_MODE_SYNC;
+            else if (value == "thread") config.captureMode = CAPTURE_MODE_THREAD;
+            else if (value == "nonblock") config.captureMode = CAPTURE_MODE_NONBLOCK;
+            else ok = false;
+        } else if (key == "timestamps") {
+            if (value == "capture") config.timestampMode = TIMESTAMP_MODE_CAPTURE;
+            else if (value == "synthetic") config.timestampMode = TIMESTAMP_MODE_SYNTHETIC;
+            else ok = false;
+        } else if (key == "latency") {
+            if (value == "low") config.lowLatency = true;
+            else if (value == "normal") config.lowLatency = false;
+            else ok = false;
+        } else if (key == "abr") {
+            if (value == "on") config.adaptiveBitrate = true;
+            else if (value == "off") config.adaptiveBitrate = false;
+            else ok = false;
+        } else if (key == "minbitrate") {
+            ok = parseUnsigned(value, number);
+            if (ok) config.minBitrate = number;
+        } else if (key == "maxbitrate") {
+            ok = parseUnsigned(value, number);
+            if (ok) config.maxBitrate = number;
+        } else if (key == "pace") {
+            if (value == "recorded") config.replayPace = REPLAY_PACE_RECORDED;
+            else if (value == "fast") config.replayPace = REPLAY_PACE_FAST;
+            else ok = false;
+        } else if (key == "dump") {
+            ok = !value.empty();
+            config.dumpPath = value;
+        } else if (key == "multicast") {
+            size_t colon = value.find(':');
+            std::string group = value.substr(0, colon);
+            struct in_addr address;
+            ok = inet_pton(AF_INET, group.c_str(), &address) == 1 && IN_MULTICAST(ntohl(address.s_addr));
+            if (ok && colon != std::string::npos) {
+                ok = parseUnsigned(value.substr(colon + 1), number) && number < 65535 && number % 2 == 0;
+                if (ok) config.multicastPort = number;
+            }
+            if (ok) config.multicastGroup = group;
+        } else if (key == "record") {
+            ok = !value.empty();
+            config.recordDirectory = value;
+        } else if (key == "dvr") {
+            ok = parseUnsigned(value, number);
+            if (ok) config.dvrSeconds = number;
+        } else if (key == "hls") {
+            if (value == "on") config.hls = true;
+            else if (value == "off") config.hls = false;
+            else ok = false;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            LOG_ERROR("Bad device option '" + item + "' for " + config.device);
+            return false;
+        }
+    }
+    return true;
+}
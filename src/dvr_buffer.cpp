@@ -0,0 +1,177 @@
+#include "dvr_buffer.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstring>
+
+DvrBuffer* DvrBuffer::createNew(CaptureDevice* capture, v4l2FrameDistributor* distributor, unsigned seconds) {
+    // Sized for the highest bitrate adaptive bitrate may pick, so the
+    // buffer holds at least 'seconds' however the encoder is steered
+    const DeviceConfig& config = capture->getConfig();
+    uint64_t bitrate = std::max(config.bitrate, config.maxBitrate);
+    uint64_t arenaBytes = seconds * bitrate / 8 * DVR_BITRATE_HEADROOM;
+    arenaBytes = std::max<uint64_t>(arenaBytes, GOP_CACHE_MAX_BYTES);
+    if (arenaBytes > DVR_MAX_ARENA_BYTES) {
+        LOG_WARN("DVR of " + config.device + " capped at " + std::to_string(DVR_MAX_ARENA_BYTES >> 20) +
+                 " MiB, it will hold less than " + std::to_string(seconds) + " s.");
+        arenaBytes = DVR_MAX_ARENA_BYTES;
+    }
+    uint64_t fps = (config.frameRateDenominator + config.frameRateNumerator - 1) / config.frameRateNumerator;
+    uint64_t frameCapacity = seconds * fps * DVR_FRAME_HEADROOM + 1;
+
+    DvrBuffer* dvr = new DvrBuffer(capture, distributor, arenaBytes, frameCapacity);
+    if (!dvr->start()) {
+        delete dvr;
+        return nullptr;
+    }
+    LOG_INFO("DVR of " + config.device + ": " + std::to_string(seconds) + " s in " +
+             std::to_string(arenaBytes >> 20) + " MiB, " + std::to_string(frameCapacity) + " frames.");
+    return dvr;
+}
+
+DvrBuffer::DvrBuffer(CaptureDevice* capture, v4l2FrameDistributor* distributor, size_t arenaBytes,
+                     size_t frameCapacity)
+    : capture(capture), distributor(distributor), stats(capture->getStats()),
+      arena(arenaBytes), writePosition(0), frames(frameCapacity), firstSeq(0), nextSeq(0),
+      keyFrames(frameCapacity), firstKey(0), nextKey(0), waitingForKeyFrame(true) {
+    // Zero-filled above, so the arena is resident from the start
+    waiting.reserve(16);
+    notifying.reserve(16);
+}
+
+DvrBuffer::~DvrBuffer() {
+    distributor->removeConsumer(this);
+}
+
+bool DvrBuffer::start() {
+    // Like recording, the DVR has no viewer to start the capture
+    if (!distributor->isStreaming() && !distributor->startStreaming()) {
+        LOG_ERROR("Failed to start capture for the DVR of " + capture->getConfig().device + ".");
+        return false;
+    }
+    distributor->addConsumer(this);
+    distributor->requestFrame(this);
+    return true;
+}
+
+void DvrBuffer::deliverFrame(const FramePtr& frame, bool continuous) {
+    if (!continuous) waitingForKeyFrame = true;
+    if (waitingForKeyFrame && frame->isIDR()) waitingForKeyFrame = false;
+    if (!waitingForKeyFrame) {
+        store(*frame);
+        notifyReaders();
+    }
+    distributor->requestFrame(this);  // May deliver again right away
+}
+
+void DvrBuffer::store(const EncodedFrame& frame) {
+    size_t need = 0;
+    for (unsigned i = 0; i < frame.nalCount; ++i) {
+        need += 4 + frame.nals[i].length;
+    }
+    if (need == 0) return;
+    if (need > arena.size()) {
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, std::string("Frame larger than the DVR, skipping to the next IDR."));
+        waitingForKeyFrame = true;
+        return;
+    }
+
+    // A frame never straddles the end of the arena
+    size_t offset = writePosition % arena.size();
+    if (offset + need > arena.size()) {
+        writePosition += arena.size() - offset;
+        offset = 0;
+    }
+    // Overwritten frames go, oldest first
+    while (nextSeq > firstSeq && (frames[firstSeq % frames.size()].position + arena.size() < writePosition + need ||
+                                  nextSeq - firstSeq == frames.size())) {
+        evictOldest();
+    }
+
+    Frame& stored = frames[nextSeq % frames.size()];
+    stored.captureNanos = frame.captureNanos;
+    stored.position = writePosition;
+    stored.length = need;
+    stored.nalCount = frame.nalCount;
+    stored.keyFrame = frame.isIDR();
+    stored.parameterSets = frame.hasParameterSets();
+
+    uint8_t* out = arena.data() + offset;
+    for (unsigned i = 0; i < frame.nalCount; ++i) {
+        uint32_t length = frame.nals[i].length;
+        out[0] = length >> 24;
+        out[1] = length >> 16;
+        out[2] = length >> 8;
+        out[3] = length;
+        memcpy(out + 4, frame.nalData(i), length);
+        out += 4 + length;
+    }
+    writePosition += need;
+
+    if (stored.keyFrame) {
+        if (nextKey - firstKey == keyFrames.size()) firstKey++;
+        KeyFrame& key = keyFrames[nextKey % keyFrames.size()];
+        key.captureNanos = frame.captureNanos;
+        key.seq = nextSeq;
+        nextKey++;
+    }
+    nextSeq++;
+    stats.dvrWindowMs.store(windowNanos() / 1000000, std::memory_order_relaxed);
+}
+
+void DvrBuffer::evictOldest() {
+    if (nextKey > firstKey && keyFrame(firstKey).seq == firstSeq) firstKey++;
+    firstSeq++;
+}
+
+const uint8_t* DvrBuffer::nalAt(uint64_t& position, uint32_t& length) const {
+    const uint8_t* p = arena.data() + position % arena.size();
+    length = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    position += 4 + length;
+    return p + 4;
+}
+
+bool DvrBuffer::findKeyFrame(uint64_t captureNanos, uint64_t& seq) const {
+    if (nextKey == firstKey) return false;
+    // Last key frame at or before 'captureNanos'; capture times only grow
+    uint64_t low = firstKey, high = nextKey;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (keyFrame(middle).captureNanos <= captureNanos) low = middle;
+        else high = middle;
+    }
+    seq = keyFrame(low).seq;
+    return true;
+}
+
+bool DvrBuffer::latestKeyFrame(uint64_t& seq) const {
+    if (nextKey == firstKey) return false;
+    seq = keyFrame(nextKey - 1).seq;
+    return true;
+}
+
+uint64_t DvrBuffer::windowNanos() const {
+    if (nextSeq - firstSeq < 2) return 0;
+    return frame(nextSeq - 1).captureNanos - frame(firstSeq).captureNanos;
+}
+
+void DvrBuffer::waitForFrame(Reader* reader) {
+    if (std::find(waiting.begin(), waiting.end(), reader) == waiting.end()) {
+        waiting.push_back(reader);
+    }
+}
+
+void DvrBuffer::cancelWait(Reader* reader) {
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), reader), waiting.end());
+    // Also if a reader being notified right now closes another one
+    std::replace(notifying.begin(), notifying.end(), reader, static_cast<Reader*>(nullptr));
+}
+
+void DvrBuffer::notifyReaders() {
+    // Readers wait again from inside frameStored(); both lists keep their
+    // capacity, so this doesn't allocate
+    waiting.swap(notifying);
+    for (size_t i = 0; i < notifying.size(); ++i) {
+        if (notifying[i] != nullptr) notifying[i]->frameStored();
+    }
+    notifying.clear();
+}
@@ -0,0 +1,279 @@
+#include "file_replay_capture.h"
+#include "h264_nal_parser.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+FileReplayCapture::FileReplayCapture(const DeviceConfig& config)
+    : CaptureDevice(config)
+    , mapping(nullptr)
+    , mappingSize(0)
+    , loopMicros(0)
+    , nextFrame(0)
+    , passStartNanos(0)
+    , passSequence(0)
+    , zeroCopy(false)
+    , streaming(false)
+    , fastPace(config.replayPace == REPLAY_PACE_FAST) {
+    int file = open(config.device.c_str(), O_RDONLY);
+    if (file == -1) {
+        LOG_ERROR("Cannot open recording " + config.device + ": " + std::string(strerror(errno)));
+        return;
+    }
+    struct stat st;
+    if (fstat(file, &st) == -1 || st.st_size == 0) {
+        LOG_ERROR("Recording " + config.device + " is empty or unreadable.");
+        close(file);
+        return;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Cannot map recording " + config.device + ": " + std::string(strerror(errno)));
+        return;
+    }
+    mapping = static_cast<const uint8_t*>(mapped);
+    mappingSize = st.st_size;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (nonBlocking ? TFD_NONBLOCK : 0));
+    if (fd == -1) {
+        LOG_ERROR("timerfd_create error: " + std::string(strerror(errno)));
+    }
+}
+
+FileReplayCapture::~FileReplayCapture() {
+    if (mapping != nullptr) munmap(const_cast<uint8_t*>(mapping), mappingSize);
+    if (fd >= 0) close(fd);
+}
+
+bool FileReplayCapture::initialize() {
+    if (mapping == nullptr) return false;
+
+    std::string path = config.device;
+    bool dump = path.size() >= strlen(FRAME_DUMP_EXTENSION) &&
+                path.compare(path.size() - strlen(FRAME_DUMP_EXTENSION), std::string::npos, FRAME_DUMP_EXTENSION) == 0;
+    if (!(dump ? indexDump() : indexAnnexB())) return false;
+
+    const ReplayFrame& last = frames.back();
+    // The last frame lasts as long as the one before it
+    uint64_t lastDuration = frames.size() > 1 ? last.captureMicros - frames[frames.size() - 2].captureMicros
+                                              : config.frameMicros();
+    loopMicros = last.captureMicros + (lastDuration > 0 ? lastDuration : config.frameMicros());
+
+    size_t maxLength = 0;
+    for (const ReplayFrame& frame : frames) {
+        if (frame.length > maxLength) maxLength = frame.length;
+    }
+    framePool.reserve(maxLength, 0);
+
+    LOG_INFO("Replaying " + std::to_string(frames.size()) + " frames (" +
+             std::to_string(loopMicros / 1000) + " ms) from " + path +
+             (fastPace ? " as fast as possible." : " at recorded pace."));
+    if (!extractSpsPps()) {
+        LOG_WARN("No SPS/PPS in " + path + ", clients will wait for in-band ones.");
+    }
+    return true;
+}
+
+bool FileReplayCapture::indexAnnexB() {
+    // An access unit starts at an AUD, SPS, PPS or SEI following a slice,
+    // or at a slice whose first_mb_in_slice is 0 (leading ue(v) bit set)
+    bool auHasSlice = false;
+    size_t pos = findStartCode(mapping, mappingSize);
+    while (pos < mappingSize) {
+        size_t nal = pos + 3;
+        size_t next = findStartCode(mapping, mappingSize, nal);
+        if (nal < mappingSize) {
+            uint8_t type = mapping[nal] & 0x1F;
+            bool slice = type == NAL_TYPE_SLICE || type == NAL_TYPE_IDR;
+            bool startsAu = frames.empty() ||
+                            (auHasSlice && (type == NAL_TYPE_AUD || type == NAL_TYPE_SPS ||
+                                            type == NAL_TYPE_PPS || type == NAL_TYPE_SEI)) ||
+                            (auHasSlice && slice && nal + 1 < mappingSize && (mapping[nal + 1] & 0x80));
+            if (startsAu) {
+                if (!frames.empty()) frames.back().length = pos - frames.back().offset;
+                ReplayFrame frame;
+                frame.offset = nal;
+                frame.length = 0;
+                frame.captureMicros = uint64_t(frames.size()) * config.frameMicros();
+                frame.sequence = frames.size();
+                frames.push_back(frame);
+                auHasSlice = false;
+            }
+            auHasSlice = auHasSlice || slice;
+        }
+        pos = next;
+    }
+    if (frames.empty()) {
+        LOG_ERROR(config.device + " has no H.264 start codes.");
+        return false;
+    }
+    frames.back().length = mappingSize - frames.back().offset;
+    return true;
+}
+
+bool FileReplayCapture::indexDump() {
+    size_t magicSize = strlen(FRAME_DUMP_MAGIC);
+    if (mappingSize < magicSize || memcmp(mapping, FRAME_DUMP_MAGIC, magicSize) != 0) {
+        LOG_ERROR(config.device + " is not a frame dump.");
+        return false;
+    }
+
+    uint64_t firstMicros = 0;
+    size_t pos = magicSize;
+    while (pos + sizeof(FrameDumpRecord) <= mappingSize) {
+        FrameDumpRecord record;
+        memcpy(&record, mapping + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.length > mappingSize - pos) {
+            LOG_WARN(config.device + " is truncated, replaying the complete frames.");
+            break;
+        }
+        if (frames.empty()) firstMicros = record.captureMicros;
+
+        // Dumps store frames without their start code, but tolerate one
+        size_t startCode = startCodeLength(mapping + pos, record.length);
+        ReplayFrame frame;
+        frame.offset = pos + startCode;
+        frame.length = record.length - startCode;
+        // Keep the schedule monotonic even if the recording is not
+        frame.captureMicros = record.captureMicros >= firstMicros ? record.captureMicros - firstMicros : 0;
+        if (!frames.empty() && frame.captureMicros < frames.back().captureMicros) {
+            frame.captureMicros = frames.back().captureMicros;
+        }
+        frame.sequence = record.sequence;
+        frames.push_back(frame);
+        pos += record.length;
+    }
+    if (frames.empty()) {
+        LOG_ERROR(config.device + " holds no frames.");
+        return false;
+    }
+    return true;
+}
+
+bool FileReplayCapture::extractSpsPps() {
+    NalUnit units[MAX_NALS_PER_FRAME];
+    for (size_t i = 0; i < frames.size(); ++i) {
+        const uint8_t* data = mapping + frames[i].offset;
+        size_t count = splitNalUnits(data, frames[i].length, units, MAX_NALS_PER_FRAME);
+        if (count > MAX_NALS_PER_FRAME) count = MAX_NALS_PER_FRAME;
+
+        const NalUnit* spsUnit = nullptr;
+        const NalUnit* ppsUnit = nullptr;
+        for (size_t n = 0; n < count; ++n) {
+            if (units[n].type == NAL_TYPE_SPS && spsUnit == nullptr) spsUnit = &units[n];
+            else if (units[n].type == NAL_TYPE_PPS && ppsUnit == nullptr) ppsUnit = &units[n];
+        }
+        if (spsUnit != nullptr && ppsUnit != nullptr) {
+            storeParameterSet(sps, spsSize, data + spsUnit->offset, spsUnit->length);
+            storeParameterSet(pps, ppsSize, data + ppsUnit->offset, ppsUnit->length);
+            spsPpsExtracted = true;
+            spsPpsChanged();
+            LOG_INFO("SPS/PPS read from frame " + std::to_string(i) + " of " + config.device);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t FileReplayCapture::dueNanos(size_t index) const {
+    return passStartNanos + frames[index].captureMicros * 1000ULL;
+}
+
+void FileReplayCapture::armTimer(uint64_t monotonicNanos) {
+    // An all-zero it_value disarms, so a time in the past fires at once
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (monotonicNanos == 0) monotonicNanos = 1;
+    spec.it_value.tv_sec = monotonicNanos / 1000000000ULL;
+    spec.it_value.tv_nsec = monotonicNanos % 1000000000ULL;
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "timerfd_settime error: " + std::string(strerror(errno)));
+    }
+}
+
+bool FileReplayCapture::startCapture() {
+    if (frames.empty() || fd < 0) return false;
+
+    // The next frame is due now; with pace=fast the timer is never read
+    // and stays readable
+    passStartNanos = monotonicNanos() - frames[nextFrame].captureMicros * 1000ULL;
+    armTimer(fastPace ? 1 : dueNanos(nextFrame));
+    streaming = true;
+    sequenceValid = false;
+    StreamStats::add(stats.streamStarts);
+    return true;
+}
+
+bool FileReplayCapture::stopCapture() {
+    if (!streaming) return true;
+    streaming = false;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(fd, 0, &spec, nullptr);
+    return true;
+}
+
+bool FileReplayCapture::reset() {
+    stopCapture();
+    nextFrame = 0;
+    StreamStats::add(stats.resets);
+    return mapping != nullptr;
+}
+
+std::shared_ptr<EncodedFrame> FileReplayCapture::readEncodedFrame() {
+    if (!streaming) return nullptr;
+
+    if (!fastPace) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            if (errno != EAGAIN) {
+                LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "Replay timer read error: " + std::string(strerror(errno)));
+            }
+            return nullptr;
+        }
+    }
+    uint64_t now = monotonicNanos();
+    uint64_t due = fastPace ? now : dueNanos(nextFrame);
+    if (due > now) due = now;
+    // A stalled reader gets the schedule moved up instead of a burst
+    if (now - due > REPLAY_MAX_LAG_MS * 1000000ULL) {
+        passStartNanos += now - due;
+        due = now;
+    }
+
+    const ReplayFrame& replay = frames[nextFrame];
+    std::shared_ptr<EncodedFrame> frame;
+    if (zeroCopy) {
+        frame = framePool.lend([]() {});  // The mapping outlives every frame
+        frame->data = mapping + replay.offset;
+    } else {
+        uint8_t* payload;
+        frame = framePool.allocate(replay.length, payload);
+        memcpy(payload, mapping + replay.offset, replay.length);
+    }
+    frame->length = replay.length;
+    frame->sequence = passSequence + (replay.sequence - frames[0].sequence);
+    frame->dequeueNanos = now;
+    frame->captureNanos = due;
+    frame->timestamp.tv_sec = due / 1000000000ULL;
+    frame->timestamp.tv_usec = (due % 1000000000ULL) / 1000;
+    frame->indexNals();
+    if (!fastPace) stats.driverToDequeue.record((now - due) / 1000);
+    frameCaptured(*frame);
+
+    if (++nextFrame == frames.size()) {
+        nextFrame = 0;
+        passStartNanos += loopMicros * 1000ULL;
+        passSequence += frames.back().sequence - frames[0].sequence + 1;
+    }
+    if (!fastPace) armTimer(dueNanos(nextFrame));
+    return frame;
+}
@@ -0,0 +1,289 @@
+#include "fmp4_muxer.h"
+#include "h264_nal_parser.h"
+#include <cstring>
+
+namespace {
+
+const uint32_t TIMESCALE = 90000;
+const uint32_t TRACK_ID = 1;
+
+// trun sample_flags
+const uint32_t SAMPLE_FLAGS_SYNC = 0x02000000;      // depends on no other sample
+const uint32_t SAMPLE_FLAGS_NON_SYNC = 0x01010000;  // depends on others, not a sync sample
+
+void put8(std::vector<uint8_t>& out, uint8_t value) {
+    out.push_back(value);
+}
+
+void put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value & 0xff);
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((value >> shift) & 0xff);
+}
+
+void put64(std::vector<uint8_t>& out, uint64_t value) {
+    put32(out, value >> 32);
+    put32(out, value & 0xffffffff);
+}
+
+void putZeros(std::vector<uint8_t>& out, size_t count) {
+    out.insert(out.end(), count, 0);
+}
+
+void patch32(std::vector<uint8_t>& out, size_t at, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out[at + i] = (value >> (24 - 8 * i)) & 0xff;
+}
+
+// Opens a box; endBox() fills in its size
+size_t beginBox(std::vector<uint8_t>& out, const char* type) {
+    size_t start = out.size();
+    put32(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+size_t beginFullBox(std::vector<uint8_t>& out, const char* type, uint8_t version, uint32_t flags) {
+    size_t start = beginBox(out, type);
+    put32(out, (uint32_t(version) << 24) | (flags & 0xffffff));
+    return start;
+}
+
+void endBox(std::vector<uint8_t>& out, size_t start) {
+    patch32(out, start, out.size() - start);
+}
+
+void putMatrix(std::vector<uint8_t>& out) {
+    static const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (uint32_t value : unity) put32(out, value);
+}
+
+void writeAvcC(std::vector<uint8_t>& out, const uint8_t* sps, size_t spsSize,
+               const uint8_t* pps, size_t ppsSize) {
+    size_t avcC = beginBox(out, "avcC");
+    put8(out, 1);                            // configurationVersion
+    put8(out, spsSize > 1 ? sps[1] : 0);     // AVCProfileIndication
+    put8(out, spsSize > 2 ? sps[2] : 0);     // profile_compatibility
+    put8(out, spsSize > 3 ? sps[3] : 0);     // AVCLevelIndication
+    put8(out, 0xfc | 3);                     // 4-byte NAL lengths
+    put8(out, 0xe0 | 1);
+    put16(out, spsSize);
+    out.insert(out.end(), sps, sps + spsSize);
+    put8(out, 1);
+    put16(out, ppsSize);
+    out.insert(out.end(), pps, pps + ppsSize);
+    uint8_t profile = spsSize > 1 ? sps[1] : 0;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+        // V4L2 H.264 encoders only produce 8-bit 4:2:0
+        put8(out, 0xfc | 1);   // chroma_format
+        put8(out, 0xf8 | 0);   // bit_depth_luma_minus8
+        put8(out, 0xf8 | 0);   // bit_depth_chroma_minus8
+        put8(out, 0);          // numOfSequenceParameterSetExt
+    }
+    endBox(out, avcC);
+}
+
+} // namespace
+
+Fmp4Muxer::Fmp4Muxer() : baseDecodeTime(0), sequenceNumber(1) {
+}
+
+void Fmp4Muxer::writeInitSegment(std::vector<uint8_t>& out, const uint8_t* sps, size_t spsSize,
+                                 const uint8_t* pps, size_t ppsSize, unsigned width, unsigned height) {
+    parseSpsResolution(sps, spsSize, width, height);
+
+    size_t ftyp = beginBox(out, "ftyp");
+    out.insert(out.end(), {'i', 's', 'o', 'm'});
+    put32(out, 0x200);
+    out.insert(out.end(), {'i', 's', 'o', 'm', 'i', 's', 'o', '6', 'a', 'v', 'c', '1', 'm', 'p', '4', '1'});
+    endBox(out, ftyp);
+
+    size_t moov = beginBox(out, "moov");
+
+    size_t mvhd = beginFullBox(out, "mvhd", 0, 0);
+    put32(out, 0);              // creation_time
+    put32(out, 0);              // modification_time
+    put32(out, TIMESCALE);
+    put32(out, 0);              // duration: fragmented
+    put32(out, 0x00010000);     // rate 1.0
+    put16(out, 0x0100);         // volume 1.0
+    putZeros(out, 10);
+    putMatrix(out);
+    putZeros(out, 24);          // pre_defined
+    put32(out, TRACK_ID + 1);   // next_track_ID
+    endBox(out, mvhd);
+
+    size_t trak = beginBox(out, "trak");
+    size_t tkhd = beginFullBox(out, "tkhd", 0, 0x3);  // enabled, in movie
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, TRACK_ID);
+    put32(out, 0);
+    put32(out, 0);              // duration
+    putZeros(out, 8);
+    put16(out, 0);              // layer
+    put16(out, 0);              // alternate_group
+    put16(out, 0);              // volume: video
+    put16(out, 0);
+    putMatrix(out);
+    put32(out, width << 16);
+    put32(out, height << 16);
+    endBox(out, tkhd);
+
+    size_t mdia = beginBox(out, "mdia");
+    size_t mdhd = beginFullBox(out, "mdhd", 0, 0);
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, TIMESCALE);
+    put32(out, 0);
+    put16(out, 0x55c4);         // language "und"
+    put16(out, 0);
+    endBox(out, mdhd);
+
+    size_t hdlr = beginFullBox(out, "hdlr", 0, 0);
+    put32(out, 0);
+    out.insert(out.end(), {'v', 'i', 'd', 'e'});
+    putZeros(out, 12);
+    static const char handlerName[] = "VideoHandler";
+    out.insert(out.end(), handlerName, handlerName + sizeof(handlerName));
+    endBox(out, hdlr);
+
+    size_t minf = beginBox(out, "minf");
+    size_t vmhd = beginFullBox(out, "vmhd", 0, 1);
+    putZeros(out, 8);           // graphicsmode, opcolor
+    endBox(out, vmhd);
+
+    size_t dinf = beginBox(out, "dinf");
+    size_t dref = beginFullBox(out, "dref", 0, 0);
+    put32(out, 1);
+    size_t url = beginFullBox(out, "url ", 0, 1);     // media in this file
+    endBox(out, url);
+    endBox(out, dref);
+    endBox(out, dinf);
+
+    size_t stbl = beginBox(out, "stbl");
+    size_t stsd = beginFullBox(out, "stsd", 0, 0);
+    put32(out, 1);
+    size_t avc1 = beginBox(out, "avc1");
+    putZeros(out, 6);
+    put16(out, 1);              // data_reference_index
+    putZeros(out, 16);
+    put16(out, width);
+    put16(out, height);
+    put32(out, 0x00480000);     // 72 dpi
+    put32(out, 0x00480000);
+    put32(out, 0);
+    put16(out, 1);              // frame_count
+    putZeros(out, 32);          // compressorname
+    put16(out, 0x0018);         // depth
+    put16(out, 0xffff);
+    writeAvcC(out, sps, spsSize, pps, ppsSize);
+    endBox(out, avc1);
+    endBox(out, stsd);
+
+    // Sample tables are empty; the samples are in the fragments
+    static const char* const emptyTables[] = {"stts", "stsc", "stco"};
+    for (const char* type : emptyTables) {
+        size_t box = beginFullBox(out, type, 0, 0);
+        put32(out, 0);
+        endBox(out, box);
+    }
+    size_t stsz = beginFullBox(out, "stsz", 0, 0);
+    put32(out, 0);
+    put32(out, 0);
+    endBox(out, stsz);
+    endBox(out, stbl);
+    endBox(out, minf);
+    endBox(out, mdia);
+    endBox(out, trak);
+
+    size_t mvex = beginBox(out, "mvex");
+    size_t trex = beginFullBox(out, "trex", 0, 0);
+    put32(out, TRACK_ID);
+    put32(out, 1);              // default_sample_description_index
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, 0);
+    endBox(out, trex);
+    endBox(out, mvex);
+
+    endBox(out, moov);
+}
+
+void Fmp4Muxer::addSample(const EncodedFrame& frame, uint32_t duration) {
+    size_t start = mdat.size();
+    for (unsigned i = 0; i < frame.nalCount; ++i) {
+        const NalUnit& nal = frame.nals[i];
+        if (nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS || nal.type == NAL_TYPE_PPS) continue;
+        if (nal.length == 0) continue;
+        put32(mdat, nal.length);
+        const uint8_t* data = frame.nalData(i);
+        mdat.insert(mdat.end(), data, data + nal.length);
+    }
+
+    if (mdat.size() == start) {
+        if (!samples.empty()) samples.back().duration += duration;
+        return;
+    }
+    Sample sample;
+    sample.duration = duration;
+    sample.size = mdat.size() - start;
+    sample.keyFrame = frame.isIDR();
+    samples.push_back(sample);
+}
+
+void Fmp4Muxer::extendLastSample(uint32_t duration) {
+    if (!samples.empty()) samples.back().duration += duration;
+}
+
+void Fmp4Muxer::writeFragment(std::vector<uint8_t>& out) {
+    if (samples.empty()) return;
+
+    size_t moof = beginBox(out, "moof");
+    size_t mfhd = beginFullBox(out, "mfhd", 0, 0);
+    put32(out, sequenceNumber++);
+    endBox(out, mfhd);
+
+    size_t traf = beginBox(out, "traf");
+    size_t tfhd = beginFullBox(out, "tfhd", 0, 0x020000);  // default-base-is-moof
+    put32(out, TRACK_ID);
+    endBox(out, tfhd);
+
+    size_t tfdt = beginFullBox(out, "tfdt", 1, 0);
+    put64(out, baseDecodeTime);
+    endBox(out, tfdt);
+
+    // data-offset, sample-duration, sample-size and sample-flags present
+    size_t trun = beginFullBox(out, "trun", 0, 0x000701);
+    put32(out, samples.size());
+    size_t dataOffset = out.size();
+    put32(out, 0);
+    for (const Sample& sample : samples) {
+        put32(out, sample.duration);
+        put32(out, sample.size);
+        put32(out, sample.keyFrame ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+        baseDecodeTime += sample.duration;
+    }
+    endBox(out, trun);
+    endBox(out, traf);
+    endBox(out, moof);
+
+    // The data offset counts from the start of the moof to the first sample
+    patch32(out, dataOffset, out.size() - moof + 8);
+
+    put32(out, mdat.size() + 8);
+    out.insert(out.end(), {'m', 'd', 'a', 't'});
+    out.insert(out.end(), mdat.begin(), mdat.end());
+
+    samples.clear();
+    mdat.clear();
+}
+
+void Fmp4Muxer::reset() {
+    samples.clear();
+    mdat.clear();
+    baseDecodeTime = 0;
+    sequenceNumber = 1;
+}
@@ -0,0 +1,34 @@
+#include "frame_dump.h"
+#include "constants.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+
+FrameDumpWriter::FrameDumpWriter(const std::string& path)
+    : path(path), file(fopen(path.c_str(), "wb")) {
+    if (file == nullptr) {
+        LOG_ERROR("Cannot create frame dump " + path + ": " + std::string(strerror(errno)));
+        return;
+    }
+    fwrite(FRAME_DUMP_MAGIC, 1, strlen(FRAME_DUMP_MAGIC), file);
+    LOG_INFO("Recording frames to " + path);
+}
+
+FrameDumpWriter::~FrameDumpWriter() {
+    if (file != nullptr) fclose(file);
+}
+
+void FrameDumpWriter::write(const EncodedFrame& frame) {
+    if (file == nullptr) return;
+
+    FrameDumpRecord record;
+    record.captureMicros = frame.captureNanos / 1000;
+    record.sequence = frame.sequence;
+    record.length = frame.length;
+    if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+        fwrite(frame.data, 1, frame.length, file) != frame.length) {
+        LOG_ERROR("Frame dump " + path + " write failed, recording stopped: " + std::string(strerror(errno)));
+        fclose(file);
+        file = nullptr;
+    }
+}
@@ -0,0 +1,142 @@
+#include "frame_pool.h"
+#include "logger.h"
+#include <cstring>
+
+void FramePool::FreeList::init(uint32_t count) {
+    next.reset(new std::atomic<uint32_t>[count]);
+    for (uint32_t i = 0; i < count; ++i) {
+        next[i].store(i + 1 < count ? i + 1 : uint32_t(EMPTY & 0xFFFFFFFFu), std::memory_order_relaxed);
+    }
+    head.store(count > 0 ? uint64_t(0) : uint64_t(EMPTY), std::memory_order_release);
+}
+
+bool FramePool::FreeList::pop(uint32_t& index) {
+    uint64_t current = head.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t top = uint32_t(current);
+        if (top == uint32_t(EMPTY)) return false;
+        // May be stale if another thread pops 'top' first; the tag then
+        // makes the exchange fail
+        uint64_t replacement = ((current >> 32) + 1) << 32 | next[top].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(current, replacement, std::memory_order_acquire,
+                                       std::memory_order_acquire)) {
+            index = top;
+            return true;
+        }
+    }
+}
+
+void FramePool::FreeList::push(uint32_t index) {
+    uint64_t current = head.load(std::memory_order_relaxed);
+    while (true) {
+        next[index].store(uint32_t(current), std::memory_order_relaxed);
+        uint64_t replacement = (current & ~uint64_t(0xFFFFFFFFu)) | index;
+        if (head.compare_exchange_weak(current, replacement, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+FramePool::FramePool(StreamStats& stats) : stats(stats) {
+}
+
+void FramePool::reserve(size_t maxFrameSize, size_t lentFrames) {
+    if (isReserved() || maxFrameSize == 0 || FRAME_POOL_BYTES == 0) return;
+
+    // Largest class first, each with an equal share of the budget
+    std::vector<size_t> sizes;
+    for (size_t size = maxFrameSize; sizes.size() < FRAME_POOL_CLASSES; size /= 4) {
+        sizes.push_back((size + 63) & ~size_t(63));
+        if (size / 4 < FRAME_POOL_MIN_SLAB) break;
+    }
+    std::vector<size_t> counts;
+    size_t total = 0, slabs = 0;
+    for (size_t size : sizes) {
+        size_t count = FRAME_POOL_BYTES / sizes.size() / size;
+        if (count == 0) count = 1;
+        counts.push_back(count);
+        total += count * size;
+        slabs += count;
+    }
+
+    // Zero-filled, so the slabs are resident from the start
+    arena.resize(total);
+    classes = std::vector<SizeClass>(sizes.size());  // SizeClass is not movable
+    uint8_t* base = arena.data();
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        SizeClass& sizeClass = classes[sizes.size() - 1 - i];
+        sizeClass.slabSize = sizes[i];
+        sizeClass.base = base;
+        sizeClass.free.init(counts[i]);
+        base += counts[i] * sizes[i];
+    }
+
+    // Every slab in use, every lent buffer out, and frames the replay
+    // source points into its mapping
+    headers.resize(slabs + lentFrames + FRAME_POOL_SPARE_HEADERS);
+    freeHeaders.init(headers.size());
+    LOG_INFO("Frame pool: " + std::to_string(total >> 10) + " KiB in " + std::to_string(sizes.size()) +
+             " classes, largest " + std::to_string(sizes[0] >> 10) + " KiB x " + std::to_string(counts[0]) +
+             ", " + std::to_string(headers.size()) + " headers.");
+}
+
+bool FramePool::takeHeader(uint32_t& header) {
+    if (freeHeaders.pop(header)) return true;
+    if (isReserved()) StreamStats::add(stats.framePoolMisses);
+    return false;
+}
+
+std::shared_ptr<EncodedFrame> FramePool::allocate(size_t size, uint8_t*& payload) {
+    // The smallest class that fits and has a slab left
+    int sizeClass = 0;
+    uint32_t slab = 0;
+    for (; sizeClass < int(classes.size()); ++sizeClass) {
+        if (classes[sizeClass].slabSize >= size && classes[sizeClass].free.pop(slab)) break;
+    }
+    bool haveSlab = sizeClass < int(classes.size());
+
+    uint32_t header;
+    if (haveSlab && freeHeaders.pop(header)) {
+        Header& slot = headers[header];
+        slot.frame = EncodedFrame();
+        slot.sizeClass = sizeClass;
+        slot.slab = slab;
+        payload = classes[sizeClass].base + size_t(slab) * classes[sizeClass].slabSize;
+        slot.frame.data = payload;
+        slot.frame.length = size;
+        // Nothing to do at release but return the header, which the
+        // allocator does once the control block is gone
+        return std::shared_ptr<EncodedFrame>(&slot.frame, [](EncodedFrame*) {},
+                                             HeaderAllocator<EncodedFrame>(this, header));
+    }
+    if (haveSlab) classes[sizeClass].free.push(slab);
+
+    if (isReserved()) StreamStats::add(stats.framePoolMisses);
+    std::shared_ptr<EncodedFrame> frame = std::make_shared<EncodedFrame>();
+    frame->storage.resize(size);
+    payload = frame->storage.data();
+    frame->data = payload;
+    frame->length = size;
+    return frame;
+}
+
+std::shared_ptr<EncodedFrame> FramePool::clone(const EncodedFrame& frame) {
+    uint8_t* payload;
+    std::shared_ptr<EncodedFrame> copy = allocate(frame.length, payload);
+    // Everything but the bytes; a heap fallback keeps its own storage
+    std::vector<uint8_t> storage;
+    storage.swap(copy->storage);
+    *copy = frame;
+    copy->storage.swap(storage);
+    memcpy(payload, frame.data, frame.length);
+    copy->data = payload;
+    copy->bufferIndex = -1;
+    return copy;
+}
+
+void FramePool::release(uint32_t header) {
+    Header& slot = headers[header];
+    if (slot.sizeClass >= 0) classes[slot.sizeClass].free.push(slot.slab);
+    freeHeaders.push(header);
+}
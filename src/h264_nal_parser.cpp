@@ -0,0 +1,225 @@
+#include "h264_nal_parser.h"
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define NAL_PARSER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NAL_PARSER_NEON 1
+#endif
+
+size_t findStartCodeScalar(const uint8_t* data, size_t size, size_t from) {
+    size_t i = from;
+    while (i + 2 < size) {
+        // data[i+2] decides how far we can skip: anything above 1 cannot
+        // be part of a start code that ends at or before it.
+        uint8_t third = data[i + 2];
+        if (third > 1) {
+            i += 3;
+        } else if (third == 1 && data[i + 1] == 0 && data[i] == 0) {
+            return i;
+        } else {
+            i++;
+        }
+    }
+    return size;
+}
+
+size_t findStartCode(const uint8_t* data, size_t size, size_t from) {
+    size_t i = from;
+
+#if defined(NAL_PARSER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    // Compare three shifted views so that bit n of the mask is set when
+    // data[i+n..i+n+2] == 00 00 01.
+    while (i + 18 <= size) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                    _mm_cmpeq_epi8(b2, one));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+#elif defined(NAL_PARSER_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    while (i + 18 <= size) {
+        uint8x16_t b0 = vld1q_u8(data + i);
+        uint8x16_t b1 = vld1q_u8(data + i + 1);
+        uint8x16_t b2 = vld1q_u8(data + i + 2);
+        uint8x16_t hit = vandq_u8(vandq_u8(vceqq_u8(b0, zero), vceqq_u8(b1, zero)), vceqq_u8(b2, one));
+        // Narrow to one nibble per byte to get a 64-bit mask
+        uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hit), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+        if (mask != 0) return i + (__builtin_ctzll(mask) >> 2);
+        i += 16;
+    }
+#endif
+
+    return findStartCodeScalar(data, size, i);
+}
+
+size_t startCodeLength(const uint8_t* data, size_t size) {
+    if (size >= 3 && data[0] == 0x00 && data[1] == 0x00) {
+        if (data[2] == 0x01) return 3;
+        if (size >= 4 && data[2] == 0x00 && data[3] == 0x01) return 4;
+    }
+    return 0;
+}
+
+static void addUnit(const uint8_t* data, size_t begin, size_t end,
+                    NalUnit* units, size_t maxUnits, size_t& count) {
+    // Zero bytes before the next start code belong to it (zero_byte or
+    // trailing_zero_8bits), not to this NAL unit.
+    while (end > begin && data[end - 1] == 0x00) end--;
+    if (end <= begin) return;
+
+    if (count < maxUnits) {
+        NalUnit& unit = units[count];
+        unit.offset = begin;
+        unit.length = end - begin;
+        unit.type = data[begin] & 0x1F;
+        unit.refIdc = (data[begin] >> 5) & 0x03;
+    }
+    count++;
+}
+
+size_t splitNalUnits(const uint8_t* data, size_t size, NalUnit* units, size_t maxUnits) {
+    size_t count = 0;
+    size_t start = findStartCode(data, size, 0);
+
+    // Leading data without a start code (e.g. already stripped)
+    if (start > 0) addUnit(data, 0, start, units, maxUnits, count);
+
+    while (start < size) {
+        size_t begin = start + 3;
+        size_t next = findStartCode(data, size, begin);
+        addUnit(data, begin, next, units, maxUnits, count);
+        start = next;
+    }
+    return count;
+}
+
+// Exp-Golomb reader over an RBSP (emulation prevention bytes removed)
+class BitReader {
+public:
+    BitReader(const uint8_t* nal, size_t size) : pos(0), overrun(false) {
+        rbsp.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            if (i >= 2 && nal[i] == 0x03 && nal[i - 1] == 0x00 && nal[i - 2] == 0x00) continue;
+            rbsp.push_back(nal[i]);
+        }
+    }
+    unsigned bit() {
+        if (pos >= rbsp.size() * 8) {
+            overrun = true;
+            return 0;
+        }
+        unsigned value = (rbsp[pos / 8] >> (7 - pos % 8)) & 1;
+        pos++;
+        return value;
+    }
+    unsigned bits(unsigned count) {
+        unsigned value = 0;
+        while (count--) value = (value << 1) | bit();
+        return value;
+    }
+    unsigned ue() {
+        unsigned zeros = 0;
+        while (bit() == 0 && !overrun) {
+            // Longer codes don't fit 32 bits and only occur in corrupt data
+            if (++zeros == 32) {
+                overrun = true;
+                return 0;
+            }
+        }
+        return ((1u << zeros) - 1) + bits(zeros);
+    }
+    int se() {
+        unsigned value = ue();
+        return (value & 1) ? int((value + 1) / 2) : -int(value / 2);
+    }
+    bool failed() const { return overrun; }
+
+private:
+    std::vector<uint8_t> rbsp;
+    size_t pos;
+    bool overrun;         // Past the end, or an invalid code
+};
+
+static void skipScalingList(BitReader& reader, unsigned size) {
+    int lastScale = 8, nextScale = 8;
+    for (unsigned i = 0; i < size; ++i) {
+        if (nextScale != 0) nextScale = (lastScale + reader.se() + 256) % 256;
+        lastScale = nextScale == 0 ? lastScale : nextScale;
+    }
+}
+
+bool parseSpsResolution(const uint8_t* sps, size_t size, unsigned& width, unsigned& height) {
+    BitReader reader(sps, size);
+    reader.bits(8);                         // NAL header
+    unsigned profile = reader.bits(8);
+    reader.bits(16);                        // Constraint flags, level_idc
+    reader.ue();                            // seq_parameter_set_id
+
+    unsigned chromaFormat = 1;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+        profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+        profile == 139 || profile == 134 || profile == 135) {
+        chromaFormat = reader.ue();
+        if (chromaFormat == 3) reader.bit(); // separate_colour_plane_flag
+        reader.ue();                         // bit_depth_luma_minus8
+        reader.ue();                         // bit_depth_chroma_minus8
+        reader.bit();                        // qpprime_y_zero_transform_bypass_flag
+        if (reader.bit()) {                  // seq_scaling_matrix_present_flag
+            for (unsigned i = 0; i < (chromaFormat != 3 ? 8u : 12u); ++i) {
+                if (reader.bit()) skipScalingList(reader, i < 6 ? 16 : 64);
+            }
+        }
+    }
+
+    reader.ue();                            // log2_max_frame_num_minus4
+    unsigned pocType = reader.ue();
+    if (pocType == 0) {
+        reader.ue();                        // log2_max_pic_order_cnt_lsb_minus4
+    } else if (pocType == 1) {
+        reader.bit();                       // delta_pic_order_always_zero_flag
+        reader.se();                        // offset_for_non_ref_pic
+        reader.se();                        // offset_for_top_to_bottom_field
+        unsigned cycle = reader.ue();
+        for (unsigned i = 0; i < cycle && !reader.failed(); ++i) reader.se();
+    }
+    reader.ue();                            // max_num_ref_frames
+    reader.bit();                           // gaps_in_frame_num_value_allowed_flag
+    unsigned widthMbs = reader.ue() + 1;
+    unsigned heightMapUnits = reader.ue() + 1;
+    unsigned frameMbsOnly = reader.bit();
+    if (!frameMbsOnly) reader.bit();        // mb_adaptive_frame_field_flag
+    reader.bit();                           // direct_8x8_inference_flag
+
+    unsigned cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+    if (reader.bit()) {
+        cropLeft = reader.ue();
+        cropRight = reader.ue();
+        cropTop = reader.ue();
+        cropBottom = reader.ue();
+    }
+    if (reader.failed()) return false;
+
+    // Crop units depend on chroma subsampling (Table 6-1)
+    unsigned cropUnitX = (chromaFormat == 1 || chromaFormat == 2) ? 2 : 1;
+    unsigned cropUnitY = (chromaFormat == 1 ? 2 : 1) * (2 - frameMbsOnly);
+    uint64_t codedWidth = uint64_t(widthMbs) * 16;
+    uint64_t codedHeight = uint64_t(2 - frameMbsOnly) * heightMapUnits * 16;
+    uint64_t cropX = uint64_t(cropUnitX) * (uint64_t(cropLeft) + cropRight);
+    uint64_t cropY = uint64_t(cropUnitY) * (uint64_t(cropTop) + cropBottom);
+    // A crop that leaves nothing (or a size beyond any encoder) is corrupt
+    if (cropX >= codedWidth || cropY >= codedHeight || codedWidth > 0xFFFF || codedHeight > 0xFFFF) return false;
+    width = codedWidth - cropX;
+    height = codedHeight - cropY;
+    return true;
+}
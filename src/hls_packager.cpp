@@ -0,0 +1,428 @@
+#include "hls_packager.h"
+#include "latency_histogram.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+namespace {
+
+const char* const PLAYLIST_TYPE = "application/vnd.apple.mpegurl";
+const char* const MEDIA_TYPE = "video/mp4";
+
+// Value of 'key' in an undecoded query string, or -1 if it is missing
+long long queryValue(const std::string& query, const std::string& key) {
+    size_t start = 0;
+    while (start <= query.size()) {
+        size_t end = query.find('&', start);
+        if (end == std::string::npos) end = query.size();
+        size_t eq = query.find('=', start);
+        if (eq < end && query.compare(start, eq - start, key) == 0) {
+            char* parsed = nullptr;
+            long long value = strtoll(query.c_str() + eq + 1, &parsed, 10);
+            return parsed == query.c_str() + end && value >= 0 ? value : -1;
+        }
+        start = end + 1;
+    }
+    return -1;
+}
+
+std::string seconds(uint64_t ticks) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.5f", ticks / 90000.0);
+    return text;
+}
+
+void addCommonHeaders(HttpResponse& response, const char* cacheControl) {
+    // Players run in browsers on other origins
+    response.headers.push_back(std::make_pair("Access-Control-Allow-Origin", "*"));
+    response.headers.push_back(std::make_pair("Cache-Control", cacheControl));
+}
+
+} // namespace
+
+HlsPackager* HlsPackager::createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                    v4l2FrameDistributor* distributor, HttpServer* server) {
+    HlsPackager* packager = new HlsPackager(env, capture, distributor, server);
+    if (!packager->start()) {
+        delete packager;
+        return nullptr;
+    }
+    return packager;
+}
+
+HlsPackager::HlsPackager(UsageEnvironment& env, CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                         HttpServer* server)
+    : env(env), capture(capture), distributor(distributor), server(server), stats(capture->getStats()),
+      path("/" + capture->getConfig().streamName + "/"), nextMsn(0), discontinuitySequence(0),
+      initVersion(0), waitingForKeyFrame(true), sampleOpen(false), lastCaptureNanos(0), partTicks(0),
+      partIndependent(false), keyFrameRequested(false), targetTicks(HLS_TARGET_DURATION * 90000ULL),
+      waiterTask(nullptr) {
+}
+
+HlsPackager::~HlsPackager() {
+    distributor->removeConsumer(this);
+    env.taskScheduler().unscheduleDelayedTask(waiterTask);
+}
+
+bool HlsPackager::start() {
+    // Like recording, HLS has no RTSP viewer to start the capture
+    if (!distributor->isStreaming() && !distributor->startStreaming()) {
+        LOG_ERROR("Failed to start capture for HLS of " + capture->getConfig().device + ".");
+        return false;
+    }
+
+    server->addHandler(path + "index.m3u8", [this](const HttpRequest& request, HttpResponse& response) {
+        servePlaylist(request, response);
+    });
+    server->addHandler(path + "init.mp4", [this](const HttpRequest& request, HttpResponse& response) {
+        serveInit(request, response);
+    });
+    server->addHandler(path + "segment.m4s", [this](const HttpRequest& request, HttpResponse& response) {
+        serveSegment(request, response);
+    });
+    server->addHandler(path + "part.m4s", [this](const HttpRequest& request, HttpResponse& response) {
+        servePart(request, response);
+    });
+
+    distributor->addConsumer(this);
+    distributor->requestFrame(this);
+    LOG_INFO("HLS playlist for " + capture->getConfig().device + ": port " + std::to_string(server->getPort()) +
+             ", " + path + "index.m3u8");
+    return true;
+}
+
+void HlsPackager::deliverFrame(const FramePtr& frame, bool continuous) {
+    // A gap breaks decoding until the next IDR, which then starts a segment
+    if (!continuous) waitingForKeyFrame = true;
+    if (!waitingForKeyFrame || frame->isIDR()) package(*frame);
+    distributor->requestFrame(this);  // May deliver again right away
+}
+
+uint32_t HlsPackager::ticksBetween(uint64_t fromNanos, uint64_t toNanos) const {
+    uint32_t nominal = capture->getConfig().frameTicks();
+    if (fromNanos == 0 || toNanos <= fromNanos) return nominal;
+    uint64_t ticks = (toNanos - fromNanos) * 9 / 100000;
+    // Longer than a second is a stall, not a frame duration
+    if (ticks == 0 || ticks > 90000) return nominal;
+    return ticks;
+}
+
+void HlsPackager::package(const EncodedFrame& frame) {
+    uint32_t frameTicks = capture->getConfig().frameTicks();
+
+    // The previous frame lasted until this one
+    if (sampleOpen) {
+        uint32_t ticks = ticksBetween(lastCaptureNanos, frame.captureNanos);
+        muxer.extendLastSample(ticks);
+        partTicks += ticks;
+        sampleOpen = false;
+    }
+
+    Segment* current = segments.empty() || segments.back().complete ? nullptr : &segments.back();
+    if (frame.isIDR() && (current == nullptr || waitingForKeyFrame ||
+                          current->ticks + partTicks >= HLS_SEGMENT_MS * 90ULL ||
+                          capture->getSpsPpsVersion() != initVersion)) {
+        finishSegment();
+        if (!startSegment(frame)) {
+            waitingForKeyFrame = true;
+            return;
+        }
+    } else if (!muxer.empty() && partTicks + frameTicks > HLS_PART_MS * 90U) {
+        // Parts stay within the advertised part target
+        closePart();
+    }
+    waitingForKeyFrame = false;
+
+    if (muxer.empty()) partIndependent = frame.isIDR();
+    muxer.addSample(frame, 0);
+    sampleOpen = true;
+    lastCaptureNanos = frame.captureNanos;
+
+    // Segments only end at IDRs; ask for one rather than outgrow the
+    // target duration when the encoder's GOP is longer
+    const Segment& segment = segments.back();
+    if (!keyFrameRequested && segment.ticks + partTicks >= HLS_SEGMENT_MS * 90ULL) {
+        static const std::string reason = "HLS segment";
+        keyFrameRequested = capture->requestKeyFrame(reason);
+    }
+}
+
+bool HlsPackager::startSegment(const EncodedFrame& frame) {
+    if (!capture->hasSpsPps()) return false;
+
+    bool newInit = !init || capture->getSpsPpsVersion() != initVersion;
+    if (newInit) {
+        const DeviceConfig& config = capture->getConfig();
+        std::shared_ptr<std::vector<uint8_t> > bytes = std::make_shared<std::vector<uint8_t> >();
+        Fmp4Muxer::writeInitSegment(*bytes, capture->getSPS(), capture->getSPSSize(), capture->getPPS(),
+                                    capture->getPPSSize(), config.width, config.height);
+        init = bytes;
+        initVersion = capture->getSpsPpsVersion();
+    }
+
+    Segment segment;
+    segment.msn = nextMsn++;
+    segment.startTime = capture->toWallClock(frame.captureNanos);
+    segment.ticks = 0;
+    segment.init = init;
+    segment.initVersion = initVersion;
+    segment.discontinuity = newInit && !segments.empty();
+    segment.complete = false;
+    segments.push_back(std::move(segment));
+    keyFrameRequested = false;
+
+    // The open segment and HLS_SEGMENT_COUNT complete ones
+    while (segments.size() > HLS_SEGMENT_COUNT + 1) {
+        if (segments[1].discontinuity) discontinuitySequence++;
+        segments.pop_front();
+    }
+    return true;
+}
+
+void HlsPackager::finishSegment() {
+    if (segments.empty() || segments.back().complete) return;
+    if (sampleOpen) {
+        // Nothing follows to measure it by
+        muxer.extendLastSample(capture->getConfig().frameTicks());
+        partTicks += capture->getConfig().frameTicks();
+        sampleOpen = false;
+    }
+    closePart();
+    segments.back().complete = true;
+    // The encoder may not have honoured the key frame request in time
+    targetTicks = std::max(targetTicks, segments.back().ticks);
+    answerWaiters(false);
+}
+
+void HlsPackager::closePart() {
+    if (muxer.empty() || segments.empty()) return;
+    Segment& segment = segments.back();
+    segment.parts.push_back(Part());
+    Part& part = segment.parts.back();
+    muxer.writeFragment(part.data);
+    part.ticks = partTicks;
+    part.independent = partIndependent;
+    segment.ticks += partTicks;
+    partTicks = 0;
+    StreamStats::add(stats.hlsParts);
+    answerWaiters(false);
+}
+
+const HlsPackager::Segment* HlsPackager::findSegment(uint64_t msn) const {
+    if (segments.empty() || msn < segments.front().msn || msn > segments.back().msn) return nullptr;
+    return &segments[msn - segments.front().msn];
+}
+
+uint64_t HlsPackager::currentMsn() const {
+    return segments.empty() ? nextMsn : segments.back().msn;
+}
+
+bool HlsPackager::playlistReady(uint64_t msn, int part) const {
+    if (segments.empty()) return false;
+    const Segment& last = segments.back();
+    if (msn < last.msn) return true;
+    if (msn > last.msn) return false;
+    return last.complete || (part >= 0 && unsigned(part) < last.parts.size());
+}
+
+uint64_t HlsPackager::targetDuration() const {
+    return (targetTicks + 89999) / 90000;
+}
+
+std::string HlsPackager::playlist() const {
+    char line[256];
+    std::string out = "#EXTM3U\n#EXT-X-VERSION:6\n";
+    out += "#EXT-X-TARGETDURATION:" + std::to_string(targetDuration()) + "\n";
+    snprintf(line, sizeof(line), "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n",
+             3 * HLS_PART_MS / 1000.0);
+    out += line;
+    snprintf(line, sizeof(line), "#EXT-X-PART-INF:PART-TARGET=%.3f\n", HLS_PART_MS / 1000.0);
+    out += line;
+    out += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(segments.empty() ? nextMsn : segments.front().msn) + "\n";
+    out += "#EXT-X-DISCONTINUITY-SEQUENCE:" + std::to_string(discontinuitySequence) + "\n";
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const Segment& segment = segments[i];
+        if (segment.parts.empty()) continue;
+        std::string msn = std::to_string(segment.msn);
+        if (segment.discontinuity && i > 0) out += "#EXT-X-DISCONTINUITY\n";
+        if (i == 0 || segment.initVersion != segments[i - 1].initVersion) {
+            out += "#EXT-X-MAP:URI=\"init.mp4?v=" + std::to_string(segment.initVersion) + "\"\n";
+        }
+
+        time_t startSeconds = segment.startTime.tv_sec;
+        struct tm utc;
+        gmtime_r(&startSeconds, &utc);
+        strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%S", &utc);
+        out += "#EXT-X-PROGRAM-DATE-TIME:" + std::string(line);
+        snprintf(line, sizeof(line), ".%03dZ\n", int(segment.startTime.tv_usec / 1000));
+        out += line;
+
+        // Parts only for the live edge; older segments are whole
+        if (i + HLS_PART_SEGMENTS >= segments.size()) {
+            for (size_t p = 0; p < segment.parts.size(); ++p) {
+                out += "#EXT-X-PART:DURATION=" + seconds(segment.parts[p].ticks) + ",URI=\"part.m4s?msn=" + msn +
+                       "&part=" + std::to_string(p) + "\"";
+                out += segment.parts[p].independent ? ",INDEPENDENT=YES\n" : "\n";
+            }
+        }
+        if (segment.complete) {
+            out += "#EXTINF:" + seconds(segment.ticks) + ",\nsegment.m4s?msn=" + msn + "\n";
+        }
+    }
+
+    // The next part: in the open segment, or the first of the next one
+    uint64_t hintMsn = currentMsn();
+    size_t hintPart = 0;
+    if (!segments.empty()) {
+        if (segments.back().complete) hintMsn++;
+        else hintPart = segments.back().parts.size();
+    }
+    out += "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part.m4s?msn=" + std::to_string(hintMsn) + "&part=" +
+           std::to_string(hintPart) + "\"\n";
+    return out;
+}
+
+void HlsPackager::servePlaylist(const HttpRequest& request, HttpResponse& response) {
+    long long msn = queryValue(request.query, "_HLS_msn");
+    long long part = queryValue(request.query, "_HLS_part");
+    if (msn >= 0) {
+        // Blocking playlist reload
+        if (uint64_t(msn) > currentMsn() + 2) {
+            response.status = 400;
+            return;
+        }
+        if (!playlistReady(msn, part)) {
+            wait(request, response, true, msn, part);
+            return;
+        }
+    } else if (part >= 0) {
+        response.status = 400;
+        return;
+    }
+    response.contentType = PLAYLIST_TYPE;
+    response.body = playlist();
+    addCommonHeaders(response, "no-cache");
+}
+
+void HlsPackager::serveInit(const HttpRequest& request, HttpResponse& response) {
+    long long version = queryValue(request.query, "v");
+    std::shared_ptr<const std::vector<uint8_t> > bytes;
+    if (version < 0 || unsigned(version) == initVersion) {
+        bytes = init;
+    } else {
+        for (const Segment& segment : segments) {
+            if (segment.initVersion == unsigned(version)) bytes = segment.init;
+        }
+    }
+    if (!bytes) {
+        response.status = 404;
+        return;
+    }
+    response.contentType = MEDIA_TYPE;
+    response.body.assign(bytes->begin(), bytes->end());
+    addCommonHeaders(response, "max-age=3600");
+}
+
+void HlsPackager::serveSegment(const HttpRequest& request, HttpResponse& response) {
+    long long msn = queryValue(request.query, "msn");
+    const Segment* segment = msn >= 0 ? findSegment(msn) : nullptr;
+    if (segment == nullptr || !segment->complete) {
+        response.status = 404;
+        return;
+    }
+    size_t size = 0;
+    for (const Part& part : segment->parts) size += part.data.size();
+    response.body.reserve(size);
+    for (const Part& part : segment->parts) response.body.append(part.data.begin(), part.data.end());
+    response.contentType = MEDIA_TYPE;
+    addCommonHeaders(response, "max-age=60");
+}
+
+bool HlsPackager::answerPart(uint64_t msn, unsigned part, HttpResponse& response) const {
+    const Segment* segment = findSegment(msn);
+    if (segment == nullptr || part >= segment->parts.size()) return false;
+    const std::vector<uint8_t>& data = segment->parts[part].data;
+    response.status = 200;
+    response.contentType = MEDIA_TYPE;
+    response.body.assign(data.begin(), data.end());
+    addCommonHeaders(response, "max-age=60");
+    return true;
+}
+
+void HlsPackager::servePart(const HttpRequest& request, HttpResponse& response) {
+    long long msn = queryValue(request.query, "msn");
+    long long part = queryValue(request.query, "part");
+    if (msn < 0 || part < 0) {
+        response.status = 400;
+        return;
+    }
+    if (answerPart(msn, part, response)) return;
+
+    // The hinted part is held until it is complete; anything else is gone
+    // or too far ahead
+    const Segment* segment = findSegment(msn);
+    bool upcoming = (segment != nullptr && !segment->complete && unsigned(part) == segment->parts.size()) ||
+                    (uint64_t(msn) == currentMsn() + 1 && part == 0) || (segments.empty() && part == 0);
+    if (!upcoming) {
+        response.status = 404;
+        return;
+    }
+    wait(request, response, false, msn, part);
+}
+
+void HlsPackager::wait(const HttpRequest& request, HttpResponse& response, bool playlist, uint64_t msn, int part) {
+    Waiter waiter;
+    waiter.connectionId = request.connectionId;
+    waiter.playlist = playlist;
+    waiter.msn = msn;
+    waiter.part = part;
+    // Three target durations, as the HLS spec suggests
+    waiter.deadlineNanos = monotonicNanos() + 3ULL * targetDuration() * 1000000000ULL;
+    waiters.push_back(waiter);
+    response.deferred = true;
+    if (waiterTask == nullptr) {
+        waiterTask = env.taskScheduler().scheduleDelayedTask(HLS_PART_MS * 1000LL, waiterTimeoutTask, this);
+    }
+}
+
+void HlsPackager::waiterTimeoutTask(void* clientData) {
+    HlsPackager* packager = static_cast<HlsPackager*>(clientData);
+    packager->waiterTask = nullptr;
+    packager->answerWaiters(true);
+    if (!packager->waiters.empty()) {
+        packager->waiterTask = packager->env.taskScheduler().scheduleDelayedTask(HLS_PART_MS * 1000LL,
+                                                                                 waiterTimeoutTask, packager);
+    }
+}
+
+void HlsPackager::answerWaiters(bool timedOut) {
+    uint64_t now = timedOut ? monotonicNanos() : 0;
+    for (size_t i = 0; i < waiters.size();) {
+        const Waiter& waiter = waiters[i];
+        HttpResponse response;
+        bool done = true;
+        if (waiter.playlist && playlistReady(waiter.msn, waiter.part)) {
+            response.contentType = PLAYLIST_TYPE;
+            response.body = playlist();
+            addCommonHeaders(response, "no-cache");
+        } else if (!waiter.playlist && answerPart(waiter.msn, waiter.part, response)) {
+            // Sent below
+        } else if (!waiter.playlist && waiter.msn < currentMsn()) {
+            response.status = 404;   // Its segment ended before the part did
+        } else if (timedOut && now >= waiter.deadlineNanos) {
+            response.status = 503;
+        } else {
+            done = false;
+        }
+
+        if (done) {
+            server->respond(waiter.connectionId, response);
+            waiters.erase(waiters.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+}
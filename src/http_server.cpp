@@ -0,0 +1,278 @@
+#include "http_server.h"
+#include "constants.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct HttpServer::Connection {
+    HttpServer* server;
+    uint64_t id;
+    int socket;
+    std::string input;
+    std::string output;
+    size_t written;
+    bool keepAlive;      // Of the request being answered
+    bool pending;        // Its handler deferred the answer
+    TaskToken idleTask;  // Closes a connection with no request in progress
+};
+
+static const char* statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+// End of the request headers in 'input', or npos if they are incomplete
+static size_t headerEnd(const std::string& input) {
+    size_t crlf = input.find("\r\n\r\n");
+    size_t lf = input.find("\n\n");
+    if (crlf != std::string::npos && (lf == std::string::npos || crlf < lf)) return crlf + 4;
+    return lf == std::string::npos ? lf : lf + 2;
+}
+
+HttpServer::HttpServer(UsageEnvironment& env, const std::string& bindAddress, int port, unsigned maxConnections)
+    : env_(env), bindAddress_(bindAddress), port_(port), maxConnections_(maxConnections), listenSocket_(-1),
+      nextConnectionId_(1) {
+}
+
+HttpServer::~HttpServer() {
+    while (!connections_.empty()) {
+        closeConnection(connections_.begin()->second);
+    }
+    if (listenSocket_ >= 0) {
+        env_.taskScheduler().disableBackgroundHandling(listenSocket_);
+        ::close(listenSocket_);
+    }
+}
+
+bool HttpServer::initialize() {
+    listenSocket_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket_ < 0) {
+        LOG_ERROR("HTTP socket error: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(listenSocket_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    if (inet_pton(AF_INET, bindAddress_.c_str(), &addr.sin_addr) != 1) {
+        LOG_ERROR("Invalid HTTP bind address " + bindAddress_);
+        ::close(listenSocket_);
+        listenSocket_ = -1;
+        return false;
+    }
+    if (bind(listenSocket_, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenSocket_, 16) < 0) {
+        LOG_ERROR("HTTP bind/listen error on port " + std::to_string(port_) + ": " + std::string(strerror(errno)));
+        ::close(listenSocket_);
+        listenSocket_ = -1;
+        return false;
+    }
+
+    fcntl(listenSocket_, F_SETFL, fcntl(listenSocket_, F_GETFL, 0) | O_NONBLOCK);
+    env_.taskScheduler().setBackgroundHandling(listenSocket_, SOCKET_READABLE, incomingConnectionHandler, this);
+    LOG_INFO("HTTP endpoint listening on " + bindAddress_ + ":" + std::to_string(port_));
+    return true;
+}
+
+void HttpServer::addHandler(const std::string& path, Handler handler) {
+    handlers_[path] = handler;
+}
+
+void HttpServer::incomingConnectionHandler(void* clientData, int /*mask*/) {
+    static_cast<HttpServer*>(clientData)->acceptConnection();
+}
+
+void HttpServer::connectionReadableHandler(void* clientData, int /*mask*/) {
+    Connection* connection = static_cast<Connection*>(clientData);
+    connection->server->handleReadable(connection);
+}
+
+void HttpServer::connectionWritableHandler(void* clientData, int /*mask*/) {
+    Connection* connection = static_cast<Connection*>(clientData);
+    connection->server->handleWritable(connection);
+}
+
+void HttpServer::acceptConnection() {
+    int sock = accept(listenSocket_, nullptr, nullptr);
+    if (sock < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_RATE_LIMITED(LOG_LEVEL_WARN, "HTTP accept error: " + std::string(strerror(errno)));
+        }
+        return;
+    }
+    if (connections_.size() >= maxConnections_) {
+        ::close(sock);
+        return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    Connection* connection = new Connection();
+    connection->server = this;
+    connection->id = nextConnectionId_++;
+    connection->socket = sock;
+    connection->written = 0;
+    connection->keepAlive = false;
+    connection->pending = false;
+    connections_[sock] = connection;
+    env_.taskScheduler().setBackgroundHandling(sock, SOCKET_READABLE, connectionReadableHandler, connection);
+    // A client that never completes a request doesn't keep its slot
+    connection->idleTask = env_.taskScheduler().scheduleDelayedTask(HTTP_KEEPALIVE_TIMEOUT_MS * 1000LL,
+                                                                     idleTimeoutHandler, connection);
+}
+
+void HttpServer::handleReadable(Connection* connection) {
+    char buffer[1024];
+    ssize_t received = recv(connection->socket, buffer, sizeof(buffer), 0);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (received <= 0) {
+        closeConnection(connection);
+        return;
+    }
+
+    connection->input.append(buffer, received);
+    if (connection->input.size() > HTTP_MAX_REQUEST_SIZE) {
+        closeConnection(connection);
+    } else if (!connection->pending && headerEnd(connection->input) != std::string::npos) {
+        // A deferred request is still open; pipelined ones wait for it
+        dispatch(connection);
+    }
+}
+
+void HttpServer::dispatch(Connection* connection) {
+    if (connection->idleTask != nullptr) {
+        env_.taskScheduler().unscheduleDelayedTask(connection->idleTask);
+    }
+
+    // Request line and the Connection header; bodies are not needed here
+    HttpRequest request;
+    HttpResponse response;
+    size_t end = headerEnd(connection->input);
+    std::string input = connection->input.substr(0, end);
+    connection->input.erase(0, end);
+
+    std::string lowered = input;
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+    size_t lineEnd = lowered.find('\n');
+    bool http11 = lowered.rfind("http/1.1", lineEnd) != std::string::npos;
+    connection->keepAlive = http11 && lowered.find("\nconnection: close") == std::string::npos;
+
+    size_t methodEnd = input.find(' ');
+    size_t targetEnd = methodEnd == std::string::npos ? methodEnd : input.find(' ', methodEnd + 1);
+    if (targetEnd == std::string::npos) {
+        response.status = 400;
+    } else {
+        request.method = input.substr(0, methodEnd);
+        std::string target = input.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+        size_t queryStart = target.find('?');
+        request.path = target.substr(0, queryStart);
+        if (queryStart != std::string::npos) request.query = target.substr(queryStart + 1);
+        request.connectionId = connection->id;
+
+        std::map<std::string, Handler>::const_iterator it = handlers_.find(request.path);
+        if (request.method != "GET") {
+            response.status = 405;
+        } else if (it == handlers_.end()) {
+            response.status = 404;
+        } else {
+            it->second(request, response);
+        }
+    }
+    if (response.deferred) {
+        // Still readable, so a client that gives up is noticed
+        connection->pending = true;
+        return;
+    }
+    sendResponse(connection, response);
+}
+
+bool HttpServer::respond(uint64_t connectionId, const HttpResponse& response) {
+    for (auto& entry : connections_) {
+        Connection* connection = entry.second;
+        if (connection->id == connectionId && connection->pending) {
+            connection->pending = false;
+            sendResponse(connection, response);
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpServer::sendResponse(Connection* connection, const HttpResponse& response) {
+    std::string body = response.body;
+    if (response.status != 200 && body.empty()) {
+        body = std::string(statusText(response.status)) + "\n";
+    }
+
+    connection->output = "HTTP/1.1 " + std::to_string(response.status) + " " + statusText(response.status) +
+                         "\r\nContent-Type: " + response.contentType +
+                         "\r\nContent-Length: " + std::to_string(body.size());
+    for (const auto& header : response.headers) {
+        connection->output += "\r\n" + header.first + ": " + header.second;
+    }
+    connection->output += connection->keepAlive ? "\r\nConnection: keep-alive\r\n\r\n"
+                                                : "\r\nConnection: close\r\n\r\n";
+    connection->output += body;
+    connection->written = 0;
+    env_.taskScheduler().setBackgroundHandling(connection->socket, SOCKET_WRITABLE,
+                                               connectionWritableHandler, connection);
+}
+
+void HttpServer::handleWritable(Connection* connection) {
+    while (connection->written < connection->output.size()) {
+        ssize_t sent = send(connection->socket, connection->output.data() + connection->written,
+                            connection->output.size() - connection->written, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            break;
+        }
+        connection->written += sent;
+    }
+    if (connection->written < connection->output.size() || !connection->keepAlive) {
+        closeConnection(connection);
+        return;
+    }
+
+    // Wait for the next request on the same connection
+    connection->output.clear();
+    connection->written = 0;
+    env_.taskScheduler().setBackgroundHandling(connection->socket, SOCKET_READABLE,
+                                               connectionReadableHandler, connection);
+    if (headerEnd(connection->input) != std::string::npos) {
+        dispatch(connection);
+        return;
+    }
+    connection->idleTask = env_.taskScheduler().scheduleDelayedTask(HTTP_KEEPALIVE_TIMEOUT_MS * 1000LL,
+                                                                     idleTimeoutHandler, connection);
+}
+
+void HttpServer::idleTimeoutHandler(void* clientData) {
+    Connection* connection = static_cast<Connection*>(clientData);
+    connection->idleTask = nullptr;
+    connection->server->closeConnection(connection);
+}
+
+void HttpServer::closeConnection(Connection* connection) {
+    if (connection->idleTask != nullptr) {
+        env_.taskScheduler().unscheduleDelayedTask(connection->idleTask);
+    }
+    env_.taskScheduler().disableBackgroundHandling(connection->socket);
+    ::close(connection->socket);
+    connections_.erase(connection->socket);
+    delete connection;
+}
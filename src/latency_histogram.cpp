@@ -0,0 +1,71 @@
+#include "latency_histogram.h"
+#include <cstdio>
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0) {
+    for (unsigned i = 0; i < BUCKETS; ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+unsigned LatencyHistogram::bucketIndex(uint64_t micros) {
+    // Values below SUB_BUCKETS get a bucket each; above that the exponent
+    // picks the row and the next SUB_BITS bits the column
+    if (micros < SUB_BUCKETS) return static_cast<unsigned>(micros);
+    unsigned exponent = 63 - __builtin_clzll(micros);
+    unsigned row = exponent - SUB_BITS + 1;
+    if (row > MAX_EXPONENT) return BUCKETS - 1;
+    unsigned column = static_cast<unsigned>((micros >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return row * SUB_BUCKETS + column;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned index) {
+    unsigned row = index / SUB_BUCKETS;
+    unsigned column = index % SUB_BUCKETS;
+    if (row == 0) return column + 1;
+    unsigned shift = row - 1;
+    return (uint64_t(SUB_BUCKETS + column + 1) << shift);
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+    buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double quantile) const {
+    uint64_t n = count();
+    if (n == 0) return 0;
+    uint64_t target = static_cast<uint64_t>(quantile * n);
+    if (target >= n) target = n - 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > target) return bucketUpperBound(i);
+    }
+    return bucketUpperBound(BUCKETS - 1);
+}
+
+void LatencyHistogram::writePrometheus(std::string& out, const std::string& name,
+                                       const std::string& labels) const {
+    char line[256];
+    uint64_t cumulative = 0;
+    uint64_t nextBound = 1;
+    // The last bucket also takes everything beyond it; only +Inf covers that
+    for (unsigned i = 0; i + 1 < BUCKETS; ++i) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        // Emit at power-of-two bounds only, which keeps the output short
+        uint64_t bound = bucketUpperBound(i);
+        if (bound < nextBound) continue;
+        // 'le' is inclusive; the largest whole microsecond below the bound
+        snprintf(line, sizeof(line), "%s_bucket{%s,le=\"%.6f\"} %llu\n",
+                 name.c_str(), labels.c_str(), (bound - 1) / 1e6, (unsigned long long)cumulative);
+        out += line;
+        nextBound = bound * 2;
+    }
+    snprintf(line, sizeof(line), "%s_bucket{%s,le=\"+Inf\"} %llu\n%s_sum{%s} %g\n%s_count{%s} %llu\n",
+             name.c_str(), labels.c_str(), (unsigned long long)count(),
+             name.c_str(), labels.c_str(), sumMicros() / 1e6,
+             name.c_str(), labels.c_str(), (unsigned long long)count());
+    out += line;
+}
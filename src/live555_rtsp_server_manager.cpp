@@ -1,40 +1,388 @@
 #include "live555_rtsp_server_manager.h"
 #include "v4l2_h264_media_subsession.h"
+#include "v4l2_dvr_media_subsession.h"
 #include "logger.h"
+#include <cstdio>
 
-Live555RTSPServerManager::Live555RTSPServerManager(UsageEnvironment* env, v4l2Capture* capture, int port)
-    : env_(env), capture_(capture), port_(port), rtspServer_(nullptr), sms_(nullptr) {
+Live555RTSPServerManager::Live555RTSPServerManager(UsageEnvironment* env, const std::vector<DeviceConfig>& devices,
+                                                   int port, int workerCount)
+    : port_(port), workerCount_(workerCount), env_(env), devices_(devices), rtspServer_(nullptr),
+      httpServer_(nullptr), hlsServer_(nullptr), cpuReportTask_(nullptr) {
+    lastCpuReport_.tv_sec = 0;
+    lastCpuReport_.tv_nsec = 0;
 }
 
 Live555RTSPServerManager::~Live555RTSPServerManager() {
+    cleanup();
 }
 
 bool Live555RTSPServerManager::initialize() {
-    rtspServer_ = RTSPServer::createNew(*env_, port_, NULL);
-    if (rtspServer_ == NULL) {
-        *env_ << "Failed to create RTSP server: " << env_->getResultMsg() << "\n";
+    if (workerCount_ > 0) {
+        // Listeners first, so the cameras can register a shard with each
+        for (int i = 0; i < workerCount_; ++i) {
+            Live555RTSPWorker* worker = new Live555RTSPWorker(i, port_);
+            workers_.push_back(worker);
+            if (!worker->initialize()) return false;
+        }
+        LOG_INFO("Successfully created " + std::to_string(workerCount_) + " RTSP workers.");
+    } else {
+        rtspServer_ = RTSPServer::createNew(*env_, port_, NULL);
+        if (rtspServer_ == NULL) {
+            *env_ << "Failed to create RTSP server: " << env_->getResultMsg() << "\n";
+            return false;
+        }
+        LOG_INFO("Successfully created RTSP server.");
+    }
+
+    // Before the cameras, which register their playlists with it
+    bool hls = false;
+    for (const DeviceConfig& config : devices_) {
+        hls = hls || config.hls;
+    }
+    if (hls && HLS_HTTP_PORT > 0) {
+        hlsServer_ = new HttpServer(*env_, HLS_HTTP_BIND, HLS_HTTP_PORT, HLS_HTTP_MAX_CONNECTIONS);
+        if (!hlsServer_->initialize()) {
+            LOG_WARN("HLS disabled.");
+            delete hlsServer_;
+            hlsServer_ = nullptr;
+        }
+    }
+
+    // A camera that is unplugged or busy shouldn't take the others down
+    for (const DeviceConfig& config : devices_) {
+        if (!addCamera(config)) {
+            LOG_WARN("Skipping " + config.device + ".");
+        }
+    }
+    if (cameras_.empty()) {
+        LOG_ERROR("No capture device could be set up.");
+        return false;
+    }
+
+    if (!startWorkers()) return false;
+
+    // Monitoring only; the cameras are served without it
+    if (STATS_HTTP_PORT > 0) {
+        httpServer_ = new HttpServer(*env_, STATS_HTTP_BIND, STATS_HTTP_PORT);
+        if (httpServer_->initialize()) {
+            httpServer_->addHandler("/metrics", [this](const HttpRequest& request, HttpResponse& response) {
+                serveMetrics(request, response);
+            });
+        } else {
+            LOG_WARN("Stats endpoint disabled.");
+            delete httpServer_;
+            httpServer_ = nullptr;
+        }
+    }
+
+    if (CPU_REPORT_INTERVAL_SEC > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &lastCpuReport_);
+        cpuReportTask_ = env_->taskScheduler().scheduleDelayedTask(
+            CPU_REPORT_INTERVAL_SEC * 1000000LL, cpuReportTask, this);
+    }
+    return true;
+}
+
+bool Live555RTSPServerManager::addCamera(const DeviceConfig& requested) {
+    for (const Camera& camera : cameras_) {
+        if (camera.config.streamName == requested.streamName) {
+            LOG_ERROR("Stream name '" + requested.streamName + "' is used twice.");
+            return false;
+        }
+    }
+
+    // Workers are fed by the capture thread's per-worker rings
+    DeviceConfig config = requested;
+    if (!workers_.empty() && config.captureMode != CAPTURE_MODE_THREAD) {
+        LOG_INFO("RTSP workers need the capture thread, switching " + config.device + " to it.");
+        config.captureMode = CAPTURE_MODE_THREAD;
+    }
+
+    CaptureDevice* capture = CaptureDevice::createNew(config);
+    if (capture->getFd() < 0) {
+        delete capture;
+        return false;
+    }
+
+    // Format, controls and buffers; SPS/PPS come from the on-disk cache
+    // when this format was seen before
+    capture->setZeroCopy(ZERO_COPY_FRAMES);
+    if (!capture->initialize()) {
+        LOG_ERROR("Failed to initialize " + config.device + ".");
+        delete capture;
+        return false;
+    }
+
+    // One capture read path shared by every client session of this camera
+    v4l2FrameDistributor* distributor = v4l2FrameDistributor::createNew(*env_, capture, config.captureMode);
+
+    // Map buffers and learn SPS/PPS before the first client shows up, so
+    // neither DESCRIBE nor SETUP has to wait for the encoder
+    if (!distributor->prepare()) {
+        LOG_WARN("Failed to prepare capture, will retry on first client.");
+    } else if (distributor->getWarmMode() == WARM_CAPTURE_RUNNING && !distributor->startStreaming()) {
+        LOG_WARN("Failed to start always-on capture.");
+    }
+
+    Camera camera;
+    camera.config = config;
+    camera.capture = capture;
+    camera.distributor = distributor;
+    camera.bitrateController = config.adaptiveBitrate ? new BitrateController(capture) : nullptr;
+    camera.sms = nullptr;
+    camera.multicast = nullptr;
+    camera.recorder = nullptr;
+    camera.dvr = nullptr;
+    camera.hls = nullptr;
+    camera.lastCaptureCpu = 0;
+    camera.lastEventLoopCpu = 0;
+
+    bool ok = true;
+    // Workers don't run yet, so their servers can be changed from here
+    std::vector<std::pair<RTSPServer*, ServerMediaSession*> > sessions;
+    if (workers_.empty()) {
+        ok = addStream(rtspServer_, *env_, camera, distributor, camera.sms);
+        if (ok) sessions.push_back(std::make_pair(rtspServer_, camera.sms));
+    } else {
+        for (Live555RTSPWorker* worker : workers_) {
+            v4l2FrameDistributor* shard = v4l2FrameDistributor::createShard(*worker->getEnv(), distributor);
+            if (shard == nullptr) {
+                ok = false;
+                break;
+            }
+            camera.shards.push_back(shard);
+            if (distributor->getWarmMode() == WARM_CAPTURE_RUNNING) shard->startStreaming();
+
+            ServerMediaSession* sms = nullptr;
+            ok = addStream(worker->getRTSPServer(), *worker->getEnv(), camera, shard, sms);
+            if (!ok) break;
+            sessions.push_back(std::make_pair(worker->getRTSPServer(), sms));
+        }
+    }
+    if (!ok) {
+        // Nothing of a camera that can't be served stays behind
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            sessions[i].first->deleteServerMediaSession(sessions[i].second);
+        }
+        for (v4l2FrameDistributor* shard : camera.shards) {
+            delete shard;
+        }
+        delete distributor;
+        delete camera.bitrateController;
+        delete capture;
+        return false;
+    }
+
+    if (!config.multicastGroup.empty()) {
+        // Not fatal: the unicast mount is already up
+        addMulticastStream(camera);
+    }
+    if (!config.recordDirectory.empty()) {
+        addRecorder(camera);
+    }
+    if (config.dvrSeconds > 0) {
+        addDvrStream(camera);
+    }
+    if (config.hls && hlsServer_ != nullptr) {
+        addHlsStream(camera);
+    }
+    cameras_.push_back(camera);
+    return true;
+}
+
+bool Live555RTSPServerManager::addMulticastStream(Camera& camera) {
+    const DeviceConfig& config = camera.config;
+    // PassiveServerMediaSubsession drives the sink from the RTSP server's
+    // thread, and with workers there is no RTSP server on the main loop
+    if (!workers_.empty()) {
+        LOG_WARN("Multicast needs -w 0, not multicasting " + config.device + ".");
+        return false;
+    }
+    camera.multicast = v4l2MulticastStream::createNew(*env_, camera.capture, camera.distributor,
+                                                      config.multicastGroup, config.multicastPort);
+    if (camera.multicast == nullptr) return false;
+
+    ServerMediaSession* sms = camera.multicast->createSession(config.streamName + MULTICAST_STREAM_SUFFIX);
+    if (sms == nullptr) return false;
+    rtspServer_->addServerMediaSession(sms);
+    char* url = rtspServer_->rtspURL(sms);
+    LOG_INFO("Multicast stream URL for " + config.device + ": " + std::string(url));
+    delete[] url;
+    return true;
+}
+
+bool Live555RTSPServerManager::addRecorder(Camera& camera) {
+    // With workers the primary only drives the device; the recorder gets
+    // a shard of its own on the main loop
+    v4l2FrameDistributor* distributor = camera.distributor;
+    if (!workers_.empty()) {
+        distributor = v4l2FrameDistributor::createShard(*env_, camera.distributor);
+        if (distributor == nullptr) return false;
+        camera.shards.push_back(distributor);
+    }
+    camera.recorder = SegmentRecorder::createNew(camera.capture, distributor, camera.config.recordDirectory);
+    if (camera.recorder == nullptr) {
+        LOG_WARN("Not recording " + camera.config.device + ".");
         return false;
     }
-    logMessage("Successfully created RTSP server.");
+    return true;
+}
 
-    sms_ = ServerMediaSession::createNew(*env_, "v4l2Stream", "v4l2Stream", 
-        "Session streamed by \"v4l2StreamServer\"", True);
-    sms_->addSubsession(v4l2H264MediaSubsession::createNew(*env_, capture_, False));
-    rtspServer_->addServerMediaSession(sms_);
+bool Live555RTSPServerManager::addDvrStream(Camera& camera) {
+    const DeviceConfig& config = camera.config;
+    // Readers and the buffer share one event loop, and sessions on worker
+    // loops would read it from other threads
+    if (!workers_.empty()) {
+        LOG_WARN("DVR needs -w 0, no timeshift for " + config.device + ".");
+        return false;
+    }
+    camera.dvr = DvrBuffer::createNew(camera.capture, camera.distributor, config.dvrSeconds);
+    if (camera.dvr == nullptr) return false;
 
-    char* url = rtspServer_->rtspURL(sms_);
-    logMessage("Stream URL: " + std::string(url));
+    std::string name = config.streamName + DVR_STREAM_SUFFIX;
+    ServerMediaSession* sms = ServerMediaSession::createNew(*env_, name.c_str(), name.c_str(),
+        "Timeshift session streamed by \"v4l2StreamServer\"", True);
+    if (sms == nullptr) return false;
+    sms->addSubsession(v4l2DvrMediaSubsession::createNew(*env_, camera.dvr, camera.distributor));
+    rtspServer_->addServerMediaSession(sms);
+    char* url = rtspServer_->rtspURL(sms);
+    LOG_INFO("DVR stream URL for " + config.device + ": " + std::string(url));
     delete[] url;
+    return true;
+}
 
+bool Live555RTSPServerManager::addHlsStream(Camera& camera) {
+    // Like the recorder: a shard on the main loop, which runs the server
+    v4l2FrameDistributor* distributor = camera.distributor;
+    if (!workers_.empty()) {
+        distributor = v4l2FrameDistributor::createShard(*env_, camera.distributor);
+        if (distributor == nullptr) return false;
+        camera.shards.push_back(distributor);
+    }
+    camera.hls = HlsPackager::createNew(*env_, camera.capture, distributor, hlsServer_);
+    if (camera.hls == nullptr) {
+        LOG_WARN("No HLS for " + camera.config.device + ".");
+        return false;
+    }
+    return true;
+}
+
+bool Live555RTSPServerManager::addStream(RTSPServer* server, UsageEnvironment& env, const Camera& camera,
+                                         v4l2FrameDistributor* distributor, ServerMediaSession*& sms) {
+    const DeviceConfig& config = camera.config;
+    sms = ServerMediaSession::createNew(env, config.streamName.c_str(),
+        config.streamName.c_str(), "Session streamed by \"v4l2StreamServer\"", True);
+    if (sms == nullptr) return false;
+    sms->addSubsession(v4l2H264MediaSubsession::createNew(env, camera.capture, distributor,
+                                                          camera.bitrateController, False));
+    server->addServerMediaSession(sms);
+
+    // Every worker serves the same URLs; log them once
+    if (server == rtspServer_ || server == workers_.front()->getRTSPServer()) {
+        char* url = server->rtspURL(sms);
+        LOG_INFO("Stream URL for " + config.device + ": " + std::string(url));
+        delete[] url;
+    }
+    return true;
+}
+
+bool Live555RTSPServerManager::startWorkers() {
+    for (Live555RTSPWorker* worker : workers_) {
+        if (!worker->start()) return false;
+    }
     return true;
 }
 
 void Live555RTSPServerManager::runEventLoop(char* shouldExit) {
-    logMessage("Starting event loop. Press Ctrl+C to exit.");
+    LOG_INFO("Starting event loop. Press Ctrl+C to exit.");
     env_->taskScheduler().doEventLoop(shouldExit);
 }
 
+void Live555RTSPServerManager::cpuReportTask(void* clientData) {
+    Live555RTSPServerManager* manager = static_cast<Live555RTSPServerManager*>(clientData);
+    manager->reportCpuUsage();
+    manager->cpuReportTask_ = manager->env_->taskScheduler().scheduleDelayedTask(
+        CPU_REPORT_INTERVAL_SEC * 1000000LL, cpuReportTask, manager);
+}
+
+void Live555RTSPServerManager::reportCpuUsage() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wallNanos = (now.tv_sec - lastCpuReport_.tv_sec) * 1e9 + (now.tv_nsec - lastCpuReport_.tv_nsec);
+    lastCpuReport_ = now;
+    if (wallNanos <= 0) return;
+
+    for (Camera& camera : cameras_) {
+        uint64_t captureCpu = camera.distributor->captureCpuNanos();
+        uint64_t eventLoopCpu = camera.distributor->eventLoopCpuNanos();
+        for (v4l2FrameDistributor* shard : camera.shards) {
+            eventLoopCpu += shard->eventLoopCpuNanos();
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "CPU %s (%s): capture thread %.1f%%, event loop %.1f%%",
+                 camera.config.device.c_str(), camera.config.streamName.c_str(),
+                 100.0 * (captureCpu - camera.lastCaptureCpu) / wallNanos,
+                 100.0 * (eventLoopCpu - camera.lastEventLoopCpu) / wallNanos);
+        LOG_INFO(line);
+        camera.lastCaptureCpu = captureCpu;
+        camera.lastEventLoopCpu = eventLoopCpu;
+    }
+}
+
+void Live555RTSPServerManager::releaseCameras() {
+    // Recorders, DVRs and HLS before their distributor, shards before their primary,
+    // distributors before the captures: each one stops threads that use
+    // the next
+    for (Camera& camera : cameras_) {
+        delete camera.recorder;
+        delete camera.dvr;
+        delete camera.hls;
+        for (v4l2FrameDistributor* shard : camera.shards) {
+            delete shard;
+        }
+        delete camera.multicast;
+        delete camera.distributor;
+        delete camera.bitrateController;
+        delete camera.capture;
+    }
+    cameras_.clear();
+}
+
+void Live555RTSPServerManager::serveMetrics(const HttpRequest& /*request*/, HttpResponse& response) {
+    std::vector<LabeledStats> streams;
+    for (const Camera& camera : cameras_) {
+        LabeledStats stream;
+        stream.labels = "device=\"" + camera.config.device + "\",stream=\"" + camera.config.streamName + "\"";
+        stream.stats = &camera.capture->getStats();
+        streams.push_back(stream);
+    }
+    response.contentType = "text/plain; version=0.0.4";
+    response.body = formatPrometheus(streams);
+}
+
 void Live555RTSPServerManager::cleanup() {
+    if (cameras_.empty() && workers_.empty() && rtspServer_ == nullptr) return;
+
+    if (cpuReportTask_ != nullptr) {
+        env_->taskScheduler().unscheduleDelayedTask(cpuReportTask_);
+    }
+    delete httpServer_;
+    httpServer_ = nullptr;
+    delete hlsServer_;
+    hlsServer_ = nullptr;
+
+    // Workers must be stopped before anything they use goes away
+    for (Live555RTSPWorker* worker : workers_) {
+        worker->stop();
+        worker->cleanup();
+    }
     Medium::close(rtspServer_);
-    logMessage("Successfully cleaned up RTSP server.");
+    rtspServer_ = nullptr;
+
+    releaseCameras();
+    for (Live555RTSPWorker* worker : workers_) {
+        delete worker;
+    }
+    workers_.clear();
+    LOG_INFO("Successfully cleaned up RTSP server.");
 }
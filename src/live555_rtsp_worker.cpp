@@ -0,0 +1,116 @@
+#include "live555_rtsp_worker.h"
+#include "constants.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// RTSPServer::createNew() binds its own socket without SO_REUSEPORT, so the
+// workers hand a prepared socket to the protected constructor instead.
+class ReusePortRTSPServer : public RTSPServer {
+public:
+    static ReusePortRTSPServer* createNew(UsageEnvironment& env, int port) {
+        int sock = setUpSocket(port);
+        if (sock < 0) return nullptr;
+        return new ReusePortRTSPServer(env, sock, port);
+    }
+
+protected:
+    ReusePortRTSPServer(UsageEnvironment& env, int sock, int port)
+        : RTSPServer(env, sock, -1, Port(port), NULL, 65) {}
+
+private:
+    static int setUpSocket(int port) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) {
+            LOG_ERROR("RTSP worker socket error: " + std::string(strerror(errno)));
+            return -1;
+        }
+
+        int on = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            LOG_ERROR("SO_REUSEPORT error: " + std::string(strerror(errno)));
+            ::close(sock);
+            return -1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+            LOG_ERROR("RTSP worker bind/listen error: " + std::string(strerror(errno)));
+            ::close(sock);
+            return -1;
+        }
+
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        return sock;
+    }
+};
+
+Live555RTSPWorker::Live555RTSPWorker(int id, int port)
+    : id_(id), port_(port), scheduler_(nullptr), env_(nullptr), rtspServer_(nullptr), shouldExit_(0) {
+}
+
+Live555RTSPWorker::~Live555RTSPWorker() {
+    stop();
+    cleanup();
+    if (env_ != nullptr) env_->reclaim();
+    delete scheduler_;
+}
+
+bool Live555RTSPWorker::initialize() {
+    scheduler_ = BasicTaskScheduler::createNew();
+    env_ = BasicUsageEnvironment::createNew(*scheduler_);
+
+    rtspServer_ = ReusePortRTSPServer::createNew(*env_, port_);
+    if (rtspServer_ == nullptr) {
+        LOG_ERROR("Failed to create RTSP listener for worker " + std::to_string(id_));
+        return false;
+    }
+    return true;
+}
+
+bool Live555RTSPWorker::start() {
+    shouldExit_ = 0;
+    thread_ = std::thread(&Live555RTSPWorker::run, this);
+
+    if (RTSP_WORKER_PIN_CORES) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(id_ % (cores > 0 ? cores : 1), &set);
+        int err = pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set);
+        if (err != 0) {
+            LOG_ERROR("Failed to pin RTSP worker " + std::to_string(id_) + ": " + std::string(strerror(err)));
+        }
+    }
+
+    LOG_INFO("Started RTSP worker " + std::to_string(id_) + ".");
+    return true;
+}
+
+void Live555RTSPWorker::stop() {
+    if (!thread_.joinable()) return;
+    // doEventLoop() checks the watch variable at least every scheduler tick
+    shouldExit_ = 1;
+    thread_.join();
+    LOG_INFO("Stopped RTSP worker " + std::to_string(id_) + ".");
+}
+
+void Live555RTSPWorker::cleanup() {
+    Medium::close(rtspServer_);
+    rtspServer_ = nullptr;
+}
+
+void Live555RTSPWorker::run() {
+    env_->taskScheduler().doEventLoop(&shouldExit_);
+}
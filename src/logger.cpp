@@ -1,8 +1,203 @@
 #include "logger.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct LogSlot {
+    std::atomic<uint64_t> sequence;  // Vyukov-style bounded queue ticket
+    struct timespec time;
+    int level;
+    unsigned length;
+    char text[LOG_SLOT_SIZE];
+};
+
+class AsyncLogger {
+public:
+    AsyncLogger() : tail(0), head(0), dropped(0), running(false) {
+        for (uint64_t i = 0; i < LOG_RING_SLOTS; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        cachedSecond = 0;
+        cachedStamp[0] = '\0';
+    }
+
+    void start() {
+        running.store(true, std::memory_order_release);
+        thread = std::thread(&AsyncLogger::run, this);
+    }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        running.store(false, std::memory_order_release);
+        // Pairs with the fence in pushed(): a producer either sees the
+        // logger stopped or its message is seen by the drain below
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        thread.join();
+        drain();
+    }
+
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+
+    // After a push: a message that raced with stop() would sit in a ring
+    // nobody reads any more, so the producer writes it out itself
+    void pushed() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!running.load(std::memory_order_relaxed)) drain();
+    }
+
+    // Any thread. Never blocks.
+    bool push(int level, const struct timespec& time, const std::string& message) {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        LogSlot* slot;
+        while (true) {
+            slot = &slots[pos % LOG_RING_SLOTS];
+            uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = int64_t(seq) - int64_t(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->time = time;
+        slot->level = level;
+        slot->length = message.size() < LOG_SLOT_SIZE ? message.size() : LOG_SLOT_SIZE;
+        memcpy(slot->text, message.data(), slot->length);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Writes one line directly, for use once the thread is gone
+    void write(int level, const struct timespec& time, const char* text, unsigned length) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        writeLine(level, time, text, length);
+        fflush(stdout);
+    }
+
+private:
+    void run() {
+        while (running.load(std::memory_order_acquire)) {
+            if (!drain()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+            }
+        }
+    }
+
+    // Background thread, or anyone once it has stopped. Returns true if
+    // anything was written.
+    bool drain() {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        bool wrote = false;
+        while (true) {
+            LogSlot& slot = slots[head % LOG_RING_SLOTS];
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1) break;
+            writeLine(slot.level, slot.time, slot.text, slot.length);
+            slot.sequence.store(head + LOG_RING_SLOTS, std::memory_order_release);
+            head++;
+            wrote = true;
+        }
+
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0) {
+            char note[64];
+            int length = snprintf(note, sizeof(note), "Log ring full, %llu messages dropped",
+                                  (unsigned long long)lost);
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            writeLine(LOG_LEVEL_WARN, now, note, length);
+            wrote = true;
+        }
+        if (wrote) fflush(stdout);
+        return wrote;
+    }
+
+    void writeLine(int level, const struct timespec& time, const char* text, unsigned length) {
+        // localtime/strftime once per second at most
+        if (time.tv_sec != cachedSecond || cachedStamp[0] == '\0') {
+            struct tm local;
+            time_t seconds = time.tv_sec;
+            localtime_r(&seconds, &local);
+            strftime(cachedStamp, sizeof(cachedStamp), "%Y-%m-%d %H:%M:%S", &local);
+            cachedSecond = time.tv_sec;
+        }
+        static const char* const prefixes[] = { "DEBUG: ", "", "WARN: ", "ERROR: " };
+        const char* prefix = level >= LOG_LEVEL_DEBUG && level <= LOG_LEVEL_ERROR ? prefixes[level] : "";
+        fprintf(stdout, "%s - %s%.*s\n", cachedStamp, prefix, (int)length, text);
+    }
+
+    LogSlot slots[LOG_RING_SLOTS];
+    char padding1[64];
+    std::atomic<uint64_t> tail;     // Producers
+    char padding2[64];
+    uint64_t head;                  // Under writeMutex
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> running;
+    std::thread thread;
+    std::mutex writeMutex;          // Serializes writers of stdout; producers only take it after stop()
+    time_t cachedSecond;
+    char cachedStamp[20];
+};
+
+AsyncLogger* logger() {
+    static AsyncLogger* instance = nullptr;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        instance = new AsyncLogger();
+        instance->start();
+        atexit(logShutdown);
+    });
+    return instance;
+}
+
+} // namespace
+
+void logMessage(int level, const std::string& message) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    AsyncLogger* async = logger();
+    if (async->isRunning()) {
+        async->push(level, now, message);
+        async->pushed();
+    } else {
+        async->write(level, now, message.data(), message.size());
+    }
+}
 
 void logMessage(const std::string& message) {
-    std::time_t now = std::time(nullptr);
-    char timestamp[20];
-    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    std::cout << timestamp << " - " << message << std::endl;
+    logMessage(LOG_LEVEL_INFO, message);
+}
+
+void logShutdown() {
+    logger()->stop();
+}
+
+bool LogRateLimiter::allow(uint64_t& skipped) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t start = windowStart.load(std::memory_order_relaxed);
+    if (now - start >= LOG_RATE_LIMIT_INTERVAL_MS &&
+        windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    if (count.fetch_add(1, std::memory_order_relaxed) >= LOG_RATE_LIMIT_BURST) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    skipped = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+std::string rateLimitSuffix(uint64_t skipped) {
+    if (skipped == 0) return std::string();
+    return " (" + std::to_string(skipped) + " similar messages suppressed)";
 }
@@ -1,4 +1,6 @@
 #include <csignal>
+#include <cstdlib>
+#include <vector>
 #include "live555_rtsp_server_manager.h"
 #include "logger.h"
 #include "constants.h"
@@ -6,7 +8,7 @@
 char shouldExit = 0;
 
 void signalHandler(int signum) {
-    logMessage("Interrupt signal (" + std::to_string(signum) + ") received.");
+    LOG_INFO("Interrupt signal (" + std::to_string(signum) + ") received.");
     shouldExit = 1;
 }
 
@@ -18,15 +20,44 @@ int main(int argc, char** argv) {
     TaskScheduler* scheduler = BasicTaskScheduler::createNew();
     UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
 
-    // Set up V4L2 capture
-    v4l2Capture* capture = new v4l2Capture(DEVICE);
-    if (capture->getFd() < 0) {
-        *env << "Failed to open v4l2 capture device.\n";
-        exit(1);
-    }  
+    // Each positional argument is a device spec, see parseDeviceConfig()
+    int port = DEFAULT_RTSP_PORT;
+    int workers = RTSP_WORKER_THREADS;
+    std::vector<DeviceConfig> devices;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-p" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "-w" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            continue;
+        }
+        DeviceConfig config;
+        if (!parseDeviceConfig(arg, config)) {
+            *env << "Usage: " << argv[0] << " [-p port] [-w workers] [device[,name=..][,size=WxH][,bitrate=..]"
+                 << "[,gop=..][,fps=..][,rotate=..][,mode=sync|thread|nonblock]"
+                 << "[,timestamps=capture|synthetic][,latency=low|normal]"
+                 << "[,abr=on|off][,minbitrate=..][,maxbitrate=..]"
+                 << "[,pace=recorded|fast][,dump=file" << FRAME_DUMP_EXTENSION << "]"
+                 << "[,multicast=group[:port]][,record=dir][,dvr=seconds][,hls=on|off]]...\n";
+            exit(1);
+        }
+        devices.push_back(config);
+    }
+    if (devices.empty()) {
+        devices.push_back(DeviceConfig());
+    }
+    // Without an explicit name, cameras after the first are named after their node
+    for (size_t i = 1; i < devices.size(); ++i) {
+        if (devices[i].streamName == DEFAULT_STREAM_NAME) {
+            devices[i].streamName = devices[i].device.substr(devices[i].device.find_last_of('/') + 1);
+        }
+    }
 
-    // Create and initialize RTSP server manager
-    Live555RTSPServerManager rtspManager(env, capture);
+    // Create and initialize RTSP server manager; it opens every camera
+    Live555RTSPServerManager rtspManager(env, devices, port, workers);
     if (!rtspManager.initialize()) {
         *env << "Failed to initialize RTSP server manager.\n";
         exit(1);
@@ -37,10 +68,10 @@ int main(int argc, char** argv) {
 
     // Cleanup
     rtspManager.cleanup();
-    delete capture;
     delete scheduler;
     env->reclaim();
 
-    logMessage("Successfully shut down application.");
+    LOG_INFO("Successfully shut down application.");
+    logShutdown();
     return 0;
 }
@@ -0,0 +1,120 @@
+#include "parameter_set_cache.h"
+#include "constants.h"
+#include "logger.h"
+#include <Base64.hh>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+static std::string toHex(const uint8_t* data, unsigned size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(size * 2);
+    for (unsigned i = 0; i < size; ++i) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0x0F];
+    }
+    return hex;
+}
+
+static bool fromHex(const std::string& hex, std::vector<uint8_t>& out) {
+    if (hex.empty() || hex.size() % 2 != 0) return false;
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        char byte[3] = { hex[i], hex[i + 1], 0 };
+        char* end = nullptr;
+        unsigned long value = strtoul(byte, &end, 16);
+        if (end != byte + 2) return false;
+        out.push_back(static_cast<uint8_t>(value));
+    }
+    return true;
+}
+
+ParameterSetCache::ParameterSetCache(const std::string& device, const std::string& key)
+    : key(key) {
+    // One file per device node: /dev/video0 -> <dir>/video0.params
+    size_t slash = device.find_last_of('/');
+    std::string name = slash == std::string::npos ? device : device.substr(slash + 1);
+    path = std::string(PARAM_SET_CACHE_DIR) + "/" + name + ".params";
+}
+
+bool ParameterSetCache::load(std::vector<uint8_t>& sps, std::vector<uint8_t>& pps,
+                             std::string& fmtpParams) const {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    std::string line, storedKey, spsHex, ppsHex, fmtp;
+    while (std::getline(in, line)) {
+        size_t space = line.find(' ');
+        if (space == std::string::npos) continue;
+        std::string field = line.substr(0, space);
+        std::string value = line.substr(space + 1);
+        if (field == "key") storedKey = value;
+        else if (field == "sps") spsHex = value;
+        else if (field == "pps") ppsHex = value;
+        else if (field == "fmtp") fmtp = value;
+    }
+
+    if (storedKey != key) {
+        LOG_INFO("Parameter set cache " + path + " is for a different format, ignoring it.");
+        return false;
+    }
+    if (!fromHex(spsHex, sps) || !fromHex(ppsHex, pps) || fmtp.empty()) {
+        LOG_ERROR("Parameter set cache " + path + " is damaged, ignoring it.");
+        return false;
+    }
+    fmtpParams = fmtp;
+    return true;
+}
+
+bool ParameterSetCache::store(const uint8_t* sps, unsigned spsSize, const uint8_t* pps, unsigned ppsSize,
+                              const std::string& fmtpParams) const {
+    if (mkdir(PARAM_SET_CACHE_DIR, 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("Cannot create " + std::string(PARAM_SET_CACHE_DIR) + ": " + std::string(strerror(errno)));
+        return false;
+    }
+
+    // Write a temporary file and rename it so readers never see half an entry
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out) {
+            LOG_ERROR("Cannot write " + tmpPath + ": " + std::string(strerror(errno)));
+            return false;
+        }
+        out << "key " << key << "\n"
+            << "sps " << toHex(sps, spsSize) << "\n"
+            << "pps " << toHex(pps, ppsSize) << "\n"
+            << "fmtp " << fmtpParams << "\n";
+        if (!out.flush()) {
+            LOG_ERROR("Failed to write " + tmpPath);
+            return false;
+        }
+    }
+    if (rename(tmpPath.c_str(), path.c_str()) == -1) {
+        LOG_ERROR("Cannot rename " + tmpPath + ": " + std::string(strerror(errno)));
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    LOG_INFO("Saved SPS/PPS to " + path);
+    return true;
+}
+
+std::string buildFmtpParams(const uint8_t* sps, unsigned spsSize, const uint8_t* pps, unsigned ppsSize) {
+    if (sps == nullptr || pps == nullptr || spsSize < 4 || ppsSize == 0) return std::string();
+
+    char* spsBase64 = base64Encode((char*)sps, spsSize);
+    char* ppsBase64 = base64Encode((char*)pps, ppsSize);
+
+    char profileLevelId[7];
+    snprintf(profileLevelId, sizeof(profileLevelId), "%02X%02X%02X", sps[1], sps[2], sps[3]);
+    std::string params = std::string("packetization-mode=1;profile-level-id=") + profileLevelId +
+                         ";sprop-parameter-sets=" + spsBase64 + "," + ppsBase64;
+
+    delete[] spsBase64;
+    delete[] ppsBase64;
+    return params;
+}
@@ -0,0 +1,40 @@
+#include "rtcp_feedback_groupsock.h"
+#include "logger.h"
+
+// RTCP payload-specific feedback (RFC 4585) and its FMT values
+static const unsigned char RTCP_PT_PSFB = 206;
+static const unsigned char PSFB_FMT_PLI = 1;
+static const unsigned char PSFB_FMT_FIR = 4;
+
+RtcpFeedbackGroupsock::RtcpFeedbackGroupsock(UsageEnvironment& env, struct sockaddr_storage const& groupAddr,
+                                             Port port, u_int8_t ttl, CaptureDevice* capture)
+    : Groupsock(env, groupAddr, port, ttl), fCapture(capture) {
+}
+
+RtcpFeedbackGroupsock::~RtcpFeedbackGroupsock() {
+}
+
+Boolean RtcpFeedbackGroupsock::handleRead(unsigned char* buffer, unsigned bufferMaxSize, unsigned& bytesRead,
+                                          struct sockaddr_storage& fromAddressAndPort) {
+    Boolean ok = Groupsock::handleRead(buffer, bufferMaxSize, bytesRead, fromAddressAndPort);
+    if (ok && hasPictureLossFeedback(buffer, bytesRead)) {
+        StreamStats::add(fCapture->getStats().pictureLossIndications);
+        fCapture->requestKeyFrame("RTCP PLI/FIR");
+    }
+    return ok;
+}
+
+bool RtcpFeedbackGroupsock::hasPictureLossFeedback(const unsigned char* packet, unsigned size) {
+    // Walk the compound packet: V=2, then PT and length in 32-bit words - 1
+    while (size >= 4) {
+        if ((packet[0] >> 6) != 2) return false;
+        unsigned length = ((unsigned(packet[2]) << 8 | packet[3]) + 1) * 4;
+        if (length > size) return false;
+
+        unsigned char fmt = packet[0] & 0x1f;
+        if (packet[1] == RTCP_PT_PSFB && (fmt == PSFB_FMT_PLI || fmt == PSFB_FMT_FIR)) return true;
+        packet += length;
+        size -= length;
+    }
+    return false;
+}
@@ -0,0 +1,461 @@
+#include "segment_recorder.h"
+#include "logger.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char* const SEGMENT_SUFFIX = ".mp4";
+const char* const PART_SUFFIX = ".mp4.part";
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// <prefix>YYYYMMDD-HHMMSS[-n]<suffix>, so cameras whose names share a
+// prefix don't touch each other's files
+bool isSegmentName(const std::string& name, const std::string& prefix, const std::string& suffix) {
+    if (name.compare(0, prefix.size(), prefix) != 0 || !endsWith(name, suffix)) return false;
+    if (name.size() < prefix.size() + 15 + suffix.size()) return false;
+    for (size_t i = 0; i < 15; ++i) {
+        char c = name[prefix.size() + i];
+        if (i == 8 ? c != '-' : !isdigit(static_cast<unsigned char>(c))) return false;
+    }
+    return true;
+}
+
+uint32_t readBE32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+} // namespace
+
+SegmentRecorder* SegmentRecorder::createNew(CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                                            const std::string& directory) {
+    if (mkdir(directory.c_str(), 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("Cannot create recording directory " + directory + ": " + std::string(strerror(errno)));
+        return nullptr;
+    }
+    struct stat st;
+    if (stat(directory.c_str(), &st) == -1 || !S_ISDIR(st.st_mode) || access(directory.c_str(), W_OK) == -1) {
+        LOG_ERROR("Recording directory " + directory + " is not a writable directory.");
+        return nullptr;
+    }
+
+    SegmentRecorder* recorder = new SegmentRecorder(capture, distributor, directory);
+    if (!recorder->start()) {
+        delete recorder;
+        return nullptr;
+    }
+    return recorder;
+}
+
+SegmentRecorder::SegmentRecorder(CaptureDevice* capture, v4l2FrameDistributor* distributor,
+                                 const std::string& directory)
+    : capture(capture), distributor(distributor), directory(directory),
+      prefix(capture->getConfig().streamName + "-"), stats(capture->getStats()),
+      queue(RECORDER_QUEUE_FRAMES), parameterSetVersion(0), lostFrame(false), running(false),
+      waitingForKeyFrame(true), fd(-1), segmentStartNanos(0), fragmentStartNanos(0), block(nullptr),
+      blockFill(0), blockOffset(0), blockDirty(false), lastCheckpointMs(0) {
+}
+
+SegmentRecorder::~SegmentRecorder() {
+    distributor->removeConsumer(this);
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        thread.join();   // Writes out the queue and finalizes the segment
+    }
+    free(block);
+}
+
+bool SegmentRecorder::start() {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, sysconf(_SC_PAGESIZE), RECORDER_WRITE_BLOCK) != 0) {
+        LOG_ERROR("Failed to allocate the recording buffer.");
+        return false;
+    }
+    block = static_cast<uint8_t*>(memory);
+
+    // Like multicast, recording has no viewer to start the capture
+    if (!distributor->isStreaming() && !distributor->startStreaming()) {
+        LOG_ERROR("Failed to start capture for recording " + capture->getConfig().device + ".");
+        return false;
+    }
+    running.store(true, std::memory_order_release);
+    thread = std::thread(&SegmentRecorder::run, this);
+
+    distributor->addConsumer(this);
+    distributor->requestFrame(this);
+    LOG_INFO("Recording " + capture->getConfig().device + " to " + directory + ".");
+    return true;
+}
+
+void SegmentRecorder::deliverFrame(const FramePtr& frame, bool continuous) {
+    // Snapshot the SPS/PPS the frame was encoded with for the writer thread
+    if (capture->hasSpsPps() && (!parameterSets || capture->getSpsPpsVersion() != parameterSetVersion)) {
+        std::shared_ptr<ParameterSets> current = std::make_shared<ParameterSets>();
+        current->sps.assign(capture->getSPS(), capture->getSPS() + capture->getSPSSize());
+        current->pps.assign(capture->getPPS(), capture->getPPS() + capture->getPPSSize());
+        parameterSets = current;
+        parameterSetVersion = capture->getSpsPpsVersion();
+    }
+
+    QueuedFrame queued;
+    // A lent frame would pin a V4L2 buffer for as long as the disk is slow
+    queued.frame = frame->isLent() ? capture->getFramePool().clone(*frame) : frame;
+    queued.continuous = continuous && !lostFrame;
+    queued.parameterSets = parameterSets;
+    if (queue.push(std::move(queued))) {
+        lostFrame = false;
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wake.notify_one();
+    } else {
+        lostFrame = true;
+        StreamStats::add(stats.recorderDrops);
+    }
+
+    distributor->requestFrame(this);  // May deliver again right away
+}
+
+void SegmentRecorder::run() {
+    recoverPartialSegments();
+    applyRetention();
+
+    QueuedFrame next;
+    while (true) {
+        bool stopping = !running.load(std::memory_order_acquire);
+        while (queue.pop(next)) {
+            record(next);
+        }
+        if (stopping) break;
+        checkpoint();
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait_for(lock, std::chrono::milliseconds(RECORDER_CHECKPOINT_MS), [this] {
+            return queue.size() > 0 || !running.load(std::memory_order_acquire);
+        });
+    }
+    finishSegment();
+}
+
+void SegmentRecorder::record(QueuedFrame& next) {
+    const EncodedFrame& frame = *next.frame;
+    if (!next.continuous) {
+        // The decoder would break on the gap; close the file and start the
+        // next one at an IDR
+        finishSegment();
+        waitingForKeyFrame = true;
+    }
+    if (waitingForKeyFrame && (!frame.isIDR() || !next.parameterSets)) return;
+
+    // The held frame lasts until this one
+    if (held.frame) {
+        if (muxer.empty()) fragmentStartNanos = held.frame->captureNanos;
+        muxer.addSample(*held.frame, ticksBetween(*held.frame, frame));
+        held = QueuedFrame();
+    }
+
+    if (fd >= 0) {
+        uint64_t now = frame.captureNanos;
+        bool newParameterSets = next.parameterSets && next.parameterSets != segmentParameterSets &&
+            (next.parameterSets->sps != segmentParameterSets->sps ||
+             next.parameterSets->pps != segmentParameterSets->pps);
+        if (frame.isIDR() && (newParameterSets ||
+                              (now > segmentStartNanos &&
+                               now - segmentStartNanos >= RECORDER_SEGMENT_SECONDS * 1000000000ULL))) {
+            finishSegment();
+        } else if (!muxer.empty() && now > fragmentStartNanos &&
+                   now - fragmentStartNanos >= RECORDER_FRAGMENT_MS * 1000000ULL) {
+            flushFragment();
+        }
+    }
+
+    // Every file starts with an IDR and its own avcC
+    if (fd < 0 && (!frame.isIDR() || !next.parameterSets || !openSegment(next))) {
+        waitingForKeyFrame = true;
+        return;
+    }
+    waitingForKeyFrame = false;
+    held = std::move(next);
+}
+
+uint32_t SegmentRecorder::ticksBetween(const EncodedFrame& frame, const EncodedFrame& next) const {
+    uint32_t nominal = capture->getConfig().frameTicks();
+    if (frame.captureNanos == 0 || next.captureNanos <= frame.captureNanos) return nominal;
+    uint64_t ticks = (next.captureNanos - frame.captureNanos) * 9 / 100000;
+    // Longer than a second is a stall, not a frame duration
+    if (ticks == 0 || ticks > 90000) return nominal;
+    return ticks;
+}
+
+bool SegmentRecorder::openSegment(const QueuedFrame& first) {
+    const DeviceConfig& config = capture->getConfig();
+    struct timeval wallClock = capture->toWallClock(first.frame->captureNanos);
+    time_t seconds = wallClock.tv_sec;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    // Segments cut short by a parameter set change can share a second
+    std::string base = directory + "/" + prefix + stamp;
+    finalPath = base + SEGMENT_SUFFIX;
+    for (int n = 1; access(finalPath.c_str(), F_OK) == 0; ++n) {
+        finalPath = base + "-" + std::to_string(n) + SEGMENT_SUFFIX;
+    }
+    partPath = finalPath + ".part";
+
+    fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "Cannot create segment " + partPath + ": " + std::string(strerror(errno)));
+        return false;
+    }
+    segmentParameterSets = first.parameterSets;
+    segmentStartNanos = first.frame->captureNanos;
+    blockFill = 0;
+    blockOffset = 0;
+    blockDirty = false;
+    lastCheckpointMs = monotonicNanos() / 1000000;
+    muxer.reset();
+
+    fragment.clear();
+    const ParameterSets& sets = *first.parameterSets;
+    Fmp4Muxer::writeInitSegment(fragment, sets.sps.data(), sets.sps.size(), sets.pps.data(), sets.pps.size(),
+                                config.width, config.height);
+    append(fragment);
+    LOG_DEBUG("Started segment " + partPath);
+    return fd >= 0;
+}
+
+void SegmentRecorder::flushFragment() {
+    if (muxer.empty()) return;
+    fragment.clear();
+    muxer.writeFragment(fragment);
+    append(fragment);
+}
+
+void SegmentRecorder::finishSegment() {
+    if (fd < 0) return;
+
+    if (held.frame) {
+        muxer.addSample(*held.frame, capture->getConfig().frameTicks());
+        held = QueuedFrame();
+    }
+    flushFragment();
+    if (fd >= 0 && blockDirty) writeBlock();
+    if (fd < 0) return;   // Write failed; the partial segment was salvaged
+
+    if (fdatasync(fd) == -1) {
+        LOG_WARN("fdatasync failed for " + partPath + ": " + std::string(strerror(errno)));
+    }
+    close(fd);
+    fd = -1;
+
+    // Only a complete, synced file gets the final name
+    if (rename(partPath.c_str(), finalPath.c_str()) == -1) {
+        LOG_ERROR("Cannot rename " + partPath + ": " + std::string(strerror(errno)));
+        return;
+    }
+    syncDirectory();
+    StreamStats::add(stats.recordedSegments);
+    LOG_INFO("Finished segment " + finalPath);
+    applyRetention();
+}
+
+void SegmentRecorder::abandonSegment() {
+    close(fd);
+    fd = -1;
+    held = QueuedFrame();
+    muxer.reset();
+    waitingForKeyFrame = true;
+
+    // Keep what made it to disk, and maybe free up space for the next one
+    recoverSegment(partPath);
+    syncDirectory();
+    applyRetention();
+}
+
+void SegmentRecorder::append(const std::vector<uint8_t>& bytes) {
+    const uint8_t* data = bytes.data();
+    size_t size = bytes.size();
+    StreamStats::add(stats.recordedBytes, size);
+    while (size > 0 && fd >= 0) {
+        size_t count = std::min(size, size_t(RECORDER_WRITE_BLOCK) - blockFill);
+        memcpy(block + blockFill, data, count);
+        blockFill += count;
+        blockDirty = true;
+        data += count;
+        size -= count;
+        if (blockFill == RECORDER_WRITE_BLOCK) writeBlock();
+    }
+}
+
+bool SegmentRecorder::writeBlock() {
+    // A partial block is rewritten in place until it fills up, so every
+    // write starts on a block boundary
+    size_t done = 0;
+    while (done < blockFill) {
+        ssize_t written = pwrite(fd, block + done, blockFill - done, blockOffset + done);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "Write to " + partPath + " failed: " + std::string(strerror(errno)));
+            abandonSegment();
+            return false;
+        }
+        done += written;
+    }
+    blockDirty = false;
+
+    if (blockFill == RECORDER_WRITE_BLOCK) {
+        // Start writeback now instead of leaving a whole segment of dirty
+        // pages to the final fdatasync, and keep the recording from
+        // pushing everything else out of the page cache
+        sync_file_range(fd, blockOffset, RECORDER_WRITE_BLOCK, SYNC_FILE_RANGE_WRITE);
+        if (blockOffset >= RECORDER_WRITE_BLOCK) {
+            posix_fadvise(fd, blockOffset - RECORDER_WRITE_BLOCK, RECORDER_WRITE_BLOCK, POSIX_FADV_DONTNEED);
+        }
+        blockOffset += RECORDER_WRITE_BLOCK;
+        blockFill = 0;
+    }
+    return true;
+}
+
+void SegmentRecorder::checkpoint() {
+    uint64_t nowMs = monotonicNanos() / 1000000;
+    if (fd < 0 || nowMs - lastCheckpointMs < RECORDER_CHECKPOINT_MS) return;
+    lastCheckpointMs = nowMs;
+
+    // Bounds what a crash loses when frames stop coming
+    flushFragment();
+    if (fd >= 0 && blockDirty) writeBlock();
+}
+
+void SegmentRecorder::recoverPartialSegments() {
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return;
+    std::vector<std::string> parts;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (isSegmentName(name, prefix, PART_SUFFIX)) parts.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+
+    for (const std::string& path : parts) {
+        recoverSegment(path);
+    }
+    if (!parts.empty()) syncDirectory();
+}
+
+bool SegmentRecorder::recoverSegment(const std::string& path) {
+    int file = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (file == -1) return false;
+    struct stat st;
+    if (fstat(file, &st) == -1) {
+        close(file);
+        return false;
+    }
+
+    // Walk the top-level boxes up to the last complete fragment; a moof
+    // only counts once its mdat is complete too
+    uint64_t fileSize = st.st_size;
+    uint64_t offset = 0;
+    uint64_t complete = 0;
+    uint64_t moovEnd = 0;
+    uint8_t header[16];
+    while (offset + 8 <= fileSize) {
+        if (pread(file, header, 8, offset) != 8) break;
+        uint64_t size = readBE32(header);
+        if (size == 1) {
+            if (pread(file, header + 8, 8, offset + 8) != 8) break;
+            size = (uint64_t(readBE32(header + 8)) << 32) | readBE32(header + 12);
+        }
+        if (size < 8 || offset + size > fileSize) break;
+        offset += size;
+        if (memcmp(header + 4, "moof", 4) != 0) complete = offset;
+        if (memcmp(header + 4, "moov", 4) == 0) moovEnd = offset;
+    }
+
+    if (moovEnd == 0 || complete <= moovEnd) {
+        close(file);
+        unlink(path.c_str());
+        LOG_INFO("Removed " + path + ", it had no complete fragment.");
+        return false;
+    }
+    if (complete < fileSize && ftruncate(file, complete) == -1) {
+        LOG_WARN("Cannot truncate " + path + ": " + std::string(strerror(errno)));
+    }
+    fdatasync(file);
+    close(file);
+
+    std::string recovered = path.substr(0, path.size() - strlen(".part"));
+    if (rename(path.c_str(), recovered.c_str()) == -1) {
+        LOG_ERROR("Cannot rename " + path + ": " + std::string(strerror(errno)));
+        return false;
+    }
+    LOG_INFO("Recovered " + recovered + " (" + std::to_string(complete) + " of " +
+             std::to_string(fileSize) + " bytes).");
+    return true;
+}
+
+void SegmentRecorder::applyRetention() {
+    if (RECORDER_RETENTION_SECONDS <= 0 && RECORDER_RETENTION_BYTES == 0) return;
+
+    struct Segment {
+        std::string path;
+        time_t modified;
+        uint64_t size;
+    };
+    std::vector<Segment> segments;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (!isSegmentName(name, prefix, SEGMENT_SUFFIX)) continue;
+        Segment segment;
+        segment.path = directory + "/" + name;
+        struct stat st;
+        if (stat(segment.path.c_str(), &st) == -1) continue;
+        segment.modified = st.st_mtime;
+        segment.size = st.st_size;
+        segments.push_back(segment);
+    }
+    closedir(dir);
+
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+        return a.modified != b.modified ? a.modified < b.modified : a.path < b.path;
+    });
+    uint64_t total = 0;
+    for (const Segment& segment : segments) total += segment.size;
+
+    // Oldest first; the newest segment is always kept
+    time_t now = time(nullptr);
+    for (size_t i = 0; i + 1 < segments.size(); ++i) {
+        bool tooOld = RECORDER_RETENTION_SECONDS > 0 && now - segments[i].modified > RECORDER_RETENTION_SECONDS;
+        bool tooBig = RECORDER_RETENTION_BYTES > 0 && total > RECORDER_RETENTION_BYTES;
+        if (!tooOld && !tooBig) break;
+        if (unlink(segments[i].path.c_str()) == 0) {
+            total -= segments[i].size;
+            LOG_INFO("Deleted old segment " + segments[i].path);
+        }
+    }
+}
+
+void SegmentRecorder::syncDirectory() {
+    int dir = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1) return;
+    fsync(dir);
+    close(dir);
+}
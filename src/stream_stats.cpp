@@ -0,0 +1,103 @@
+#include "stream_stats.h"
+#include <cstdio>
+
+static void writeHeader(std::string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+static void writeCounter(std::string& out, const std::vector<LabeledStats>& streams, const char* name,
+                         const char* help, std::atomic<uint64_t> StreamStats::*counter) {
+    writeHeader(out, name, "counter", help);
+    char line[256];
+    for (const LabeledStats& stream : streams) {
+        snprintf(line, sizeof(line), "%s{%s} %llu\n", name, stream.labels.c_str(),
+                 (unsigned long long)(stream.stats->*counter).load(std::memory_order_relaxed));
+        out += line;
+    }
+}
+
+static void writeGauge(std::string& out, const std::vector<LabeledStats>& streams, const char* name,
+                       const char* help, std::atomic<uint64_t> StreamStats::*gauge) {
+    writeHeader(out, name, "gauge", help);
+    char line[256];
+    for (const LabeledStats& stream : streams) {
+        snprintf(line, sizeof(line), "%s{%s} %llu\n", name, stream.labels.c_str(),
+                 (unsigned long long)(stream.stats->*gauge).load(std::memory_order_relaxed));
+        out += line;
+    }
+}
+
+static void writeHistogram(std::string& out, const std::vector<LabeledStats>& streams, const char* name,
+                           const char* help, LatencyHistogram StreamStats::*histogram) {
+    writeHeader(out, name, "histogram", help);
+    for (const LabeledStats& stream : streams) {
+        (stream.stats->*histogram).writePrometheus(out, name, stream.labels);
+    }
+}
+
+std::string formatPrometheus(const std::vector<LabeledStats>& streams) {
+    std::string out;
+    out.reserve(16384);
+
+    writeHistogram(out, streams, "v4l2_driver_to_dequeue_seconds",
+                   "Driver buffer timestamp to VIDIOC_DQBUF.", &StreamStats::driverToDequeue);
+    writeHistogram(out, streams, "v4l2_dequeue_to_delivery_seconds",
+                   "VIDIOC_DQBUF to the frame's first NAL unit reaching afterGetting().",
+                   &StreamStats::dequeueToDelivery);
+    writeHistogram(out, streams, "v4l2_delivery_to_send_seconds",
+                   "afterGetting() to the NAL unit's first RTP packet being sent.",
+                   &StreamStats::deliveryToSend);
+
+    writeCounter(out, streams, "v4l2_frames_total", "Frames dequeued for streaming.", &StreamStats::frames);
+    writeCounter(out, streams, "v4l2_bytes_total", "Encoded bytes dequeued for streaming.", &StreamStats::bytes);
+    writeCounter(out, streams, "v4l2_key_frames_total", "IDR frames dequeued.", &StreamStats::keyFrames);
+    writeCounter(out, streams, "v4l2_sequence_gaps_total", "Frames skipped by the driver.",
+                 &StreamStats::sequenceGaps);
+    writeCounter(out, streams, "v4l2_ring_drops_total", "Frames dropped on a full capture ring.",
+                 &StreamStats::ringDrops);
+    writeCounter(out, streams, "v4l2_latency_skips_total",
+                 "Stale frames skipped by lagging consumers in low-latency mode.", &StreamStats::latencySkips);
+    writeCounter(out, streams, "v4l2_truncations_total", "NAL units truncated to fit the sink buffer.",
+                 &StreamStats::truncations);
+    writeCounter(out, streams, "v4l2_truncated_bytes_total", "Bytes lost to truncation.",
+                 &StreamStats::truncatedBytes);
+    writeCounter(out, streams, "v4l2_stream_starts_total", "VIDIOC_STREAMON calls.", &StreamStats::streamStarts);
+    writeCounter(out, streams, "v4l2_resets_total", "Buffer teardowns and remaps.", &StreamStats::resets);
+
+    writeCounter(out, streams, "v4l2_key_frame_requests_total", "IDR frames forced on the encoder.",
+                 &StreamStats::keyFrameRequests);
+    writeCounter(out, streams, "v4l2_rtcp_pli_fir_total", "RTCP PLI/FIR feedback received.",
+                 &StreamStats::pictureLossIndications);
+    writeCounter(out, streams, "v4l2_bitrate_changes_total", "Adaptive bitrate adjustments.",
+                 &StreamStats::bitrateChanges);
+    writeCounter(out, streams, "v4l2_rtp_packets_total", "RTP packets sent through batched egress.",
+                 &StreamStats::rtpPackets);
+    writeCounter(out, streams, "v4l2_rtp_send_calls_total", "sendmmsg() calls for batched RTP egress.",
+                 &StreamStats::rtpSendCalls);
+    writeCounter(out, streams, "v4l2_recorder_drops_total", "Frames dropped on a full recorder queue.",
+                 &StreamStats::recorderDrops);
+    writeCounter(out, streams, "v4l2_recorded_bytes_total", "Bytes written to MP4 segments.",
+                 &StreamStats::recordedBytes);
+    writeCounter(out, streams, "v4l2_recorded_segments_total", "MP4 segments finalized.",
+                 &StreamStats::recordedSegments);
+    writeCounter(out, streams, "v4l2_dvr_overruns_total", "DVR viewers moved up after being overwritten.",
+                 &StreamStats::dvrOverruns);
+    writeCounter(out, streams, "v4l2_hls_parts_total", "LL-HLS parts published.", &StreamStats::hlsParts);
+    writeCounter(out, streams, "v4l2_frame_pool_misses_total", "Frame copies allocated on the heap.",
+                 &StreamStats::framePoolMisses);
+    writeCounter(out, streams, "v4l2_gop_cache_overflows_total", "GOPs dropped from the cache for their length or size.",
+                 &StreamStats::gopCacheOverflows);
+
+    writeGauge(out, streams, "v4l2_consumers", "Attached client streams.", &StreamStats::consumers);
+    writeGauge(out, streams, "v4l2_encoder_bitrate_bps", "Encoder target bitrate.", &StreamStats::bitrate);
+    writeGauge(out, streams, "v4l2_dvr_window_ms", "Capture time held by the DVR.", &StreamStats::dvrWindowMs);
+    return out;
+}
@@ -1,19 +1,20 @@
 #include "v4l2_capture.h"
 #include "logger.h"
-#include <iostream>
+#include "h264_nal_parser.h"
+#include <cstdio>
+#include <poll.h>
 
-v4l2Capture::v4l2Capture(const char* device) 
-    : fd(-1)
+v4l2Capture::v4l2Capture(const DeviceConfig& config) 
+    : CaptureDevice(config)
     , buffers(nullptr)
     , n_buffers(0)
-    , sps(nullptr)
-    , pps(nullptr)
-    , spsSize(0)
-    , ppsSize(0)
-    , spsPpsExtracted(false) {
-    fd = open(device, O_RDWR);
+    , requestedBuffers(BUFFER_COUNT)
+    , mappedRequest(0)
+    , zeroCopy(false)
+    , bufferGeneration(0) {
+    fd = open(config.device.c_str(), nonBlocking ? (O_RDWR | O_NONBLOCK) : O_RDWR);
     if (fd == -1) {
-        logMessage("Cannot open device " + std::string(device) + ": " + std::string(strerror(errno)));
+        LOG_ERROR("Cannot open device " + config.device + ": " + std::string(strerror(errno)));
     }
 }
 
@@ -23,34 +24,32 @@ v4l2Capture::~v4l2Capture() {
         for (unsigned int i = 0; i < n_buffers; ++i) {
             if (buffers[i].start != MAP_FAILED && buffers[i].start != nullptr) {
                 if (munmap(buffers[i].start, buffers[i].length) == -1) {
-                    logMessage("munmap error: " + std::string(strerror(errno)));
+                    LOG_ERROR("munmap error: " + std::string(strerror(errno)));
                 }
             }
         }
         delete[] buffers;
     }
-    delete[] sps;
-    delete[] pps;
     if (fd >= 0) close(fd);
 }
 
 bool v4l2Capture::initialize() {
     struct v4l2_capability cap;
     if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == -1) {
-        logMessage("VIDIOC_QUERYCAP error: " + std::string(strerror(errno)));
+        LOG_ERROR("VIDIOC_QUERYCAP error: " + std::string(strerror(errno)));
         return false;
     }
 
     // Set the format
     struct v4l2_format fmt = {0};
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = WIDTH;
-    fmt.fmt.pix.height = HEIGHT;
+    fmt.fmt.pix.width = config.width;
+    fmt.fmt.pix.height = config.height;
     fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_H264;
     fmt.fmt.pix.field = V4L2_FIELD_ANY;
 
     if (ioctl(fd, VIDIOC_S_FMT, &fmt) == -1) {
-        logMessage("VIDIOC_S_FMT error: " + std::string(strerror(errno)));
+        LOG_ERROR("VIDIOC_S_FMT error: " + std::string(strerror(errno)));
         return false;
     }
 
@@ -58,51 +57,61 @@ bool v4l2Capture::initialize() {
     struct v4l2_control control;
     
     // Set bitrate 
-    control.id = V4L2_CID_MPEG_VIDEO_BITRATE;
-    control.value = VIDEO_BITRATE;
-    if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-        logMessage("Failed to set bitrate: " + std::string(strerror(errno)));
-    }
+    setBitrate(config.bitrate);
 
     // Set GOP size to 60 (2 seconds at 30 fps)
     control.id = V4L2_CID_MPEG_VIDEO_H264_I_PERIOD;
-    control.value = GOP_SIZE;
+    control.value = config.gopSize;
     if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-        logMessage("Failed to set GOP size: " + std::string(strerror(errno)));
+        LOG_WARN("Failed to set GOP size: " + std::string(strerror(errno)));
     }
 
     // Set H.264 profile to High
     control.id = V4L2_CID_MPEG_VIDEO_H264_PROFILE;
     control.value = V4L2_MPEG_VIDEO_H264_PROFILE_HIGH;
     if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-        logMessage("Failed to set H.264 profile: " + std::string(strerror(errno)));
+        LOG_WARN("Failed to set H.264 profile: " + std::string(strerror(errno)));
     }
 
     // Set the frame rate
     struct v4l2_streamparm streamparm = {0};
     streamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    streamparm.parm.capture.timeperframe.numerator = FRAME_RATE_NUMERATOR;
-    streamparm.parm.capture.timeperframe.denominator = FRAME_RATE_DENOMINATOR;
+    streamparm.parm.capture.timeperframe.numerator = config.frameRateNumerator;
+    streamparm.parm.capture.timeperframe.denominator = config.frameRateDenominator;
     if (ioctl(fd, VIDIOC_S_PARM, &streamparm) == -1) {
-        logMessage("Failed to set frame rate: " + std::string(strerror(errno)));
+        LOG_WARN("Failed to set frame rate: " + std::string(strerror(errno)));
     }
 
     // Set rotation (if needed)
     control.id = V4L2_CID_ROTATE;
-    control.value = ROTATION_DEGREES;
+    control.value = config.rotation;
     if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-        logMessage("Failed to set rotation: " + std::string(strerror(errno)));
+        LOG_WARN("Failed to set rotation: " + std::string(strerror(errno)));
     }
 
+    // The cache key covers everything that shapes the SPS/PPS
+    char key[256];
+    snprintf(key, sizeof(key), "%s %ux%u fourcc=%08x bitrate=%d gop=%d profile=%d fps=%d/%d rotate=%d",
+             config.device.c_str(), fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.pixelformat,
+             config.bitrate, config.gopSize, (int)V4L2_MPEG_VIDEO_H264_PROFILE_HIGH,
+             config.frameRateNumerator, config.frameRateDenominator, config.rotation);
+    setParameterSetCacheKey(key);
+
     // Initialize mmap first
     if (!initializeMmap()) {
-        logMessage("Failed to initialize memory mapping.");
+        LOG_ERROR("Failed to initialize memory mapping.");
         return false;
     }
 
+    // A cached entry for this format saves a capture round-trip; the
+    // distributor checks it against the live stream later
+    if (loadCachedSpsPps()) {
+        return true;
+    }
+
     // Start capture temporarily to get SPS/PPS
     if (!startCapture()) {
-        logMessage("Failed to start capture for SPS/PPS extraction.");
+        LOG_ERROR("Failed to start capture for SPS/PPS extraction.");
         return false;
     }
 
@@ -110,7 +119,7 @@ bool v4l2Capture::initialize() {
     bool spsPpsSuccess = extractSpsPpsImmediate();
     
     if (!spsPpsSuccess) {
-        logMessage("Failed to extract SPS/PPS immediately, falling back to regular extraction.");
+        LOG_WARN("Failed to extract SPS/PPS immediately, falling back to regular extraction.");
         spsPpsSuccess = extractSpsPps();  // Try regular extraction as fallback
     }
     
@@ -118,7 +127,7 @@ bool v4l2Capture::initialize() {
     stopCapture();
 
     if (!spsPpsSuccess) {
-        logMessage("Failed to extract SPS/PPS, but memory mapping is successful.");
+        LOG_WARN("Failed to extract SPS/PPS, but memory mapping is successful.");
     }
 
     return true;
@@ -126,16 +135,18 @@ bool v4l2Capture::initialize() {
 
 bool v4l2Capture::initializeMmap() {
     struct v4l2_requestbuffers req = {0};
-    req.count = BUFFER_COUNT;
+    req.count = requestedBuffers;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
 
     if (ioctl(fd, VIDIOC_REQBUFS, &req) == -1) {
-        logMessage("VIDIOC_REQBUFS error: " + std::string(strerror(errno)));
+        LOG_ERROR("VIDIOC_REQBUFS error: " + std::string(strerror(errno)));
         return false;
     }
 
     buffers = new Buffer[req.count];
+    mappedRequest = requestedBuffers;
+    size_t maxLength = 0;
     for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
         struct v4l2_buffer buf = {0};
         buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -143,19 +154,23 @@ bool v4l2Capture::initializeMmap() {
         buf.index = n_buffers;
 
         if (ioctl(fd, VIDIOC_QUERYBUF, &buf) == -1) {
-            logMessage("VIDIOC_QUERYBUF error: " + std::string(strerror(errno)));
+            LOG_ERROR("VIDIOC_QUERYBUF error: " + std::string(strerror(errno)));
             return false;
         }
 
         buffers[n_buffers].length = buf.length;
+        if (buf.length > maxLength) maxLength = buf.length;
         buffers[n_buffers].start = mmap(NULL, buf.length, 
             PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
 
         if (buffers[n_buffers].start == MAP_FAILED) {
-            logMessage("mmap error: " + std::string(strerror(errno)));
+            LOG_ERROR("mmap error: " + std::string(strerror(errno)));
             return false;
         }
     }
+    // No copy is larger than a buffer. Only the first mapping sizes the
+    // pool, since later copies may still hold slabs.
+    framePool.reserve(maxLength, req.count);
     return true;
 }
 
@@ -167,18 +182,20 @@ bool v4l2Capture::startCapture() {
         buf.index = i;
 
         if (ioctl(fd, VIDIOC_QBUF, &buf) == -1) {
-            logMessage("VIDIOC_QBUF error: " + std::string(strerror(errno)));
+            LOG_ERROR("VIDIOC_QBUF error: " + std::string(strerror(errno)));
             return false;
         }
     }
 
     enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     if (ioctl(fd, VIDIOC_STREAMON, &type) == -1) {
-        logMessage("VIDIOC_STREAMON error: " + std::string(strerror(errno)));
+        LOG_ERROR("VIDIOC_STREAMON error: " + std::string(strerror(errno)));
         return false;
     }
+    sequenceValid = false;
+    StreamStats::add(stats.streamStarts);
 
-    logMessage("Successfully start capture.");
+    LOG_INFO("Successfully start capture.");
     return true;
 }
 
@@ -187,10 +204,13 @@ bool v4l2Capture::stopCapture() {
     
     // First stop streaming
     if (ioctl(fd, VIDIOC_STREAMOFF, &type) == -1) {
-        logMessage("VIDIOC_STREAMOFF error: " + std::string(strerror(errno)));
+        LOG_ERROR("VIDIOC_STREAMOFF error: " + std::string(strerror(errno)));
         return false;
     }
 
+    // Frames still lent out no longer own a queued buffer
+    bufferGeneration.fetch_add(1);
+
     // Dequeue all buffers
     for (unsigned int i = 0; i < n_buffers; ++i) {
         struct v4l2_buffer buf = {0};
@@ -202,7 +222,7 @@ bool v4l2Capture::stopCapture() {
         ioctl(fd, VIDIOC_DQBUF, &buf);
     }
 
-    logMessage("Successfully stop capture.");
+    LOG_INFO("Successfully stop capture.");
     return true;
 }
 
@@ -210,6 +230,8 @@ bool v4l2Capture::reset() {
     // Ensure streaming is off
     enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ioctl(fd, VIDIOC_STREAMOFF, &type);
+    bufferGeneration.fetch_add(1);
+    StreamStats::add(stats.resets);
     
     // Clear all buffers
     for (unsigned int i = 0; i < n_buffers; ++i) {
@@ -224,12 +246,15 @@ bool v4l2Capture::reset() {
     for (unsigned int i = 0; i < n_buffers; ++i) {
         if (buffers[i].start != MAP_FAILED && buffers[i].start != nullptr) {
             if (munmap(buffers[i].start, buffers[i].length) == -1) {
-                logMessage("munmap error during reset: " + std::string(strerror(errno)));
+                LOG_ERROR("munmap error during reset: " + std::string(strerror(errno)));
             }
             buffers[i].start = nullptr;
             buffers[i].length = 0;
         }
     }
+    delete[] buffers;
+    buffers = nullptr;
+    n_buffers = 0;
     
     // Request buffers with count 0 to free all buffers
     struct v4l2_requestbuffers req = {0};
@@ -237,16 +262,16 @@ bool v4l2Capture::reset() {
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
     if (ioctl(fd, VIDIOC_REQBUFS, &req) == -1) {
-        logMessage("Failed to release buffers: " + std::string(strerror(errno)));
+        LOG_ERROR("Failed to release buffers: " + std::string(strerror(errno)));
     }
     
     // Reinitialize mmap
     if (!initializeMmap()) {
-        logMessage("Failed to reinitialize mmap during reset.");
+        LOG_ERROR("Failed to reinitialize mmap during reset.");
         return false;
     }
     
-    logMessage("Successfully reset capture.");
+    LOG_INFO("Successfully reset capture.");
     return true;
 }
 
@@ -262,8 +287,13 @@ unsigned char* v4l2Capture::getFrame(size_t& length) {
     current_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     current_buf.memory = V4L2_MEMORY_MMAP;
 
-    if (ioctl(fd, VIDIOC_DQBUF, &current_buf) == -1) {
-        logMessage("VIDIOC_DQBUF error: " + std::string(strerror(errno)));
+    int ret = ioctl(fd, VIDIOC_DQBUF, &current_buf);
+    if (ret == -1 && errno == EAGAIN && nonBlocking && waitForFrame(GET_FRAME_TIMEOUT_MS)) {
+        // Callers of getFrame() expect blocking semantics
+        ret = ioctl(fd, VIDIOC_DQBUF, &current_buf);
+    }
+    if (ret == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "VIDIOC_DQBUF error: " + std::string(strerror(errno)));
         currentFrameInfo.valid = false;
         return nullptr;
     }
@@ -275,78 +305,157 @@ unsigned char* v4l2Capture::getFrame(size_t& length) {
     return static_cast<unsigned char*>(buffers[current_buf.index].start);
 }
 
+bool v4l2Capture::waitForFrame(int timeoutMs) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while (ret == -1 && errno == EINTR);
+    return ret > 0 && (pfd.revents & POLLIN);
+}
+
 unsigned char* v4l2Capture::getFrameWithoutStartCode(size_t& length) {
     unsigned char* frame = getFrame(length);
     if (frame == nullptr) return nullptr;
 
-    if (length > 3 && frame[0] == 0x00 && frame[1] == 0x00 && 
-        ((frame[2] == 0x00 && frame[3] == 0x01) || frame[2] == 0x01)) {
-        size_t startCodeSize = (frame[2] == 0x00) ? 4 : 3;
-        memmove(frame, frame + startCodeSize, length - startCodeSize);
-        length -= startCodeSize;
-    }
-
-    return frame;
+    // Skip the start code by offset; releaseFrame() works off current_buf
+    size_t startCodeSize = startCodeLength(frame, length);
+    length -= startCodeSize;
+    return frame + startCodeSize;
 }
 
 void v4l2Capture::releaseFrame() {
     if (ioctl(fd, VIDIOC_QBUF, &current_buf) == -1) {
-        logMessage("VIDIOC_QBUF error: " + std::string(strerror(errno)));
-        logMessage("Failed to queue buffer index: " + std::to_string(current_buf.index));
+        LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "VIDIOC_QBUF error for buffer " + std::to_string(current_buf.index) +
+                         ": " + std::string(strerror(errno)));
         return;
     }
 }
 
+void v4l2Capture::setZeroCopy(bool enable) {
+    zeroCopy = enable;
+    requestedBuffers = enable ? ZERO_COPY_BUFFER_COUNT : BUFFER_COUNT;
+}
+
+std::shared_ptr<EncodedFrame> v4l2Capture::readEncodedFrame() {
+    // Use a local buffer descriptor; current_buf belongs to getFrame()
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(fd, VIDIOC_DQBUF, &buf) == -1) {
+        if (errno != EAGAIN) {
+            LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "VIDIOC_DQBUF error: " + std::string(strerror(errno)));
+        }
+        return nullptr;
+    }
+    uint64_t dequeueNanos = monotonicNanos();
+    uint64_t captureNanos = dequeueNanos;
+
+    // Driver timestamps are only usable if they are on our clock
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        uint64_t driverNanos = uint64_t(buf.timestamp.tv_sec) * 1000000000ULL +
+                               uint64_t(buf.timestamp.tv_usec) * 1000ULL;
+        if (driverNanos != 0 && dequeueNanos >= driverNanos) {
+            stats.driverToDequeue.record((dequeueNanos - driverNanos) / 1000);
+            captureNanos = driverNanos;
+        }
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(buffers[buf.index].start);
+    size_t length = buf.bytesused;
+
+    // Skip the start code by offset, never by moving the data
+    size_t startCodeSize = startCodeLength(data, length);
+
+    std::shared_ptr<EncodedFrame> frame;
+    if (zeroCopy) {
+        unsigned int index = buf.index;
+        unsigned generation = bufferGeneration.load();
+        frame = framePool.lend([this, index, generation]() { requeueBuffer(index, generation); });
+        frame->bufferIndex = index;
+        frame->data = data + startCodeSize;
+    } else {
+        uint8_t* payload;
+        frame = framePool.allocate(length - startCodeSize, payload);
+        memcpy(payload, data + startCodeSize, length - startCodeSize);
+        if (ioctl(fd, VIDIOC_QBUF, &buf) == -1) {
+            LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "VIDIOC_QBUF error: " + std::string(strerror(errno)));
+        }
+    }
+
+    frame->timestamp = buf.timestamp;
+    frame->sequence = buf.sequence;
+    frame->dequeueNanos = dequeueNanos;
+    frame->captureNanos = captureNanos;
+    frame->length = length - startCodeSize;
+    frame->indexNals();
+    frameCaptured(*frame);
+    return frame;
+}
+
+void v4l2Capture::requeueBuffer(unsigned int index, unsigned generation) {
+    if (generation != bufferGeneration.load()) return;  // Stream was restarted
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (ioctl(fd, VIDIOC_QBUF, &buf) == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "VIDIOC_QBUF error for lent buffer " + std::to_string(index) +
+                         ": " + std::string(strerror(errno)));
+    }
+}
+
+bool v4l2Capture::applyBitrate(int bitsPerSecond) {
+    struct v4l2_control control;
+    control.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+    control.value = bitsPerSecond;
+    if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, "Failed to set bitrate: " + std::string(strerror(errno)));
+        return false;
+    }
+    return true;
+}
+
+bool v4l2Capture::forceKeyFrame() {
+    struct v4l2_control control;
+    control.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+    control.value = 0;
+    if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, "Failed to force keyframe: " + std::string(strerror(errno)));
+        return false;
+    }
+    return true;
+}
+
 bool v4l2Capture::extractSpsPps() {
     if (spsPpsExtracted) {
         return true;
     }
 
     const int MAX_ATTEMPTS = 30;
+    NalUnit units[MAX_NALS_PER_FRAME];
     
     for (int i = 0; i < MAX_ATTEMPTS; ++i) {
         size_t frameSize;
         unsigned char* frame = getFrame(frameSize);
         if (frame == nullptr) {
-            std::cout << "Got null frame on attempt " << i << std::endl;
+            LOG_DEBUG("Got null frame on attempt " + std::to_string(i));
             continue;
         }
 
-        size_t offset = 0;
-        while (offset + 4 < frameSize) {
-            if (frame[offset] == 0 && frame[offset+1] == 0 && 
-                frame[offset+2] == 0 && frame[offset+3] == 1) {
-                offset += 4;
-                if (offset >= frameSize) break;
-
-                uint8_t nalType = frame[offset] & 0x1F;
-
-                size_t nextNalOffset = offset;
-                while (nextNalOffset + 4 < frameSize) {
-                    if (frame[nextNalOffset] == 0 && frame[nextNalOffset+1] == 0 && 
-                        frame[nextNalOffset+2] == 0 && frame[nextNalOffset+3] == 1) {
-                        break;
-                    }
-                    nextNalOffset++;
-                }
-
-                size_t nalUnitSize = nextNalOffset - offset;
-
-                if (nalType == 7 && sps == nullptr) {
-                    spsSize = nalUnitSize;
-                    sps = new uint8_t[spsSize];
-                    memcpy(sps, frame + offset, spsSize);
-                    // logMessage("Found SPS, size: " + std::to_string(spsSize));
-                } else if (nalType == 8 && pps == nullptr) {
-                    ppsSize = nalUnitSize;
-                    pps = new uint8_t[ppsSize];
-                    memcpy(pps, frame + offset, ppsSize);
-                    // logMessage("Found PPS, size: " + std::to_string(ppsSize));
-                }
-
-                offset = nextNalOffset;
-            } else {
-                offset++;
+        size_t count = splitNalUnits(frame, frameSize, units, MAX_NALS_PER_FRAME);
+        for (size_t n = 0; n < count && n < MAX_NALS_PER_FRAME; ++n) {
+            const NalUnit& unit = units[n];
+            if (unit.type == NAL_TYPE_SPS && sps == nullptr) {
+                storeParameterSet(sps, spsSize, frame + unit.offset, unit.length);
+            } else if (unit.type == NAL_TYPE_PPS && pps == nullptr) {
+                storeParameterSet(pps, ppsSize, frame + unit.offset, unit.length);
             }
         }
 
@@ -354,34 +463,25 @@ bool v4l2Capture::extractSpsPps() {
 
         if (sps != nullptr && pps != nullptr) {
             spsPpsExtracted = true;
-            logMessage("Successfully extract SPS and PPS.");
+            spsPpsChanged();
+            LOG_INFO("Successfully extract SPS and PPS.");
             return true;
         }
     }
 
-    std::cerr << "Failed to extract SPS and PPS within " << MAX_ATTEMPTS << " attempts." << std::endl;
+    LOG_ERROR("Failed to extract SPS and PPS within " + std::to_string(MAX_ATTEMPTS) + " attempts.");
     return false;
 }
 
-void v4l2Capture::clearSpsPps() {
-    delete[] sps;
-    delete[] pps;
-    sps = nullptr;
-    pps = nullptr;
-    spsSize = 0;
-    ppsSize = 0;
-    spsPpsExtracted = false;
-    logMessage("Cleared SPS/PPS data");
-}
-
 bool v4l2Capture::extractSpsPpsImmediate() {
     const int MAX_IMMEDIATE_ATTEMPTS = 10;    
+    NalUnit units[MAX_NALS_PER_FRAME];
     
     // Force keyframe request
     struct v4l2_control control;
     control.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
     if (ioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-        logMessage("Failed to force keyframe: " + std::string(strerror(errno)));
+        LOG_WARN("Failed to force keyframe: " + std::string(strerror(errno)));
     }
     
     for (int i = 0; i < MAX_IMMEDIATE_ATTEMPTS; ++i) {
@@ -389,73 +489,23 @@ bool v4l2Capture::extractSpsPpsImmediate() {
         unsigned char* frame = getFrame(frameSize);
         
         if (frame == nullptr) {
-            logMessage("Failed to get frame on attempt " + std::to_string(i + 1));
+            LOG_DEBUG("Failed to get frame on attempt " + std::to_string(i + 1));
             continue;
         }
 
-        // Debug log the first few bytes of the frame
-        std::string frameStart = "Frame starts with: ";
-        for (int j = 0; j < std::min(16, (int)frameSize); ++j) {
-            char hex[4];
-            snprintf(hex, sizeof(hex), "%02X ", frame[j]);
-            frameStart += hex;
-        }
-        // logMessage(frameStart);
-        
         // Look for NAL units and process them
-        size_t offset = 0;
         bool foundSPS = false;
         bool foundPPS = false;
         
-        while (offset + 4 < frameSize) {
-            // Look for NAL unit start code
-            if (frame[offset] == 0x00 && frame[offset+1] == 0x00 && 
-                ((frame[offset+2] == 0x00 && frame[offset+3] == 0x01) ||
-                 (frame[offset+2] == 0x01))) {
-                
-                // Calculate start code size
-                size_t startCodeSize = (frame[offset+2] == 0x00) ? 4 : 3;
-                size_t nalStart = offset + startCodeSize;
-                
-                if (nalStart >= frameSize) break;
-                
-                // Get NAL type
-                uint8_t nalType = frame[nalStart] & 0x1F;
-                // logMessage("Found NAL type: " + std::to_string(nalType));
-                
-                // Find next NAL unit or end of frame
-                size_t nextNalOffset = nalStart;
-                while (nextNalOffset + 3 < frameSize) {
-                    if (frame[nextNalOffset] == 0x00 && frame[nextNalOffset+1] == 0x00 && 
-                        (frame[nextNalOffset+2] == 0x01 || 
-                         (nextNalOffset + 3 < frameSize && frame[nextNalOffset+2] == 0x00 && 
-                          frame[nextNalOffset+3] == 0x01))) {
-                        break;
-                    }
-                    nextNalOffset++;
-                }
-                
-                size_t nalUnitSize = nextNalOffset - nalStart;
-                
-                if (nalType == 7 && !foundSPS) {  // SPS
-                    delete[] sps;  // Delete old SPS if exists
-                    spsSize = nalUnitSize;
-                    sps = new uint8_t[spsSize];
-                    memcpy(sps, frame + nalStart, spsSize);
-                    foundSPS = true;
-                    // logMessage("Found SPS, size: " + std::to_string(spsSize));
-                } else if (nalType == 8 && !foundPPS) {  // PPS
-                    delete[] pps;  // Delete old PPS if exists
-                    ppsSize = nalUnitSize;
-                    pps = new uint8_t[ppsSize];
-                    memcpy(pps, frame + nalStart, ppsSize);
-                    foundPPS = true;
-                    // logMessage("Found PPS, size: " + std::to_string(ppsSize));
-                }
-                
-                offset = nextNalOffset;
-            } else {
-                offset++;
+        size_t count = splitNalUnits(frame, frameSize, units, MAX_NALS_PER_FRAME);
+        for (size_t n = 0; n < count && n < MAX_NALS_PER_FRAME; ++n) {
+            const NalUnit& unit = units[n];
+            if (unit.type == NAL_TYPE_SPS && !foundSPS) {
+                storeParameterSet(sps, spsSize, frame + unit.offset, unit.length);
+                foundSPS = true;
+            } else if (unit.type == NAL_TYPE_PPS && !foundPPS) {
+                storeParameterSet(pps, ppsSize, frame + unit.offset, unit.length);
+                foundPPS = true;
             }
         }
         
@@ -463,11 +513,12 @@ bool v4l2Capture::extractSpsPpsImmediate() {
         
         if (foundSPS && foundPPS) {
             spsPpsExtracted = true;
-            logMessage("Successfully extracted SPS and PPS on attempt " + std::to_string(i + 1));
+            spsPpsChanged();
+            LOG_INFO("Successfully extracted SPS and PPS on attempt " + std::to_string(i + 1));
             return true;
         }
     }
     
-    logMessage("Failed to extract SPS/PPS during immediate initialization");
+    LOG_ERROR("Failed to extract SPS/PPS during immediate initialization");
     return false;
 }
@@ -0,0 +1,148 @@
+#include "v4l2_capture_thread.h"
+#include "logger.h"
+#include "cpu_usage.h"
+#include <poll.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+v4l2CaptureThread::v4l2CaptureThread(CaptureDevice* capture)
+    : capture(capture)
+    , outputCount(0)
+    , running(false)
+    , dropped(0)
+    , cpuTime(0)
+    , nextFrameIndex(0) {
+}
+
+v4l2CaptureThread::~v4l2CaptureThread() {
+    stop();
+}
+
+int v4l2CaptureThread::addOutput(TaskScheduler& scheduler, EventTriggerId trigger, void* triggerClientData) {
+    int index = outputCount.load(std::memory_order_relaxed);
+    if (index >= CAPTURE_MAX_OUTPUTS) {
+        LOG_ERROR("Too many capture outputs, raise CAPTURE_MAX_OUTPUTS.");
+        return -1;
+    }
+
+    Output& output = outputs[index];
+    output.ring.reset(new SpscRing<FramePtr>(CAPTURE_RING_SIZE));
+    output.scheduler = &scheduler;
+    output.trigger = trigger;
+    output.triggerClientData = triggerClientData;
+    output.active.store(true, std::memory_order_relaxed);
+    // Publish the slot; the capture thread may already be running
+    outputCount.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+void v4l2CaptureThread::setOutputActive(int output, bool active) {
+    outputs[output].active.store(active, std::memory_order_release);
+}
+
+bool v4l2CaptureThread::start(uint64_t firstIndex) {
+    if (isRunning()) return true;
+    if (thread.joinable()) thread.join();  // Previous run ended on its own
+
+    nextFrameIndex = firstIndex;
+    running.store(true, std::memory_order_release);
+    thread = std::thread(&v4l2CaptureThread::run, this);
+
+    LOG_INFO("Successfully started capture thread.");
+    return true;
+}
+
+void v4l2CaptureThread::stop() {
+    if (!thread.joinable()) return;
+
+    running.store(false, std::memory_order_release);
+    thread.join();
+
+    // Drop whatever the event loops did not pick up. Only called once no
+    // output is being read any more.
+    size_t highWater = 0;
+    int count = outputCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        FramePtr frame;
+        while (outputs[i].ring->pop(frame)) {}
+        highWater = std::max(highWater, outputs[i].ring->highWaterMark());
+    }
+
+    LOG_INFO("Successfully stopped capture thread (ring high water " +
+               std::to_string(highWater) + "/" + std::to_string(ringCapacity()) +
+               ", dropped " + std::to_string(droppedFrames()) + ").");
+}
+
+bool v4l2CaptureThread::popFrame(int output, FramePtr& frame) {
+    return outputs[output].ring->pop(frame);
+}
+
+void v4l2CaptureThread::backOff(unsigned failures) {
+    if (failures <= CAPTURE_RETRY_LIMIT) return;
+    unsigned shift = std::min(failures - CAPTURE_RETRY_LIMIT - 1, 16u);
+    int ms = std::min(CAPTURE_BACKOFF_MIN_MS << shift, CAPTURE_POLL_TIMEOUT_MS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void v4l2CaptureThread::run() {
+    struct pollfd pfd;
+    pfd.fd = capture->getFd();
+    pfd.events = POLLIN;
+    // The thread CPU clock starts at zero for every run
+    uint64_t previousRuns = cpuTime.load(std::memory_order_relaxed);
+    unsigned failures = 0;   // Polls and reads in a row that gave no frame
+
+    while (running.load(std::memory_order_acquire)) {
+        // Bounded wait so stop() is noticed even if the camera goes quiet
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, CAPTURE_POLL_TIMEOUT_MS);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LOG_RATE_LIMITED(LOG_LEVEL_ERROR, "Capture thread poll error: " + std::string(strerror(errno)));
+            break;
+        }
+        if (ret == 0) continue;
+        if (pfd.revents & POLLNVAL) {
+            LOG_ERROR("Capture device fd is no longer valid, stopping capture thread.");
+            break;
+        }
+        if (!(pfd.revents & POLLIN)) {
+            // POLLERR (streaming stopped, or every buffer is out with the
+            // consumers) or POLLHUP: poll() keeps returning at once
+            LOG_RATE_LIMITED(LOG_LEVEL_WARN, std::string("Capture device poll reported ") +
+                                                 (pfd.revents & POLLHUP ? "hang-up" : "error") + ", backing off.");
+            backOff(++failures);
+            continue;
+        }
+
+        std::shared_ptr<EncodedFrame> frame = capture->readEncodedFrame();
+        cpuTime.store(previousRuns + threadCpuNanos(), std::memory_order_relaxed);
+        if (!frame) {
+            // The capture logs why
+            backOff(++failures);
+            continue;
+        }
+        failures = 0;
+        frame->index = nextFrameIndex++;
+
+        // A full ring means that event loop is behind; drop the new frame
+        // for it and let its consumers resynchronize on the index gap.
+        FramePtr shared(std::move(frame));
+        int count = outputCount.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            Output& output = outputs[i];
+            if (!output.active.load(std::memory_order_acquire)) continue;
+            FramePtr item(shared);
+            if (!output.ring->push(std::move(item))) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                StreamStats::add(capture->getStats().ringDrops);
+                continue;
+            }
+            output.scheduler->triggerEvent(output.trigger, output.triggerClientData);
+        }
+    }
+
+    running.store(false, std::memory_order_release);
+}
@@ -0,0 +1,185 @@
+#include "v4l2_dvr_framed_source.h"
+#include "logger.h"
+#include <cstring>
+
+v4l2DvrFramedSource* v4l2DvrFramedSource::createNew(UsageEnvironment& env, DvrBuffer* dvr) {
+    return new v4l2DvrFramedSource(env, dvr);
+}
+
+v4l2DvrFramedSource::v4l2DvrFramedSource(UsageEnvironment& env, DvrBuffer* dvr)
+    : FramedSource(env), fDvr(dvr), fCapture(dvr->getCapture()), fStats(fCapture->getStats()),
+      fStartNanos(UINT64_MAX) {
+    StreamStats::add(fStats.consumers);
+    if (fCapture->hasSpsPps()) {
+        fSps.assign(fCapture->getSPS(), fCapture->getSPS() + fCapture->getSPSSize());
+        fPps.assign(fCapture->getPPS(), fCapture->getPPS() + fCapture->getPPSSize());
+    }
+    fBaseTime.tv_sec = 0;
+    fBaseTime.tv_usec = 0;
+}
+
+v4l2DvrFramedSource::~v4l2DvrFramedSource() {
+    fDvr->cancelWait(this);
+    fStats.consumers.fetch_sub(1, std::memory_order_relaxed);
+    LOG_DEBUG("Successfully destroyed v4l2DvrFramedSource.");
+}
+
+uint64_t v4l2DvrFramedSource::seekTo(uint64_t captureNanos, uint64_t endNanos) {
+    // Takes effect at the next frame pulled; PLAY seeks before that
+    fStartNanos = captureNanos;
+    fEndNanos = endNanos;
+    fPositioned = false;
+    uint64_t seq;
+    if (!fDvr->findKeyFrame(captureNanos, seq)) return 0;
+    return fDvr->frame(seq).captureNanos;
+}
+
+void v4l2DvrFramedSource::doStopGettingFrames() {
+    fDvr->cancelWait(this);
+    fWaiting = false;
+    FramedSource::doStopGettingFrames();
+}
+
+void v4l2DvrFramedSource::frameStored() {
+    fWaiting = false;
+    if (isCurrentlyAwaitingData()) doGetNextFrame();
+}
+
+bool v4l2DvrFramedSource::position() {
+    uint64_t seq;
+    if (!fDvr->findKeyFrame(fStartNanos, seq)) return false;
+    fPositioned = true;
+    beginFrame(seq);
+    return true;
+}
+
+// Time to wait between two frames: their capture interval, shortened
+// while there is backlog to catch up on
+static uint64_t pacedGap(uint64_t fromNanos, uint64_t toNanos, bool catchingUp, uint64_t frameNanos) {
+    uint64_t gap = toNanos > fromNanos ? toNanos - fromNanos : 0;
+    // A capture restart leaves a hole; play across it at the nominal rate
+    if (gap > 1000000000ULL) gap = frameNanos;
+    return catchingUp ? uint64_t(gap / DVR_CATCHUP_RATE) : gap;
+}
+
+void v4l2DvrFramedSource::beginFrame(uint64_t seq) {
+    const DvrBuffer::Frame& frame = fDvr->frame(seq);
+    uint64_t frameNanos = fCapture->getConfig().frameMicros() * 1000ULL;
+    if (fFrameNanos != 0) {
+        if (fAdvanceKnown) {
+            fPlayNanos += fNextAdvance;
+        } else if (seq == fSeq + 1) {
+            // Caught up with live: the frame was waited for
+            fPlayNanos += pacedGap(fFrameNanos, frame.captureNanos, false, frameNanos);
+        } else {
+            fPlayNanos += frameNanos;  // Jumped after an overrun
+        }
+    }
+    fAdvanceKnown = false;
+
+    fSeq = seq;
+    fFrameNanos = frame.captureNanos;
+    fNalPosition = frame.position;
+    fNalsLeft = frame.nalCount;
+    fState = frame.keyFrame && !frame.parameterSets && !fSps.empty() ? SENDING_SPS : SENDING_FRAMES;
+}
+
+void v4l2DvrFramedSource::doGetNextFrame() {
+    if (fWaiting) return;
+
+    if (!fPositioned) {
+        if (!position()) {
+            fWaiting = true;
+            fDvr->waitForFrame(this);
+            return;
+        }
+    } else if (!fDvr->contains(fSeq)) {
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, std::string("DVR overwrote a viewer, skipping to the oldest IDR held."));
+        StreamStats::add(fStats.dvrOverruns);
+        fStartNanos = 0;
+        if (!position()) {
+            fPositioned = false;
+            fWaiting = true;
+            fDvr->waitForFrame(this);
+            return;
+        }
+    }
+
+    if (fState == SENDING_SPS) {
+        fState = SENDING_PPS;
+        sendParameterSet(fSps);
+        return;
+    }
+    if (fState == SENDING_PPS) {
+        fState = SENDING_FRAMES;
+        sendParameterSet(fPps);
+        return;
+    }
+    if (fNalsLeft > 0) {
+        sendNextNal();
+        return;
+    }
+
+    // Up to date with the capture: wait for it
+    if (fSeq + 1 >= fDvr->end()) {
+        fWaiting = true;
+        fDvr->waitForFrame(this);
+        return;
+    }
+    beginFrame(fSeq + 1);
+    if (fEndNanos != 0 && fFrameNanos > fEndNanos) {
+        handleClosure();
+        return;
+    }
+    doGetNextFrame();
+}
+
+void v4l2DvrFramedSource::setPresentationTime() {
+    if (fBaseTime.tv_sec == 0) gettimeofday(&fBaseTime, NULL);
+    uint64_t micros = fBaseTime.tv_usec + fPlayNanos / 1000;
+    fPresentationTime.tv_sec = fBaseTime.tv_sec + micros / 1000000;
+    fPresentationTime.tv_usec = micros % 1000000;
+}
+
+void v4l2DvrFramedSource::sendParameterSet(const std::vector<uint8_t>& nal) {
+    if (nal.size() > fMaxSize) {
+        doGetNextFrame();
+        return;
+    }
+    memcpy(fTo, nal.data(), nal.size());
+    fFrameSize = nal.size();
+    fNumTruncatedBytes = 0;
+    fDurationInMicroseconds = 0;
+    setPresentationTime();
+    FramedSource::afterGetting(this);
+}
+
+void v4l2DvrFramedSource::sendNextNal() {
+    uint32_t length;
+    const uint8_t* data = fDvr->nalAt(fNalPosition, length);
+    bool lastNal = --fNalsLeft == 0;
+
+    if (length <= fMaxSize) {
+        memcpy(fTo, data, length);
+        fFrameSize = length;
+        fNumTruncatedBytes = 0;
+    } else {
+        memcpy(fTo, data, fMaxSize);
+        fFrameSize = fMaxSize;
+        fNumTruncatedBytes = length - fMaxSize;
+        StreamStats::add(fStats.truncations);
+        StreamStats::add(fStats.truncatedBytes, fNumTruncatedBytes);
+    }
+    setPresentationTime();
+
+    fDurationInMicroseconds = 0;
+    if (lastNal && fSeq + 1 < fDvr->end()) {
+        // Backlog beyond the next frame means we are still behind live
+        bool catchingUp = fSeq + 2 < fDvr->end();
+        fNextAdvance = pacedGap(fFrameNanos, fDvr->frame(fSeq + 1).captureNanos, catchingUp,
+                                fCapture->getConfig().frameMicros() * 1000ULL);
+        fAdvanceKnown = true;
+        fDurationInMicroseconds = fNextAdvance / 1000;
+    }
+    FramedSource::afterGetting(this);
+}
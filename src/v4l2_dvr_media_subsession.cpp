@@ -0,0 +1,105 @@
+#include "v4l2_dvr_media_subsession.h"
+#include "v4l2_dvr_framed_source.h"
+#include "logger.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+// "YYYYMMDDTHHMMSS[.fraction]Z", as in RFC 2326 clock ranges
+static bool parseClockTime(const char* text, struct timeval& time) {
+    struct tm parts;
+    memset(&parts, 0, sizeof(parts));
+    int consumed = 0;
+    if (sscanf(text, "%4d%2d%2dT%2d%2d%2d%n", &parts.tm_year, &parts.tm_mon, &parts.tm_mday,
+               &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &consumed) != 6) {
+        return false;
+    }
+    parts.tm_year -= 1900;
+    parts.tm_mon -= 1;
+    time.tv_sec = timegm(&parts);
+    time.tv_usec = 0;
+    if (text[consumed] == '.') {
+        long scale = 100000;
+        for (const char* p = text + consumed + 1; *p >= '0' && *p <= '9' && scale > 0; ++p, scale /= 10) {
+            time.tv_usec += (*p - '0') * scale;
+        }
+    }
+    return time.tv_sec != (time_t)-1;
+}
+
+static char* formatClockTime(const struct timeval& time) {
+    struct tm parts;
+    time_t seconds = time.tv_sec;
+    gmtime_r(&seconds, &parts);
+    char text[32];
+    snprintf(text, sizeof(text), "%04d%02d%02dT%02d%02d%02d.%03dZ", parts.tm_year + 1900, parts.tm_mon + 1,
+             parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec, int(time.tv_usec / 1000));
+    return strDup(text);
+}
+
+v4l2DvrMediaSubsession* v4l2DvrMediaSubsession::createNew(UsageEnvironment& env, DvrBuffer* dvr,
+                                                         v4l2FrameDistributor* distributor) {
+    return new v4l2DvrMediaSubsession(env, dvr, distributor);
+}
+
+v4l2DvrMediaSubsession::v4l2DvrMediaSubsession(UsageEnvironment& env, DvrBuffer* dvr,
+                                               v4l2FrameDistributor* distributor)
+    // Playback of the past has no say in the live encoder's bitrate
+    : v4l2H264MediaSubsession(env, dvr->getCapture(), distributor, nullptr, False), fDvr(dvr) {
+}
+
+FramedSource* v4l2DvrMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate) {
+    estBitrate = 1000;
+    // The DVR keeps the capture running, so there is nothing to start
+    LOG_INFO("Setting up DVR stream for session: " + std::to_string(clientSessionId));
+
+    v4l2DvrFramedSource* source = v4l2DvrFramedSource::createNew(envir(), fDvr);
+    FramedSource* framer = H264VideoStreamDiscreteFramer::createNew(envir(), source);
+    if (framer == nullptr) {
+        Medium::close(source);
+        LOG_ERROR("Failed to create H264VideoStreamDiscreteFramer.");
+        return nullptr;
+    }
+    return framer;
+}
+
+void v4l2DvrMediaSubsession::seekStreamSource(FramedSource* inputSource, char*& absStart, char*& absEnd) {
+    struct timeval start, end;
+    if (absStart == NULL || !parseClockTime(absStart, start)) {
+        LOG_WARN("Ignoring unparsable DVR range start.");
+        return;
+    }
+    uint64_t endNanos = 0;
+    if (absEnd != NULL && parseClockTime(absEnd, end)) {
+        endNanos = fDvr->getCapture()->toMonotonic(end);
+    }
+
+    // Our source sits behind the framer
+    FramedSource* framed = static_cast<FramedFilter*>(inputSource)->inputSource();
+    v4l2DvrFramedSource* source = static_cast<v4l2DvrFramedSource*>(framed);
+    uint64_t keyFrameNanos = source->seekTo(fDvr->getCapture()->toMonotonic(start), endNanos);
+    if (keyFrameNanos == 0) return;
+
+    // The reply's Range: carries where playback really starts
+    delete[] absStart;
+    absStart = formatClockTime(fDvr->getCapture()->toWallClock(keyFrameNanos));
+    LOG_INFO("DVR playback seeks to " + std::string(absStart) + ".");
+}
+
+void v4l2DvrMediaSubsession::startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler,
+                                         void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum,
+                                         unsigned& rtpTimestamp,
+                                         ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                                         void* serverRequestAlternativeByteHandlerClientData) {
+    // Playback always starts at a stored IDR; no keyframe to force
+    OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler,
+                                               rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+                                               serverRequestAlternativeByteHandler,
+                                               serverRequestAlternativeByteHandlerClientData);
+}
+
+void v4l2DvrMediaSubsession::deleteStream(unsigned clientSessionId, void*& streamToken) {
+    LOG_INFO("Cleaning up DVR session: " + std::to_string(clientSessionId));
+    // The capture runs for the DVR whether anyone watches or not
+    OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+}
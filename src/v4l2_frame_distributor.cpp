@@ -0,0 +1,543 @@
+#include "v4l2_frame_distributor.h"
+#include "logger.h"
+#include "cpu_usage.h"
+#include <poll.h>
+#include <algorithm>
+#include <chrono>
+
+v4l2FrameDistributor* v4l2FrameDistributor::createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                                     int captureMode, bool zeroCopy, int warmMode) {
+    return new v4l2FrameDistributor(env, capture, captureMode, zeroCopy, warmMode);
+}
+
+v4l2FrameDistributor::v4l2FrameDistributor(UsageEnvironment& env, CaptureDevice* capture,
+                                           int captureMode, bool zeroCopy, int warmMode)
+    : env(env)
+    , capture(capture)
+    , captureMode(captureMode)
+    , framesReadyTrigger(0)
+    , captureThread(nullptr)
+    , historyDepth(FRAME_HISTORY_DEPTH)
+    , gopCacheBytes(0)
+    , gopCacheMaxFrames(std::max(GOP_CACHE_MAX_FRAMES, capture->getConfig().gopSize))
+    , nextFrameIndex(0)
+    , readTask(nullptr)
+    , warmMode(warmMode)
+    , lowLatency(capture->getConfig().lowLatency)
+    , prepared(false)
+    , deviceRunning(false)
+    , streaming(false)
+    , eventLoopCpu(0)
+    , cpuTimerDepth(0)
+    , primary(nullptr)
+    , captureOutput(-1)
+    , activeShards(0)
+    , spsPpsMismatchLogged(false) {
+    capture->setZeroCopy(zeroCopy);
+    if (zeroCopy) {
+        // Lent frames pin mmap buffers; leave enough queued for the driver
+        historyDepth = std::min<size_t>(FRAME_HISTORY_DEPTH,
+                                        ZERO_COPY_BUFFER_COUNT - ZERO_COPY_DRIVER_RESERVE);
+    }
+    if (captureMode == CAPTURE_MODE_THREAD) {
+        framesReadyTrigger = env.taskScheduler().createEventTrigger(framesReadyHandler);
+        captureThread = new v4l2CaptureThread(capture);
+        captureOutput = captureThread->addOutput(env.taskScheduler(), framesReadyTrigger, this);
+    }
+}
+
+v4l2FrameDistributor* v4l2FrameDistributor::createShard(UsageEnvironment& env, v4l2FrameDistributor* primary) {
+    if (primary->captureThread == nullptr) {
+        LOG_ERROR("Worker shards need CAPTURE_MODE_THREAD.");
+        return nullptr;
+    }
+    v4l2FrameDistributor* shard = new v4l2FrameDistributor(env, primary);
+    if (shard->captureOutput < 0) {
+        delete shard;
+        return nullptr;
+    }
+    return shard;
+}
+
+v4l2FrameDistributor::v4l2FrameDistributor(UsageEnvironment& env, v4l2FrameDistributor* primary)
+    : env(env)
+    , capture(primary->capture)
+    , captureMode(CAPTURE_MODE_THREAD)
+    , framesReadyTrigger(0)
+    , captureThread(primary->captureThread)
+    , historyDepth(primary->historyDepth)
+    , gopCacheBytes(0)
+    , gopCacheMaxFrames(primary->gopCacheMaxFrames)
+    , nextFrameIndex(0)
+    , readTask(nullptr)
+    , warmMode(primary->warmMode)
+    , lowLatency(primary->lowLatency)
+    , prepared(false)
+    , deviceRunning(false)
+    , streaming(false)
+    , eventLoopCpu(0)
+    , cpuTimerDepth(0)
+    , primary(primary)
+    , captureOutput(-1)
+    , activeShards(0)
+    , spsPpsMismatchLogged(false) {
+    framesReadyTrigger = env.taskScheduler().createEventTrigger(framesReadyHandler);
+    captureOutput = captureThread->addOutput(env.taskScheduler(), framesReadyTrigger, this);
+    if (captureOutput >= 0) {
+        captureThread->setOutputActive(captureOutput, false);
+    }
+    // Frames go to the shards from now on; the primary only runs the device
+    captureThread->setOutputActive(primary->captureOutput, false);
+}
+
+v4l2FrameDistributor::~v4l2FrameDistributor() {
+    stopStreaming();
+    if (primary == nullptr) delete captureThread;
+    if (framesReadyTrigger != 0) {
+        env.taskScheduler().deleteEventTrigger(framesReadyTrigger);
+    }
+}
+
+void v4l2FrameDistributor::addConsumer(Consumer* consumer) {
+    if (findConsumer(consumer) != nullptr) return;
+
+    ConsumerState state;
+    state.consumer = consumer;
+    state.waiting = false;
+    if (gopCache.empty()) {
+        state.nextIndex = nextFrameIndex;  // Start with the next live frame
+    } else {
+        state.nextIndex = gopCache.front()->index;  // Replay the cached GOP first
+    }
+    consumers.push_back(state);
+    LOG_DEBUG("Added frame consumer, now " + std::to_string(consumers.size()) + " attached (" +
+               std::to_string(gopCache.size()) + " cached frames to replay).");
+}
+
+void v4l2FrameDistributor::removeConsumer(Consumer* consumer) {
+    for (auto it = consumers.begin(); it != consumers.end(); ++it) {
+        if (it->consumer == consumer) {
+            consumers.erase(it);
+            LOG_DEBUG("Removed frame consumer, now " + std::to_string(consumers.size()) + " attached.");
+            return;
+        }
+    }
+}
+
+v4l2FrameDistributor::ConsumerState* v4l2FrameDistributor::findConsumer(Consumer* consumer) {
+    for (auto& state : consumers) {
+        if (state.consumer == consumer) return &state;
+    }
+    return nullptr;
+}
+
+bool v4l2FrameDistributor::prepare() {
+    if (primary != nullptr) {
+        std::lock_guard<std::mutex> lock(primary->shardMutex);
+        return primary->prepare();
+    }
+    if (prepared) return true;
+
+    // Remap only if initialize() hasn't mapped buffers for this mode yet
+    if (!capture->hasMappedBuffers() && !capture->reset()) {
+        LOG_ERROR("Failed to reset device for streaming");
+        return false;
+    }
+
+    // SPS/PPS loaded from the parameter set cache need no capture at all
+    if (!capture->hasSpsPps()) {
+        if (!capture->startCapture()) {
+            LOG_ERROR("Failed to start capture for streaming");
+            return false;
+        }
+
+        bool spsPpsSuccess = capture->extractSpsPps();
+        // Park the device with its buffers mapped; startStreaming() resumes it
+        capture->stopCapture();
+        if (!spsPpsSuccess) {
+            LOG_ERROR("Failed to extract SPS/PPS for streaming");
+            return false;
+        }
+    }
+
+    prepared = true;
+    return true;
+}
+
+bool v4l2FrameDistributor::startStreaming() {
+    if (streaming) return true;
+
+    if (primary != nullptr) {
+        if (!primary->acquireShard()) return false;
+        // Anything still in our ring is from an earlier run
+        FramePtr stale;
+        while (captureThread->popFrame(captureOutput, stale)) {}
+        captureThread->setOutputActive(captureOutput, true);
+        streaming = true;
+        LOG_INFO("Started worker frame distribution.");
+        return true;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    bool coldStart = !prepared;
+    if (!prepare()) return false;
+
+    // Resume a parked device: just requeue the mapped buffers and STREAMON
+    if (!deviceRunning) {
+        if (!capture->startCapture()) {
+            LOG_ERROR("Failed to resume capture for streaming");
+            return false;
+        }
+        deviceRunning = true;
+    }
+
+    if (captureThread != nullptr && !captureThread->start(nextFrameIndex)) {
+        return false;
+    }
+
+    if (captureMode == CAPTURE_MODE_NONBLOCK) {
+        env.taskScheduler().setBackgroundHandling(capture->getFd(), SOCKET_READABLE,
+                                                  deviceReadableHandler, this);
+    }
+
+    streaming = true;
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+    LOG_INFO("Successfully started frame distribution (" + std::string(coldStart ? "cold" : "warm") +
+               " start took " + std::to_string(micros / 1000) + "." +
+               std::to_string((micros % 1000) / 100) + " ms).");
+    return true;
+}
+
+void v4l2FrameDistributor::stopDelivery() {
+    if (readTask != nullptr) {
+        env.taskScheduler().unscheduleDelayedTask(readTask);
+    }
+    if (captureMode == CAPTURE_MODE_NONBLOCK) {
+        env.taskScheduler().disableBackgroundHandling(capture->getFd());
+    }
+    if (primary != nullptr) {
+        // The capture thread keeps running for the other workers
+        captureThread->setOutputActive(captureOutput, false);
+        FramePtr stale;
+        while (captureThread->popFrame(captureOutput, stale)) {}
+    } else if (captureThread != nullptr) {
+        captureThread->stop();
+        nextFrameIndex = captureThread->nextIndex();
+    }
+    recentFrames.clear();
+    clearGopCache();
+    streaming = false;
+}
+
+void v4l2FrameDistributor::idle() {
+    if (!streaming) return;
+
+    if (warmMode == WARM_CAPTURE_RUNNING) {
+        // Keep the device, thread and GOP cache hot; frames are simply not
+        // delivered to anyone until a consumer asks again.
+        LOG_INFO("No consumers left, capture stays running.");
+        return;
+    }
+
+    if (primary != nullptr) {
+        stopDelivery();
+        primary->releaseShard();
+        LOG_INFO("No consumers left on this worker.");
+        return;
+    }
+
+    if (warmMode == WARM_CAPTURE_PAUSE) {
+        stopDelivery();
+        capture->stopCapture();  // STREAMOFF; buffers stay mapped
+        deviceRunning = false;
+        LOG_INFO("No consumers left, capture paused.");
+        return;
+    }
+
+    stopStreaming();
+}
+
+bool v4l2FrameDistributor::acquireShard() {
+    std::lock_guard<std::mutex> lock(shardMutex);
+    if (activeShards == 0 && !startStreaming()) return false;
+    activeShards++;
+    return true;
+}
+
+void v4l2FrameDistributor::releaseShard() {
+    std::lock_guard<std::mutex> lock(shardMutex);
+    if (activeShards > 0 && --activeShards == 0) idle();
+}
+
+void v4l2FrameDistributor::stopStreaming() {
+    if (primary != nullptr) {
+        // The device itself belongs to the primary
+        if (streaming) {
+            stopDelivery();
+            primary->releaseShard();
+        }
+        return;
+    }
+
+    if (streaming) stopDelivery();
+    if (!prepared && !deviceRunning) return;
+
+    capture->stopCapture();
+    if (!capture->reset()) {
+        LOG_WARN("Failed to reset capture device after streaming");
+    }
+    prepared = false;
+    deviceRunning = false;
+    LOG_INFO("Successfully stopped frame distribution.");
+}
+
+void v4l2FrameDistributor::requestFrame(Consumer* consumer) {
+    ConsumerState* state = findConsumer(consumer);
+    if (state == nullptr) return;
+    ScopedCpuTimer timer(eventLoopCpu, cpuTimerDepth);
+
+    state->waiting = true;
+    if (state->nextIndex < nextFrameIndex && !recentFrames.empty()) {
+        deliverTo(*state);
+        return;
+    }
+
+    if (!streaming && !startStreaming()) return;
+    // The capture thread and the fd handler deliver on their own;
+    // only the sync mode pulls
+    if (captureMode == CAPTURE_MODE_SYNC) scheduleRead();
+}
+
+void v4l2FrameDistributor::cancelRequest(Consumer* consumer) {
+    ConsumerState* state = findConsumer(consumer);
+    if (state != nullptr) state->waiting = false;
+}
+
+void v4l2FrameDistributor::deliverTo(ConsumerState& state) {
+    FramePtr frame = findFrame(state.nextIndex);
+    // Indices skipped by a full capture ring are lost frames too
+    bool continuous = frame && frame->index == state.nextIndex;
+    if (!frame) {
+        // Consumer fell behind the history; jump to the newest frame and
+        // let it resynchronize on the next IDR.
+        frame = recentFrames.back();
+    } else if (lowLatency) {
+        frame = skipStaleFrames(frame, continuous);
+    }
+
+    state.nextIndex = frame->index + 1;
+    state.waiting = false;
+    state.consumer->deliverFrame(frame, continuous);  // May re-enter requestFrame()
+}
+
+FramePtr v4l2FrameDistributor::skipStaleFrames(const FramePtr& frame, bool& continuous) {
+    // Only live history; a GOP cache replay is sent in full
+    if (recentFrames.empty() || frame->index < recentFrames.front()->index ||
+        frame == recentFrames.back()) {
+        return frame;
+    }
+    auto first = std::lower_bound(recentFrames.begin(), recentFrames.end(), frame->index,
+        [](const FramePtr& f, uint64_t i) { return f->index < i; });
+
+    // A newer IDR makes everything before it unnecessary
+    for (auto it = recentFrames.end() - 1; it != first; --it) {
+        if ((*it)->isIDR()) {
+            StreamStats::add(capture->getStats().latencySkips, it - first);
+            continuous = true;
+            return *it;
+        }
+    }
+
+    // Otherwise only frames nothing refers to may go; the newest is kept
+    auto it = first;
+    while (it + 1 != recentFrames.end() && !(*it)->reference && (*(it + 1))->index == (*it)->index + 1) {
+        ++it;
+    }
+    if (it != first) StreamStats::add(capture->getStats().latencySkips, it - first);
+    return *it;
+}
+
+// First frame with an index >= 'index' in a deque ordered by index
+static FramePtr lowerBound(const std::deque<FramePtr>& frames, uint64_t index) {
+    auto it = std::lower_bound(frames.begin(), frames.end(), index,
+        [](const FramePtr& frame, uint64_t i) { return frame->index < i; });
+    return it == frames.end() ? FramePtr() : *it;
+}
+
+FramePtr v4l2FrameDistributor::findFrame(uint64_t index) const {
+    // Indices can have gaps where the capture ring dropped frames
+    if (!gopCache.empty() && index >= gopCache.front()->index && index <= gopCache.back()->index) {
+        return lowerBound(gopCache, index);
+    }
+    if (!recentFrames.empty() && index >= recentFrames.front()->index) {
+        return lowerBound(recentFrames, index);
+    }
+    return FramePtr();
+}
+
+void v4l2FrameDistributor::scheduleRead() {
+    if (readTask != nullptr) return;
+    readTask = env.taskScheduler().scheduleDelayedTask(0, readFrameTask, this);
+}
+
+void v4l2FrameDistributor::readFrameTask(void* clientData) {
+    static_cast<v4l2FrameDistributor*>(clientData)->readFrame();
+}
+
+void v4l2FrameDistributor::readFrame() {
+    readTask = nullptr;
+    if (!streaming) return;
+    ScopedCpuTimer timer(eventLoopCpu, cpuTimerDepth);
+
+    std::shared_ptr<EncodedFrame> frame = capture->readEncodedFrame();
+    if (!frame) {
+        // Back off briefly instead of spinning on a failing device
+        readTask = env.taskScheduler().scheduleDelayedTask(10000, readFrameTask, this);
+        return;
+    }
+    frame->index = nextFrameIndex;
+    addFrame(frame);
+
+    // Everything else the driver already has is stale by now; take it
+    // too so consumers can skip ahead. Frames captured after this read
+    // started are not stale, and a source that is always ready (fast
+    // replay) would otherwise never let the loop end.
+    if (lowLatency) {
+        uint64_t readStart = frame->dequeueNanos;
+        struct pollfd pfd;
+        pfd.fd = capture->getFd();
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+            frame = capture->readEncodedFrame();
+            if (!frame) break;
+            frame->index = nextFrameIndex;
+            addFrame(frame);
+            if (frame->captureNanos > readStart) break;
+            pfd.revents = 0;
+        }
+    }
+    deliverToWaiting();
+}
+
+void v4l2FrameDistributor::framesReadyHandler(void* clientData) {
+    static_cast<v4l2FrameDistributor*>(clientData)->framesReady();
+}
+
+void v4l2FrameDistributor::framesReady() {
+    if (!streaming) return;
+    ScopedCpuTimer timer(eventLoopCpu, cpuTimerDepth);
+
+    // One trigger may stand for several frames; take everything queued
+    FramePtr frame;
+    bool gotFrame = false;
+    while (captureThread->popFrame(captureOutput, frame)) {
+        addFrame(frame);
+        gotFrame = true;
+    }
+    if (gotFrame) deliverToWaiting();
+}
+
+void v4l2FrameDistributor::deviceReadableHandler(void* clientData, int /*mask*/) {
+    static_cast<v4l2FrameDistributor*>(clientData)->deviceReadable();
+}
+
+void v4l2FrameDistributor::deviceReadable() {
+    if (!streaming) return;
+    ScopedCpuTimer timer(eventLoopCpu, cpuTimerDepth);
+
+    // Drain every buffer the driver has ready; EAGAIN ends the loop
+    bool gotFrame = false;
+    while (true) {
+        std::shared_ptr<EncodedFrame> frame = capture->readEncodedFrame();
+        if (!frame) break;
+        frame->index = nextFrameIndex;
+        addFrame(frame);
+        gotFrame = true;
+    }
+    if (gotFrame) deliverToWaiting();
+}
+
+void v4l2FrameDistributor::addFrame(const FramePtr& frame) {
+    if (frame->hasParameterSets()) checkParameterSets(*frame);
+
+    nextFrameIndex = frame->index + 1;
+    recentFrames.push_back(frame);
+    while (recentFrames.size() > historyDepth) {
+        recentFrames.pop_front();
+    }
+
+    if (GOP_CACHE_ENABLED) cacheFrame(frame);
+}
+
+void v4l2FrameDistributor::checkParameterSets(const EncodedFrame& frame) {
+    // In-band SPS/PPS are the truth; a stale cache entry is replaced here
+    // and picked up by the next DESCRIBE
+    const NalUnit* spsUnit = nullptr;
+    const NalUnit* ppsUnit = nullptr;
+    for (unsigned i = 0; i < frame.nalCount; ++i) {
+        if (frame.nals[i].type == NAL_TYPE_SPS && spsUnit == nullptr) spsUnit = &frame.nals[i];
+        else if (frame.nals[i].type == NAL_TYPE_PPS && ppsUnit == nullptr) ppsUnit = &frame.nals[i];
+    }
+    if (spsUnit == nullptr || ppsUnit == nullptr) return;
+
+    if (primary != nullptr) {
+        // Other workers read the capture's SPS/PPS concurrently, so shards
+        // only report a mismatch; the cache is refreshed by the next
+        // single-threaded run or a cold start.
+        if (!spsPpsMismatchLogged &&
+            !capture->matchesSpsPps(frame.data + spsUnit->offset, spsUnit->length,
+                                    frame.data + ppsUnit->offset, ppsUnit->length)) {
+            LOG_WARN("In-band SPS/PPS differ from the cached ones.");
+            spsPpsMismatchLogged = true;
+        }
+        return;
+    }
+
+    capture->updateSpsPps(frame.data + spsUnit->offset, spsUnit->length,
+                          frame.data + ppsUnit->offset, ppsUnit->length);
+}
+
+void v4l2FrameDistributor::cacheFrame(const FramePtr& frame) {
+    if (frame->isIDR()) {
+        clearGopCache();
+    } else if (gopCache.empty()) {
+        return;  // Nothing useful to cache before the first IDR
+    } else if (frame->index != gopCache.back()->index + 1) {
+        // A missing frame makes the cache unusable
+        clearGopCache();
+        return;
+    } else if (gopCache.size() >= gopCacheMaxFrames || gopCacheBytes + frame->size() > GOP_CACHE_MAX_BYTES) {
+        // So does an oversized GOP; new viewers then wait for the next IDR
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, "GOP longer than " + std::to_string(gopCacheMaxFrames) + " frames or " +
+                                             std::to_string(GOP_CACHE_MAX_BYTES >> 10) + " KiB, not cached.");
+        StreamStats::add(capture->getStats().gopCacheOverflows);
+        clearGopCache();
+        return;
+    }
+
+    // Lent frames pin driver buffers, so the cache keeps its own copy
+    gopCache.push_back(frame->isLent() ? capture->getFramePool().clone(*frame) : frame);
+    gopCacheBytes += frame->size();
+}
+
+void v4l2FrameDistributor::clearGopCache() {
+    gopCache.clear();
+    gopCacheBytes = 0;
+}
+
+void v4l2FrameDistributor::deliverToWaiting() {
+    // Deliver to everyone waiting; consumers may attach, detach or request
+    // again from inside deliverFrame(), so work from a snapshot.
+    std::vector<Consumer*> waiting;
+    for (auto& state : consumers) {
+        if (state.waiting) waiting.push_back(state.consumer);
+    }
+    for (Consumer* consumer : waiting) {
+        ConsumerState* state = findConsumer(consumer);
+        if (state != nullptr && state->waiting && state->nextIndex < nextFrameIndex) {
+            deliverTo(*state);
+        }
+    }
+}
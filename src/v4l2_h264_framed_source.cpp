@@ -1,206 +1,226 @@
 #include "v4l2_h264_framed_source.h"
 #include "logger.h"
+#include <cstring>
 
-v4l2H264FramedSource* v4l2H264FramedSource::createNew(UsageEnvironment& env, v4l2Capture* capture) {
-    return new v4l2H264FramedSource(env, capture);
+v4l2H264FramedSource* v4l2H264FramedSource::createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                                     v4l2FrameDistributor* distributor) {
+    return new v4l2H264FramedSource(env, capture, distributor);
 }
 
-v4l2H264FramedSource::v4l2H264FramedSource(UsageEnvironment& env, v4l2Capture* capture)
-    : FramedSource(env), fCapture(capture), 
-      gopState(WAITING_FOR_GOP), fCurTimestamp(90000)  {
+v4l2H264FramedSource::v4l2H264FramedSource(UsageEnvironment& env, CaptureDevice* capture,
+                                           v4l2FrameDistributor* distributor)
+    : FramedSource(env), fCapture(capture), fDistributor(distributor), fCurTimestamp(90000),
+      fFrameTicks(capture->getConfig().frameTicks()),
+      fFrameDuration(capture->getConfig().frameMicros()),
+      fCaptureTimestamps(capture->getConfig().timestampMode == TIMESTAMP_MODE_CAPTURE),
+      setupTime(std::chrono::steady_clock::now()),
+      fStats(capture->getStats())  {
+
+    fDistributor->addConsumer(this);
+    fLiveIndex = fDistributor->nextIndex();
+    StreamStats::add(fStats.consumers);
 
     // Store SPS/PPS for reuse
-    if (capture->hasSpsPps()) {
+    if (capture->hasSpsPps() && capture->getSPSSize() <= MAX_PARAMETER_SET_SIZE &&
+        capture->getPPSSize() <= MAX_PARAMETER_SET_SIZE) {
         storedSpsSize = capture->getSPSSize();
         storedPpsSize = capture->getPPSSize();
-        
-        storedSps = new uint8_t[storedSpsSize];
-        storedPps = new uint8_t[storedPpsSize];
-        
         memcpy(storedSps, capture->getSPS(), storedSpsSize);
         memcpy(storedPps, capture->getPPS(), storedPpsSize);
+    } else if (capture->hasSpsPps()) {
+        LOG_WARN("SPS/PPS larger than MAX_PARAMETER_SET_SIZE, relying on in-band ones.");
     }
 }
 
 v4l2H264FramedSource::~v4l2H264FramedSource() {
-    delete[] storedSps;
-    delete[] storedPps;
-    logMessage("Successfully destroyed v4l2H264FramedSource.");
+    fDistributor->removeConsumer(this);
+    fStats.consumers.fetch_sub(1, std::memory_order_relaxed);
+    LOG_DEBUG("Successfully destroyed v4l2H264FramedSource.");
 }
 
-void v4l2H264FramedSource::doGetNextFrame() {
-    if (!foundFirstGOP) {
-        // Wait for first complete GOP
-        if (gopState == WAITING_FOR_GOP) {
-            // Try to get an IDR frame
-            size_t length;
-            unsigned char* frame = fCapture->getFrameWithoutStartCode(length);
-            
-            if (frame && length > 0 && (frame[0] & 0x1F) == 5) {
-                // Found IDR, store it
-                firstIDRFrame = new unsigned char[length];
-                firstIDRSize = length;
-                memcpy(firstIDRFrame, frame, length);
-                fCapture->releaseFrame();
-                
-                if (storedSps && storedPps) {
-                    // We have all components
-                    foundFirstGOP = true;
-
-                    // Get initial time once
-                    gettimeofday(&fInitialTime, NULL);
-                    gopState = SENDING_SPS;
-
-                    // Recursive call to start sending
-                    doGetNextFrame();  
-                }
-                return;
-            }
-            
-            if (frame) fCapture->releaseFrame();
+void v4l2H264FramedSource::doStopGettingFrames() {
+    fDistributor->cancelRequest(this);
+    FramedSource::doStopGettingFrames();
+}
 
-            // Keep trying until we get a complete GOP
-            envir().taskScheduler().scheduleDelayedTask(0,
-                (TaskFunc*)FramedSource::afterGetting, this);
-            return;
+void v4l2H264FramedSource::logStartupLatency() {
+    firstNalSent = true;
+    auto now = std::chrono::steady_clock::now();
+    auto ms = [](std::chrono::steady_clock::duration d) {
+        return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(d).count());
+    };
+    LOG_INFO("Startup latency: SETUP->PLAY " + ms(playTime - setupTime) + " ms, PLAY->first packet " +
+               ms(now - playTime) + " ms, total " + ms(now - setupTime) + " ms.");
+}
+
+// GOP_CACHE_BURST_INCREMENT (90 kHz ticks) in nanoseconds
+static const uint64_t BURST_STEP_NANOS = GOP_CACHE_BURST_INCREMENT * 100000ULL / 9;
+
+void v4l2H264FramedSource::setPresentationTime() {
+    // Every NAL unit of a frame, and the SPS/PPS sent ahead of it, share
+    // the frame's presentation time
+    if (fCaptureTimestamps && currentFrame && currentFrame->captureNanos != 0) {
+        if (currentFrame->index != fLastCaptureIndex) {
+            uint64_t nanos = currentFrame->captureNanos;
+            if (currentFrame->index < fLiveIndex) {
+                // Backlog (the cached GOP) is squeezed in just before now,
+                // so the live frames after it keep their real capture time
+                nanos = monotonicNanos() - (fLiveIndex - currentFrame->index) * BURST_STEP_NANOS;
+            }
+            // Strictly increasing across frames, whatever the driver does
+            if (fLastCaptureNanos != 0 && nanos <= fLastCaptureNanos) {
+                nanos = fLastCaptureNanos + BURST_STEP_NANOS;
+            }
+            fLastCaptureNanos = nanos;
+            fLastCaptureIndex = currentFrame->index;
         }
+        fPresentationTime = fCapture->toWallClock(fLastCaptureNanos);
+        return;
     }
-    
+
+    unsigned long long elapsedMicros = (unsigned long long)fCurTimestamp * 1000 / 90;
+    fPresentationTime = fInitialTime;
+    fPresentationTime.tv_sec += elapsedMicros / 1000000;
+    fPresentationTime.tv_usec += elapsedMicros % 1000000;
+    if (fPresentationTime.tv_usec >= 1000000) {
+        fPresentationTime.tv_sec += fPresentationTime.tv_usec / 1000000;
+        fPresentationTime.tv_usec %= 1000000;
+    }
+}
+
+void v4l2H264FramedSource::deliverNal() {
+    uint64_t start = monotonicNanos();
+    FramedSource::afterGetting(this);
+    fStats.deliveryToSend.record((monotonicNanos() - start) / 1000);
+}
+
+void v4l2H264FramedSource::doGetNextFrame() {
+    if (!playStarted) {
+        playStarted = true;
+        playTime = std::chrono::steady_clock::now();
+    }
+
     if (gopState == SENDING_SPS) {
+        gopState = SENDING_PPS;
         // Send SPS
-        if (storedSps && storedSpsSize <= fMaxSize) {
+        if (storedSpsSize > 0 && storedSpsSize <= fMaxSize) {
             memcpy(fTo, storedSps, storedSpsSize);
             fFrameSize = storedSpsSize;
-            gopState = SENDING_PPS;
-
-            // Calculate presentation time from initial time
-            unsigned long long elapsedMicros = (fCurTimestamp / 90) * 1000;
-            fPresentationTime = fInitialTime;
-            fPresentationTime.tv_sec += elapsedMicros / 1000000;
-            fPresentationTime.tv_usec += elapsedMicros % 1000000;
-            if (fPresentationTime.tv_usec >= 1000000) {
-                fPresentationTime.tv_sec += fPresentationTime.tv_usec / 1000000;
-                fPresentationTime.tv_usec %= 1000000;
-            }
+            fNumTruncatedBytes = 0;
+            setPresentationTime();
             fDurationInMicroseconds = 0;
-            FramedSource::afterGetting(this);
+            if (!firstNalSent) logStartupLatency();
+            deliverNal();
             return;
         }
     }
     
     if (gopState == SENDING_PPS) {
+        gopState = SENDING_FRAMES;
         // Send PPS
-        if (storedPps && storedPpsSize <= fMaxSize) {
+        if (storedPpsSize > 0 && storedPpsSize <= fMaxSize) {
             memcpy(fTo, storedPps, storedPpsSize);
             fFrameSize = storedPpsSize;
-            gopState = SENDING_IDR;
-
-            // Use same presentation time and timestamp as SPS
-            fPresentationTime = fInitialTime;
-            unsigned long long elapsedMicros = (fCurTimestamp / 90) * 1000;
-            fPresentationTime.tv_sec += elapsedMicros / 1000000;
-            fPresentationTime.tv_usec += elapsedMicros % 1000000;
-            if (fPresentationTime.tv_usec >= 1000000) {
-                fPresentationTime.tv_sec += fPresentationTime.tv_usec / 1000000;
-                fPresentationTime.tv_usec %= 1000000;
-            }
+            fNumTruncatedBytes = 0;
+            setPresentationTime();
             fDurationInMicroseconds = 0;
-            FramedSource::afterGetting(this);
+            deliverNal();
             return;
         }
     }
 
-    static unsigned char* pendingIDR = nullptr;
-    static size_t pendingIDRLength = 0;
-    
-    if (gopState == SENDING_IDR) {
-        // Send stored IDR for first GOP or waiting IDR
-        unsigned char* idrToSend = firstIDRFrame ? firstIDRFrame : pendingIDR;
-        size_t idrSize = firstIDRFrame ? firstIDRSize : pendingIDRLength;
-        
-        if (idrToSend && idrSize <= fMaxSize) {
-            memcpy(fTo, idrToSend, idrSize);
-            fFrameSize = idrSize;
-
-            // Use same presentation time as SPS/PPS
-            fPresentationTime = fInitialTime;
-            unsigned long long elapsedMicros = (fCurTimestamp / 90) * 1000;
-            fPresentationTime.tv_sec += elapsedMicros / 1000000;
-            fPresentationTime.tv_usec += elapsedMicros % 1000000;
-            if (fPresentationTime.tv_usec >= 1000000) {
-                fPresentationTime.tv_sec += fPresentationTime.tv_usec / 1000000;
-                fPresentationTime.tv_usec %= 1000000;
-            }
-            fDurationInMicroseconds = 33333;
-
-            // Start incrementing timestamp from here
-            fCurTimestamp += TIMESTAMP_INCREMENT;
-            
-            if (firstIDRFrame) {
-                delete[] firstIDRFrame;
-                firstIDRFrame = nullptr;
-                firstIDRSize = 0;
-            }
-            if (pendingIDR) {
-                delete[] pendingIDR;
-                pendingIDR = nullptr;
-                pendingIDRLength = 0;
-            }
-            
-            gopState = SENDING_FRAMES;
-            FramedSource::afterGetting(this);
-            return;
-        }
+    // Emit the current frame one NAL unit at a time, straight from its index
+    if (currentFrame && nextNal < currentFrame->nalCount) {
+        sendNextNal();
+        return;
     }
+    currentFrame.reset();
 
-    // Handle regular frames
-    size_t length;
-    unsigned char* frame = fCapture->getFrameWithoutStartCode(length);
-    
-    if (frame == nullptr || !fCapture->isFrameValid()) {
-        handleClosure();
-        return;
+    // Everything else comes from the shared capture; deliverFrame() continues
+    fDistributor->requestFrame(this);
+}
+
+void v4l2H264FramedSource::deliverFrame(const FramePtr& frame, bool continuous) {
+    // A lost reference frame means the decoder needs a fresh IDR before
+    // anything else makes sense
+    if (foundFirstGOP && !continuous && gopState == SENDING_FRAMES) {
+        LOG_RATE_LIMITED(LOG_LEVEL_WARN, std::string("Frame consumer fell behind, waiting for next IDR."));
+        gopState = WAITING_FOR_GOP;
+        if (KEYFRAME_ON_DEMAND) fCapture->requestKeyFrame("consumer resync");
     }
-    
-    // Check for new GOP
-    if (length > 0 && (frame[0] & 0x1F) == 5) {
-        // Store IDR and prepare new GOP
-        pendingIDR = new unsigned char[length];
-        pendingIDRLength = length;
-        memcpy(pendingIDR, frame, length);
-        fCapture->releaseFrame();
-        
-        gopState = SENDING_SPS;
-        // Don't increment timestamp here, keep current
+
+    // Check for new GOP: an IDR we can put our SPS/PPS ahead of, or one
+    // that carries its own (the only kind if ours didn't fit)
+    bool haveParameterSets = storedSpsSize > 0 && storedPpsSize > 0;
+    if (frame->isIDR() && (haveParameterSets || frame->hasParameterSets())) {
+        if (!foundFirstGOP) {
+            foundFirstGOP = true;
+
+            // Get initial time once
+            gettimeofday(&fInitialTime, NULL);
+        }
+
+        // Send our SPS/PPS ahead of the IDR unless the encoder put them
+        // in the same buffer. Don't increment timestamp here, keep current
+        currentFrame = frame;
+        nextNal = 0;
+        gopState = frame->hasParameterSets() ? SENDING_FRAMES : SENDING_SPS;
         doGetNextFrame();
         return;
     }
-    
-    // Send regular frame
-    if (length <= fMaxSize) {
-        memcpy(fTo, frame, length);
-        fFrameSize = length;
+
+    if (gopState == WAITING_FOR_GOP || frame->nalCount == 0) {
+        // Keep discarding until we get a complete GOP
+        fDistributor->requestFrame(this);
+        return;
+    }
+
+    currentFrame = frame;
+    nextNal = 0;
+    sendNextNal();
+}
+
+void v4l2H264FramedSource::sendNextNal() {
+    const NalUnit& nal = currentFrame->nals[nextNal];
+    const uint8_t* data = currentFrame->nalData(nextNal);
+    bool firstNal = nextNal == 0;
+    bool lastNal = ++nextNal == currentFrame->nalCount;
+    // Live frames only; replayed backlog would just measure its age
+    bool backlog = currentFrame->index < fLiveIndex;
+
+    if (nal.length <= fMaxSize) {
+        memcpy(fTo, data, nal.length);
+        fFrameSize = nal.length;
         fNumTruncatedBytes = 0;
     } else {
-        memcpy(fTo, frame, fMaxSize);
+        memcpy(fTo, data, fMaxSize);
         fFrameSize = fMaxSize;
-        fNumTruncatedBytes = length - fMaxSize;
+        fNumTruncatedBytes = nal.length - fMaxSize;
+        StreamStats::add(fStats.truncations);
+        StreamStats::add(fStats.truncatedBytes, fNumTruncatedBytes);
     }
 
-    // Calculate presentation time mathematically
-    unsigned long long elapsedMicros = (fCurTimestamp / 90) * 1000;  // Convert from 90kHz to microseconds
-    fPresentationTime = fInitialTime;
-    fPresentationTime.tv_sec += elapsedMicros / 1000000;
-    fPresentationTime.tv_usec += elapsedMicros % 1000000;
-    if (fPresentationTime.tv_usec >= 1000000) {
-        fPresentationTime.tv_sec += fPresentationTime.tv_usec / 1000000;
-        fPresentationTime.tv_usec %= 1000000;
+    setPresentationTime();
+
+    if (lastNal && backlog) {
+        // Backlog (e.g. the cached GOP for a new viewer): send right away
+        // with compressed timestamps so the client catches up to live
+        fDurationInMicroseconds = 0;
+        fCurTimestamp += GOP_CACHE_BURST_INCREMENT;
+    } else if (lastNal && fCaptureTimestamps) {
+        // Paced by the capture itself; the next frame is waited for
+        fDurationInMicroseconds = 0;
+    } else if (lastNal) {
+        // One frame period at the device's frame rate
+        fDurationInMicroseconds = fFrameDuration;
+        fCurTimestamp += fFrameTicks;
+    } else {
+        fDurationInMicroseconds = 0;
     }
 
-    // 30fps, 33.33ms
-    fDurationInMicroseconds = 33333;  
-    fCurTimestamp += TIMESTAMP_INCREMENT;  
-
-    fCapture->releaseFrame();
-    FramedSource::afterGetting(this);
+    if (firstNal && !backlog && currentFrame->dequeueNanos != 0) {
+        fStats.dequeueToDelivery.record((monotonicNanos() - currentFrame->dequeueNanos) / 1000);
+    }
+    if (!firstNalSent) logStartupLatency();
+    deliverNal();
 }
@@ -1,15 +1,25 @@
 #include "v4l2_h264_media_subsession.h"
 #include "v4l2_h264_framed_source.h"
+#include "v4l2_h264_rtp_sink.h"
+#include "rtcp_feedback_groupsock.h"
+#include "batching_groupsock.h"
+#include <arpa/inet.h>
+#include <cstring>
 #include "logger.h"
-#include <Base64.hh>
 
-v4l2H264MediaSubsession* v4l2H264MediaSubsession::createNew(UsageEnvironment& env, v4l2Capture* capture, Boolean reuseFirstSource) {
-    return new v4l2H264MediaSubsession(env, capture, reuseFirstSource);
+v4l2H264MediaSubsession* v4l2H264MediaSubsession::createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                                           v4l2FrameDistributor* distributor,
+                                                           BitrateController* bitrateController,
+                                                           Boolean reuseFirstSource) {
+    return new v4l2H264MediaSubsession(env, capture, distributor, bitrateController, reuseFirstSource);
 }
 
-v4l2H264MediaSubsession::v4l2H264MediaSubsession(UsageEnvironment& env, v4l2Capture* capture, Boolean reuseFirstSource)
+v4l2H264MediaSubsession::v4l2H264MediaSubsession(UsageEnvironment& env, CaptureDevice* capture,
+                                                 v4l2FrameDistributor* distributor,
+                                                 BitrateController* bitrateController, Boolean reuseFirstSource)
     : OnDemandServerMediaSubsession(env, reuseFirstSource), 
-      fCapture(capture), fAuxSDPLine(NULL) {
+      fCapture(capture), fDistributor(distributor), fBitrateController(bitrateController),
+      fAuxSDPLine(NULL), fAuxSDPLineVersion(0) {
 }
 
 v4l2H264MediaSubsession::~v4l2H264MediaSubsession() {
@@ -21,67 +31,34 @@ FramedSource* v4l2H264MediaSubsession::createNewStreamSource(unsigned clientSess
     
     // For initial setup phase
     if (clientSessionId == 0) {
-        logMessage("Initial setup phase with session 0");
-        // We need basic setup for session 0
-        if (!fCapture->hasSpsPps()) {
-            fCapture->stopCapture();
-            fCapture->reset();
-            fCapture->startCapture();
-            if (!fCapture->extractSpsPps()) {
-                logMessage("Failed to extract SPS/PPS for setup phase");
-                fCapture->stopCapture();
-                return nullptr;
-            }
-        }
-    } else if (streamingSessionId != 0 && clientSessionId != streamingSessionId) {
-        logMessage("Another client tried to connect (session " + std::to_string(clientSessionId));
-        return nullptr;
-    }
-    
-    // Update session ID for real session
-    if (streamingSessionId == 0 && clientSessionId != 0) {
-        streamingSessionId = clientSessionId;
-        
-        // Clear everything and start fresh for real session
-        fCapture->stopCapture();
-        fCapture->clearSpsPps();
-        
-        if (!fCapture->reset()) {
-            logMessage("Failed to reset device for real session");
+        LOG_DEBUG("Initial setup phase with session 0");
+        // DESCRIBE only needs SPS/PPS; the buffers stay mapped for the viewers
+        if (!fCapture->hasSpsPps() && !fDistributor->prepare()) {
+            LOG_ERROR("Failed to extract SPS/PPS for setup phase");
             return nullptr;
         }
-        
-        if (!fCapture->startCapture()) {
-            logMessage("Failed to start capture for real session");
-            return nullptr;
-        }
-
-        // Extract fresh SPS/PPS for real session
-        if (!fCapture->extractSpsPps()) {
-            logMessage("Failed to extract SPS/PPS for real session");
-            fCapture->stopCapture();
+    } else if (!fDistributor->isStreaming()) {
+        // First real viewer starts the shared capture; later viewers join it
+        if (!fDistributor->startStreaming()) {
+            LOG_ERROR("Failed to start streaming for session " + std::to_string(clientSessionId));
             return nullptr;
         }
     }
     
-    logMessage("Setting up stream for session: " + std::to_string(clientSessionId));
+    LOG_INFO("Setting up stream for session: " + std::to_string(clientSessionId));
     
     // Create our custom source
-    v4l2H264FramedSource* source = v4l2H264FramedSource::createNew(envir(), fCapture);
+    v4l2H264FramedSource* source = v4l2H264FramedSource::createNew(envir(), fCapture, fDistributor);
     if (source == nullptr) {
-        logMessage("Failed to create v4l2H264FramedSource.");
-        fCapture->stopCapture();
+        LOG_ERROR("Failed to create v4l2H264FramedSource.");
         return nullptr;
     }
-    
-    // Set the flag before wrapping with H264VideoStreamDiscreteFramer
-    source->setNeedSpsPps();
 
     // Create and return the framer
     FramedSource* framer = H264VideoStreamDiscreteFramer::createNew(envir(), source);
     if (framer == nullptr) {
         Medium::close(source);
-        logMessage("Failed to create H264VideoStreamDiscreteFramer.");
+        LOG_ERROR("Failed to create H264VideoStreamDiscreteFramer.");
         return nullptr;
     }
     
@@ -89,7 +66,7 @@ FramedSource* v4l2H264MediaSubsession::createNewStreamSource(unsigned clientSess
 }
 
 RTPSink* v4l2H264MediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource) {
-    logMessage("Creating new RTP sink with payload type: " + std::to_string(rtpPayloadTypeIfDynamic));
+    LOG_DEBUG("Creating new RTP sink with payload type: " + std::to_string(rtpPayloadTypeIfDynamic));
     
     // Ensure we have SPS/PPS
     if (!fCapture->hasSpsPps()) {
@@ -99,32 +76,67 @@ RTPSink* v4l2H264MediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock, unsi
         }
     }
 
-    return H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic,
-                                    fCapture->getSPS(), fCapture->getSPSSize(),
-                                    fCapture->getPPS(), fCapture->getPPSSize());
+    return v4l2H264RTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic,
+                                      fCapture->getSPS(), fCapture->getSPSSize(),
+                                      fCapture->getPPS(), fCapture->getPPSSize(), fBitrateController);
 }
 
-void v4l2H264MediaSubsession::deleteStream(unsigned clientSessionId, void*& streamToken) {
-    logMessage("Cleaning up session: " + std::to_string(clientSessionId));
-
-    if (clientSessionId == streamingSessionId) {
-        // Stop capture before cleanup
-        fCapture->stopCapture();
-        
-        // Reset streaming session ID
-        streamingSessionId = 0;
-        
-        // Reset device after clearing session
-        if (!fCapture->reset()) {
-            logMessage("Warning: Failed to reset capture device during cleanup");
-        }
+Groupsock* v4l2H264MediaSubsession::createGroupsock(struct sockaddr_storage const& addr, Port port) {
+    // RTP goes out on the even port; the odd one carries the client's RTCP
+    if (KEYFRAME_ON_DEMAND && (ntohs(port.num()) & 1)) {
+        return new RtcpFeedbackGroupsock(envir(), addr, port, 255, fCapture);
     }
-    
+    if (RTP_EGRESS_BATCHING && !(ntohs(port.num()) & 1)) {
+        return new BatchingGroupsock(envir(), addr, port, 255, fCapture);
+    }
+    return OnDemandServerMediaSubsession::createGroupsock(addr, port);
+}
+
+void v4l2H264MediaSubsession::startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler,
+                                          void* rtcpRRHandlerClientData, unsigned short& rtpSeqNum,
+                                          unsigned& rtpTimestamp,
+                                          ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                                          void* serverRequestAlternativeByteHandlerClientData) {
+    OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler,
+                                               rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp,
+                                               serverRequestAlternativeByteHandler,
+                                               serverRequestAlternativeByteHandlerClientData);
+
+    // Without a cached GOP to replay the viewer would wait for the next
+    // natural IDR, up to a full GOP
+    if (KEYFRAME_ON_DEMAND && !fDistributor->hasCachedGop()) {
+        fCapture->requestKeyFrame("PLAY for session " + std::to_string(clientSessionId));
+    }
+}
+
+RTCPInstance* v4l2H264MediaSubsession::createRTCP(Groupsock* RTCPgs, unsigned totSessionBW,
+                                                  unsigned char const* cname, RTPSink* sink) {
+    RTCPInstance* rtcp = OnDemandServerMediaSubsession::createRTCP(RTCPgs, totSessionBW, cname, sink);
+    // The RTSP server keeps the per-client RR handler for liveness; the
+    // general one is ours. The sink outlives its RTCP instance.
+    if (rtcp != NULL && fBitrateController != nullptr) {
+        rtcp->setRRHandler(v4l2H264RTPSink::receiverReportHandler, sink);
+    }
+    return rtcp;
+}
+
+void v4l2H264MediaSubsession::deleteStream(unsigned clientSessionId, void*& streamToken) {
+    LOG_INFO("Cleaning up session: " + std::to_string(clientSessionId));
+
+    // Closes this session's source, which detaches it from the distributor
     OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+
+    // Idle the shared capture once the last viewer has gone
+    if (fDistributor->consumerCount() == 0) {
+        fDistributor->idle();
+    }
 }
 
 char const* v4l2H264MediaSubsession::getAuxSDPLine(RTPSink* rtpSink, FramedSource* inputSource) {
-    if (fAuxSDPLine != NULL) return fAuxSDPLine;
+    // Rebuild only if the live stream brought different SPS/PPS
+    if (fAuxSDPLine != NULL && fAuxSDPLineVersion == fCapture->getSpsPpsVersion()) return fAuxSDPLine;
+    delete[] fAuxSDPLine;
+    fAuxSDPLine = NULL;
 
     if (!fCapture->hasSpsPps()) {
         if (!fCapture->extractSpsPps()) {
@@ -132,33 +144,20 @@ char const* v4l2H264MediaSubsession::getAuxSDPLine(RTPSink* rtpSink, FramedSourc
             return nullptr;
         }
     }
-    
-    u_int8_t* sps = fCapture->getSPS();
-    u_int8_t* pps = fCapture->getPPS();
-    unsigned spsSize = fCapture->getSPSSize();
-    unsigned ppsSize = fCapture->getPPSSize();
 
-    if (sps == nullptr || pps == nullptr || spsSize == 0 || ppsSize == 0) {
+    // Precomputed with the SPS/PPS (and cached on disk with them)
+    const std::string& params = fCapture->getFmtpParams();
+    if (params.empty()) {
         envir() << "Invalid SPS or PPS. Cannot create aux SDP line.\n";
         return nullptr;
     }
 
-    char* spsBase64 = base64Encode((char*)sps, spsSize);
-    char* ppsBase64 = base64Encode((char*)pps, ppsSize);
-
-    char const* fmtpFmt =
-        "a=fmtp:%d packetization-mode=1;profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s\r\n";
-    unsigned fmtpFmtSize = strlen(fmtpFmt)
-        + 3 + 6 + strlen(spsBase64) + strlen(ppsBase64);
+    char const* fmtpFmt = "a=fmtp:%d %s\r\n";
+    unsigned fmtpFmtSize = strlen(fmtpFmt) + 3 + params.size();
     char* fmtp = new char[fmtpFmtSize];
-    sprintf(fmtp, fmtpFmt,
-            rtpSink->rtpPayloadType(),
-            sps[1], sps[2], sps[3],
-            spsBase64, ppsBase64);
-
-    delete[] spsBase64;
-    delete[] ppsBase64;
+    sprintf(fmtp, fmtpFmt, rtpSink->rtpPayloadType(), params.c_str());
 
     fAuxSDPLine = fmtp;
+    fAuxSDPLineVersion = fCapture->getSpsPpsVersion();
     return fAuxSDPLine;
 }
@@ -0,0 +1,48 @@
+#include "v4l2_h264_rtp_sink.h"
+#include <arpa/inet.h>
+
+v4l2H264RTPSink* v4l2H264RTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                            u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps,
+                                            unsigned ppsSize, BitrateController* bitrateController) {
+    return new v4l2H264RTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize, bitrateController);
+}
+
+v4l2H264RTPSink::v4l2H264RTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                 u_int8_t const* sps, unsigned spsSize, u_int8_t const* pps, unsigned ppsSize,
+                                 BitrateController* bitrateController)
+    : H264VideoRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize),
+      fBitrateController(bitrateController) {
+}
+
+v4l2H264RTPSink::~v4l2H264RTPSink() {
+}
+
+void v4l2H264RTPSink::receiverReportHandler(void* clientData) {
+    static_cast<v4l2H264RTPSink*>(clientData)->onReceiverReport();
+}
+
+void v4l2H264RTPSink::onReceiverReport() {
+    if (fBitrateController == nullptr) return;
+
+    // The receiver that just reported is the one heard from last
+    RTPTransmissionStats* latest = nullptr;
+    RTPTransmissionStatsDB::Iterator it(transmissionStatsDB());
+    while (RTPTransmissionStats* stats = it.next()) {
+        if (latest == nullptr || timercmp(&stats->lastTimeReceived(), &latest->lastTimeReceived(), >)) {
+            latest = stats;
+        }
+    }
+    if (latest == nullptr) return;
+
+    char client[INET6_ADDRSTRLEN] = "?";
+    const struct sockaddr_storage& from = latest->lastFromAddress();
+    if (from.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((const struct sockaddr_in&)from).sin_addr, client, sizeof(client));
+    } else if (from.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6&)from).sin6_addr, client, sizeof(client));
+    }
+
+    // Fraction lost is 8-bit fixed point; jitter is in RTP clock units
+    fBitrateController->onReceiverReport(client, latest->packetLossRatio() / 256.0,
+                                         latest->jitter() * 1000.0 / rtpTimestampFrequency());
+}
@@ -0,0 +1,99 @@
+#include "v4l2_multicast_stream.h"
+#include "v4l2_h264_framed_source.h"
+#include "v4l2_h264_rtp_sink.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <cstring>
+#include <unistd.h>
+
+v4l2MulticastStream* v4l2MulticastStream::createNew(UsageEnvironment& env, CaptureDevice* capture,
+                                                    v4l2FrameDistributor* distributor,
+                                                    const std::string& group, int port) {
+    v4l2MulticastStream* stream = new v4l2MulticastStream(env, capture, distributor);
+    if (!stream->initialize(group, port)) {
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
+
+v4l2MulticastStream::v4l2MulticastStream(UsageEnvironment& env, CaptureDevice* capture,
+                                         v4l2FrameDistributor* distributor)
+    : fEnv(env), fCapture(capture), fDistributor(distributor), fRtpGroupsock(nullptr),
+      fRtcpGroupsock(nullptr), fSink(nullptr), fRtcp(nullptr), fSource(nullptr) {
+}
+
+v4l2MulticastStream::~v4l2MulticastStream() {
+    // RTCP sends its BYE through the sink, so it goes first
+    if (fSink != nullptr) fSink->stopPlaying();
+    Medium::close(fRtcp);
+    Medium::close(fSink);
+    Medium::close(fSource);
+    delete fRtcpGroupsock;
+    delete fRtpGroupsock;
+}
+
+bool v4l2MulticastStream::initialize(const std::string& group, int port) {
+    struct sockaddr_storage groupAddress;
+    memset(&groupAddress, 0, sizeof(groupAddress));
+    struct sockaddr_in& group4 = reinterpret_cast<struct sockaddr_in&>(groupAddress);
+    group4.sin_family = AF_INET;
+    if (inet_pton(AF_INET, group.c_str(), &group4.sin_addr) != 1) {
+        LOG_ERROR("Bad multicast group " + group);
+        return false;
+    }
+    if ((ntohl(group4.sin_addr.s_addr) >> 24) != 232) {
+        LOG_WARN(group + " is outside the SSM range 232.0.0.0/8; receivers will join it as any-source.");
+    }
+
+    // Send-only: the server never joins its own group
+    fRtpGroupsock = new Groupsock(fEnv, groupAddress, Port(port), MULTICAST_TTL);
+    fRtpGroupsock->multicastSendOnly();
+    fRtcpGroupsock = new Groupsock(fEnv, groupAddress, Port(port + 1), MULTICAST_TTL);
+    fRtcpGroupsock->multicastSendOnly();
+
+    // The SDP needs SPS/PPS before the first DESCRIBE
+    if (!fCapture->hasSpsPps() && !fDistributor->prepare()) {
+        LOG_ERROR("Failed to get SPS/PPS for the multicast stream.");
+        return false;
+    }
+    fSink = v4l2H264RTPSink::createNew(fEnv, fRtpGroupsock, 96, fCapture->getSPS(), fCapture->getSPSSize(),
+                                       fCapture->getPPS(), fCapture->getPPSSize(), nullptr);
+
+    unsigned char cname[101];
+    gethostname(reinterpret_cast<char*>(cname), sizeof(cname) - 1);
+    cname[sizeof(cname) - 1] = '\0';
+    unsigned sessionKbps = fCapture->getConfig().bitrate / 1000;
+    fRtcp = RTCPInstance::createNew(fEnv, fRtcpGroupsock, sessionKbps, cname, fSink, nullptr, True);
+
+    // Multicast has no SETUP per viewer to start the capture; it runs for
+    // as long as the mount exists
+    if (!fDistributor->isStreaming() && !fDistributor->startStreaming()) {
+        LOG_ERROR("Failed to start streaming for the multicast stream.");
+        return false;
+    }
+    v4l2H264FramedSource* source = v4l2H264FramedSource::createNew(fEnv, fCapture, fDistributor);
+    fSource = H264VideoStreamDiscreteFramer::createNew(fEnv, source);
+    if (fSource == nullptr) {
+        Medium::close(source);
+        LOG_ERROR("Failed to create H264VideoStreamDiscreteFramer.");
+        return false;
+    }
+    fSink->startPlaying(*fSource, afterPlaying, this);
+
+    LOG_INFO("Multicasting " + fCapture->getConfig().device + " to " + group + ":" + std::to_string(port) + ".");
+    return true;
+}
+
+ServerMediaSession* v4l2MulticastStream::createSession(const std::string& streamName) {
+    ServerMediaSession* sms = ServerMediaSession::createNew(fEnv, streamName.c_str(), streamName.c_str(),
+        "Multicast session streamed by \"v4l2StreamServer\"", True);
+    if (sms == nullptr) return nullptr;
+    sms->addSubsession(PassiveServerMediaSubsession::createNew(*fSink, fRtcp));
+    return sms;
+}
+
+void v4l2MulticastStream::afterPlaying(void* clientData) {
+    v4l2MulticastStream* stream = static_cast<v4l2MulticastStream*>(clientData);
+    LOG_WARN("Multicast stream of " + stream->fCapture->getConfig().device + " stopped.");
+}